@@ -0,0 +1,111 @@
+#define _GNU_SOURCE
+
+#include <sinus_convert.h>
+#include <sinus_resample.h>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHANNELS 2
+#define CHUNK 1024U         // input frames per process call
+#define SECONDS_OF_INPUT 10 // per tier and rate pair
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static const char *
+quality_name (SinusResampleQuality q)
+{
+    switch (q)
+    {
+    case SINUS_RESAMPLE_FAST:
+        return "fast";
+    case SINUS_RESAMPLE_MEDIUM:
+        return "medium";
+    case SINUS_RESAMPLE_BEST:
+        return "best";
+    }
+    return "?";
+}
+
+/* Push SECONDS_OF_INPUT of a sine through, return ns per output frame */
+static double
+bench_one (uint32_t in_rate, uint32_t out_rate, SinusResampleQuality q)
+{
+    SinusResampler *r;
+    if (sinus_resampler_init (&r, CHANNELS, in_rate, out_rate, q) < 0)
+        return -1.0;
+
+    /* Enough room for any ratio we test */
+    uint32_t out_cap = CHUNK * 8;
+    float *in = malloc (sizeof (float) * CHUNK * CHANNELS);
+    float *out = malloc (sizeof (float) * out_cap * CHANNELS);
+    if (!in || !out)
+        abort ();
+
+    for (uint32_t i = 0; i < CHUNK; ++i)
+        for (uint32_t c = 0; c < CHANNELS; ++c)
+            in[i * CHANNELS + c] = 0.5f * (float)sin (i * 0.05 + c);
+
+    uint64_t total_in = (uint64_t)in_rate * SECONDS_OF_INPUT;
+    uint64_t total_out = 0;
+    uint64_t start = now_ns ();
+
+    for (uint64_t done = 0; done < total_in;)
+    {
+        uint32_t nin = CHUNK;
+        const float *src = in;
+
+        while (nin > 0)
+        {
+            uint32_t n = nin;
+            uint32_t nout = out_cap;
+            sinus_resampler_process (r, src, &n, out, &nout);
+            src += (size_t)n * CHANNELS;
+            nin -= n;
+            total_out += nout;
+        }
+        done += CHUNK;
+    }
+
+    uint64_t elapsed = now_ns () - start;
+
+    free (in);
+    free (out);
+    sinus_resampler_deinit (r);
+
+    return total_out ? (double)elapsed / (double)total_out : -1.0;
+}
+
+int
+main (void)
+{
+    static const uint32_t pairs[][2] = {
+        { 44100, 48000 },
+        { 48000, 44100 },
+        { 44100, 96000 },
+        { 96000, 48000 },
+    };
+
+    printf ("isa: %s, %d channels\n", sinus_convert_isa (), CHANNELS);
+    printf ("%-8s %8s %8s %12s\n", "tier", "in", "out", "ns/frame");
+
+    for (unsigned q = SINUS_RESAMPLE_FAST; q <= SINUS_RESAMPLE_BEST; ++q)
+        for (unsigned i = 0; i < sizeof (pairs) / sizeof (pairs[0]); ++i)
+        {
+            double ns = bench_one (pairs[i][0], pairs[i][1],
+                                   (SinusResampleQuality)q);
+            printf ("%-8s %8u %8u %12.2f\n",
+                    quality_name ((SinusResampleQuality)q), pairs[i][0],
+                    pairs[i][1], ns);
+        }
+
+    return 0;
+}
@@ -0,0 +1,396 @@
+/*
+ * Benchmark suite, linked against one backend (see makefile).
+ *
+ *   write     - sinus_frames_write call cost per nframes/hint_min_write_frames
+ *   timed     - how far sinus_frames_write_timed lands from its timeout
+ *   jitter    - fill callback wake-ups against the time the previous fill
+ *               took to play
+ *   convert   - sample format conversion, interleaving and resampling
+ *
+ * Every result is a distribution: n, mean, p50, p90, p99 and max. Output is
+ * JSON by default, --csv for one line per result. Backend and kernel ISA are
+ * part of the output so runs can be diffed between releases and machines.
+ */
+
+#define _GNU_SOURCE
+
+#include <sinus.h>
+#include <sinus_convert.h>
+#include <sinus_resample.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef BENCH_BACKEND
+#define BENCH_BACKEND "unknown"
+#endif
+
+#define arrlen(arr) (sizeof (arr) / sizeof (arr[0]))
+
+#define RATE 48000
+#define CHANNELS 2
+#define MAX_SAMPLES 100000
+#define WRITE_NS 300000000ULL   // time spent on each write case
+#define JITTER_NS 1000000000ULL // time spent on each jitter case
+
+static bool csv;
+static bool first_result = true;
+
+static int64_t samples[MAX_SAMPLES];
+static size_t nsamples;
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sample_add (int64_t v)
+{
+    if (nsamples < MAX_SAMPLES)
+        samples[nsamples++] = v;
+}
+
+static int
+cmp_i64 (const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a;
+    int64_t y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static double
+percentile (double p)
+{
+    size_t i = (size_t)(p * (double)(nsamples - 1) + 0.5);
+    return (double)samples[i];
+}
+
+/* Summarize and clear the collected samples. scale divides every value,
+ * e.g. to turn a batch time into a per-sample time. */
+static void
+result (const char *group, const char *name, const char *unit, double scale)
+{
+    if (nsamples == 0)
+    {
+        fprintf (stderr, "%s/%s: no samples\n", group, name);
+        return;
+    }
+
+    qsort (samples, nsamples, sizeof (samples[0]), cmp_i64);
+
+    double sum = 0.0;
+    for (size_t i = 0; i < nsamples; ++i)
+        sum += (double)samples[i];
+
+    double mean = sum / (double)nsamples / scale;
+    double p50 = percentile (0.50) / scale;
+    double p90 = percentile (0.90) / scale;
+    double p99 = percentile (0.99) / scale;
+    double max = (double)samples[nsamples - 1] / scale;
+
+    if (csv)
+        printf ("%s,%s,%s,%s,%zu,%.3f,%.3f,%.3f,%.3f,%.3f\n", BENCH_BACKEND,
+                group, name, unit, nsamples, mean, p50, p90, p99, max);
+    else
+        printf ("%s    {\"group\": \"%s\", \"case\": \"%s\", \"unit\": \"%s\", "
+                "\"n\": %zu, \"mean\": %.3f, \"p50\": %.3f, \"p90\": %.3f, "
+                "\"p99\": %.3f, \"max\": %.3f}",
+                first_result ? "" : ",\n", group, name, unit, nsamples, mean,
+                p50, p90, p99, max);
+
+    first_result = false;
+    nsamples = 0;
+}
+
+static SinusContext *
+open_context (uint32_t buffer_frames, uint32_t hint)
+{
+    SinusSettings ss;
+    sinus_settings_default (&ss);
+    ss.fmt = SINUS_FORMAT_S16;
+    ss.channels = CHANNELS;
+    ss.sample_rate = RATE;
+    ss.buffer_frames = buffer_frames;
+    ss.hint_min_write_frames = hint;
+
+    SinusContext *sc;
+    if (sinus_context_init (&sc, &ss, NULL) < 0)
+        return NULL;
+
+    sinus_control_start (sc);
+    return sc;
+}
+
+static void
+bench_write (void)
+{
+    static const uint32_t nframes[] = { 64, 256, 1024 };
+    static const uint32_t hints[] = { 256, 1024, 4096 };
+    static int16_t buffer[4096 * CHANNELS];
+
+    for (unsigned h = 0; h < arrlen (hints); ++h)
+        for (unsigned f = 0; f < arrlen (nframes); ++f)
+        {
+            SinusContext *sc = open_context (4096, hints[h]);
+            if (!sc)
+                return;
+
+            uint64_t end = now_ns () + WRITE_NS;
+            while (now_ns () < end && nsamples < MAX_SAMPLES)
+            {
+                uint64_t t0 = now_ns ();
+                sinus_frames_write (sc, buffer, nframes[f]);
+                sample_add ((int64_t)(now_ns () - t0));
+            }
+
+            sinus_control_stop (sc);
+            sinus_context_deinit (sc);
+
+            char name[64];
+            snprintf (name, sizeof (name), "nframes=%u hint=%u", nframes[f],
+                      hints[h]);
+            result ("write", name, "ns/call", 1.0);
+        }
+}
+
+/* Overshoot of the timeout, negative when the call returned early */
+static void
+bench_timed (void)
+{
+    static const uint32_t timeouts_us[] = { 1000, 5000, 20000 };
+    static int16_t buffer[8192 * CHANNELS];
+
+    for (unsigned t = 0; t < arrlen (timeouts_us); ++t)
+    {
+        SinusContext *sc = open_context (4096, 1024);
+        if (!sc)
+            return;
+
+        for (int rep = 0; rep < 20; ++rep)
+        {
+            /* More than fits, so the call has to wait out the timeout */
+            uint64_t t0 = now_ns ();
+            sinus_frames_write_timed (sc, buffer, 8192, timeouts_us[t]);
+            int64_t elapsed = (int64_t)(now_ns () - t0);
+            sample_add (elapsed - (int64_t)timeouts_us[t] * 1000);
+        }
+
+        sinus_control_stop (sc);
+        sinus_context_deinit (sc);
+
+        char name[64];
+        snprintf (name, sizeof (name), "timeout_us=%u", timeouts_us[t]);
+        result ("timed", name, "us", 1000.0);
+    }
+}
+
+/* The callback has no user pointer, so it reports through these */
+static uint64_t jitter_last_ns;
+static uint32_t jitter_last_frames;
+static uint32_t jitter_calls;
+
+static sinus_ssize_t
+jitter_fill (void *frames, uint32_t frames_needed)
+{
+    uint64_t now = now_ns ();
+
+    /* It should wake up about when the previous fill has played. The first
+     * fill primes the whole buffer, so start measuring after it. */
+    if (++jitter_calls > 2)
+    {
+        int64_t expected
+            = (int64_t)((uint64_t)jitter_last_frames * 1000000000ULL / RATE);
+        sample_add ((int64_t)(now - jitter_last_ns) - expected);
+    }
+
+    jitter_last_ns = now;
+    jitter_last_frames = frames_needed;
+
+    memset (frames, 0, (size_t)frames_needed * CHANNELS * sizeof (int16_t));
+    return frames_needed;
+}
+
+static void
+bench_jitter (void)
+{
+    static const uint32_t periods[] = { 256, 1024 };
+
+    for (unsigned p = 0; p < arrlen (periods); ++p)
+    {
+        SinusContext *sc = open_context (periods[p] * 4, periods[p]);
+        if (!sc)
+            return;
+
+        jitter_calls = 0;
+        sinus_frames_fill_callback_set (sc, jitter_fill);
+
+        struct timespec ts = { .tv_sec = JITTER_NS / 1000000000ULL,
+                               .tv_nsec = JITTER_NS % 1000000000ULL };
+        nanosleep (&ts, NULL);
+
+        sinus_frames_fill_callback_set (sc, NULL);
+        sinus_control_stop (sc);
+        sinus_context_deinit (sc);
+
+        char name[64];
+        snprintf (name, sizeof (name), "period=%u", periods[p]);
+        result ("jitter", name, "us", 1000.0);
+    }
+}
+
+#define CONVERT_SAMPLES 4096
+#define CONVERT_REPS 2000
+#define RESAMPLE_REPS 500
+
+static void
+bench_convert (void)
+{
+    static const struct
+    {
+        SinusFormat from, to;
+        const char *name;
+    } pairs[] = {
+        { SINUS_FORMAT_FLOAT, SINUS_FORMAT_S16, "float->s16" },
+        { SINUS_FORMAT_S16, SINUS_FORMAT_FLOAT, "s16->float" },
+        { SINUS_FORMAT_FLOAT, SINUS_FORMAT_S32, "float->s32" },
+        { SINUS_FORMAT_S32, SINUS_FORMAT_FLOAT, "s32->float" },
+        { SINUS_FORMAT_FLOAT, SINUS_FORMAT_S24_U4, "float->s24_u4" },
+        { SINUS_FORMAT_FLOAT, SINUS_FORMAT_S24_P3, "float->s24_p3" },
+        { SINUS_FORMAT_S24_P3, SINUS_FORMAT_FLOAT, "s24_p3->float" },
+        { SINUS_FORMAT_S16, SINUS_FORMAT_S24_U4, "s16->s24_u4" },
+        { SINUS_FORMAT_FLOAT, SINUS_FORMAT_U10_P5, "float->u10_p5" },
+        { SINUS_FORMAT_S16, SINUS_FORMAT_U10_P5, "s16->u10_p5" },
+    };
+
+    static float src[CONVERT_SAMPLES * 2]; // widest format is 8 bytes
+    static float dst[CONVERT_SAMPLES * 2];
+
+    for (unsigned i = 0; i < CONVERT_SAMPLES; ++i)
+        src[i] = (float)(i % 200) / 100.0f - 1.0f;
+
+    for (unsigned p = 0; p < arrlen (pairs); ++p)
+    {
+        for (int rep = 0; rep < CONVERT_REPS; ++rep)
+        {
+            uint64_t t0 = now_ns ();
+            sinus_convert (dst, pairs[p].to, src, pairs[p].from,
+                           CONVERT_SAMPLES);
+            sample_add ((int64_t)(now_ns () - t0));
+        }
+        result ("convert", pairs[p].name, "ns/sample", CONVERT_SAMPLES);
+    }
+
+    static const uint32_t channels[] = { 2, 8 };
+    static const SinusFormat formats[] = { SINUS_FORMAT_S16,
+                                           SINUS_FORMAT_FLOAT };
+
+    for (unsigned c = 0; c < arrlen (channels); ++c)
+        for (unsigned f = 0; f < arrlen (formats); ++f)
+        {
+            uint32_t nframes = CONVERT_SAMPLES / channels[c];
+            size_t plane_bytes
+                = (size_t)nframes * (size_t)sinus_format_to_size (formats[f]);
+            const void *planes[8];
+            for (uint32_t k = 0; k < channels[c]; ++k)
+                planes[k] = (const uint8_t *)src + plane_bytes * k;
+
+            for (int rep = 0; rep < CONVERT_REPS; ++rep)
+            {
+                uint64_t t0 = now_ns ();
+                sinus_interleave (dst, planes, formats[f], channels[c],
+                                  nframes);
+                sample_add ((int64_t)(now_ns () - t0));
+            }
+
+            char name[64];
+            snprintf (name, sizeof (name), "interleave %s %uch",
+                      formats[f] == SINUS_FORMAT_S16 ? "s16" : "float",
+                      channels[c]);
+            result ("convert", name, "ns/frame", nframes);
+        }
+}
+
+static void
+bench_resample (void)
+{
+    static const uint32_t pairs[][2] = {
+        { 44100, 48000 },
+        { 48000, 44100 },
+        { 96000, 48000 },
+    };
+    static const char *quality[] = { "fast", "medium", "best" };
+    static float in[1024 * CHANNELS];
+    static float out[4096 * CHANNELS];
+
+    for (unsigned q = SINUS_RESAMPLE_FAST; q <= SINUS_RESAMPLE_BEST; ++q)
+        for (unsigned p = 0; p < arrlen (pairs); ++p)
+        {
+            SinusResampler *r;
+            if (sinus_resampler_init (&r, CHANNELS, pairs[p][0], pairs[p][1],
+                                      (SinusResampleQuality)q)
+                < 0)
+                continue;
+
+            /* Timed per 1024 input frames, reported per output frame */
+            uint64_t produced = 0;
+            for (int rep = 0; rep < RESAMPLE_REPS; ++rep)
+            {
+                uint32_t nin = arrlen (in) / CHANNELS;
+                uint32_t nout = arrlen (out) / CHANNELS;
+                uint64_t t0 = now_ns ();
+                sinus_resampler_process (r, in, &nin, out, &nout);
+                sample_add ((int64_t)(now_ns () - t0));
+                produced += nout;
+            }
+            sinus_resampler_deinit (r);
+
+            char name[64];
+            snprintf (name, sizeof (name), "resample %s %u->%u", quality[q],
+                      pairs[p][0], pairs[p][1]);
+            double per_call = (double)produced / RESAMPLE_REPS;
+            result ("convert", name, "ns/frame", per_call > 0 ? per_call : 1);
+        }
+}
+
+int
+main (int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp (argv[i], "--csv") == 0)
+            csv = true;
+        else if (strcmp (argv[i], "--json") == 0)
+            csv = false;
+        else
+        {
+            fprintf (stderr, "usage: %s [--json | --csv]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (csv)
+        printf ("backend,group,case,unit,n,mean,p50,p90,p99,max\n");
+    else
+        printf ("{\n  \"backend\": \"%s\",\n  \"isa\": \"%s\",\n"
+                "  \"results\": [\n",
+                BENCH_BACKEND, sinus_convert_isa ());
+
+    bench_write ();
+    bench_timed ();
+    bench_jitter ();
+    bench_convert ();
+    bench_resample ();
+
+    if (!csv)
+        printf ("\n  ]\n}\n");
+
+    return 0;
+}
@@ -1,9 +1,26 @@
+#define _GNU_SOURCE
+
 #include <sinus.h>
+#include <sinus_convert.h>
+#include <sinus_resample.h>
+
+#include "../common/latency.h"
+#include "../common/mix.h"
+#include "../common/ring.h"
+#include "../common/stats.h"
+#include "../common/submit.h"
 
 #include <alloca.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <alsa/asoundlib.h>
 
@@ -39,6 +56,71 @@ struct SinusContext
     snd_pcm_t *pcm;
     bool running;
     SinusSettings settings;
+    snd_pcm_uframes_t device_buffer_frames;
+
+    // format the device accepted, settings.fmt is converted to it
+    SinusFormat device_fmt;
+    void *convert_buffer; // settings.buffer_frames frames of device_fmt
+
+    // rate the device accepted, settings.sample_rate is resampled to it
+    uint32_t device_rate;
+    SinusResampler *resampler;
+    float *resample_in;  // settings.buffer_frames float frames, or NULL
+    float *resample_out; // same, NULL when device_fmt is float
+
+    // SINUS_FLAG_RING, see alsa_ring_thread
+    SinusRing ring;
+    bool ring_enabled;
+    uint32_t device_buffered; // last seen by the thread, accessed atomically
+    // Device avail the running direct write last saw less what it has
+    // written since, -1 when it read none, see alsa_fill_level
+    snd_pcm_sframes_t write_avail;
+    int ring_event; // eventfd for sinus_poll_fds_get, see alsa_ring_signal
+
+    // pull mode, see alsa_fill_thread
+    SinusFillCallback fill_cb;
+
+    // staging area for the fill callback and non-mmap begin/commit,
+    // settings.buffer_frames frames, see alsa_stage
+    void *stage;
+
+    // SND_PCM_ACCESS_RW_NONINTERLEAVED was accepted, interleaved frames
+    // are split into planar_buffer (one settings.buffer_frames plane of
+    // device_fmt per channel) on the way out
+    bool planar_access;
+    void *planar_buffer;
+
+    // SND_PCM_ACCESS_MMAP_INTERLEAVED was accepted
+    bool mmap_access;
+    snd_pcm_uframes_t mmap_offset; // of the pending sinus_frames_begin_write
+    pthread_t thread;
+    bool thread_started; // joinable
+    bool thread_quit;    // accessed atomically
+
+    // SINUS_FLAG_ADAPTIVE: writers only fill up to the target, see
+    // alsa_avail and alsa_ring_room
+    bool adaptive;
+    SinusLatency latency;
+
+    SinusMixer *mixer; // sinus_stream_open, see ../common/mix.c
+
+    SinusStats stats; // accessed atomically, see ../common/stats.h
+
+    SinusProbeStats probe; // filled once by alsa_probe
+
+    // sinus_submit, allocated on first use, see alsa_submit_thread
+    SinusSubmitQueue *submit;
+
+    // SINUS_FLAG_CAPTURE and SINUS_FLAG_DUPLEX, see alsa_capture_open. pcm
+    // stays NULL when only capturing.
+    snd_pcm_t *capture_pcm;
+    bool linked;              // snd_pcm_link worked, one call moves both
+    SinusFormat capture_fmt;  // converted to settings.fmt on the way in
+    void *capture_buffer;     // settings.buffer_frames frames of capture_fmt
+    SinusCaptureCallback capture_cb; // see alsa_capture_thread
+    pthread_t capture_thread;
+    bool capture_thread_started; // joinable
+    bool capture_quit;           // accessed atomically
 };
 
 void
@@ -53,6 +135,9 @@ sinus_settings_default (SinusSettings *ss)
     ss->sample_rate = 44100;
     ss->hint_min_write_frames = 1024;
     ss->hint_update_us = 24000;
+    ss->flags = 0;
+    ss->resample_quality = SINUS_RESAMPLE_MEDIUM;
+    ss->min_buffer_frames = 0;
 }
 
 static snd_pcm_format_t
@@ -61,6 +146,7 @@ alsa_format_from_sinus (SinusFormat fmt)
     switch (fmt)
     {
     case SINUS_FORMAT_UNKNOWN:
+    case SINUS_FORMAT_U10_P5: // no ALSA device takes it
         return SND_PCM_FORMAT_UNKNOWN;
     case SINUS_FORMAT_S8:
         return SND_PCM_FORMAT_S8;
@@ -82,41 +168,63 @@ alsa_format_from_sinus (SinusFormat fmt)
         return SND_PCM_FORMAT_FLOAT;
     case SINUS_FORMAT_FLOAT64:
         return SND_PCM_FORMAT_FLOAT64;
+    case SINUS_FORMAT_S32:
+        return SND_PCM_FORMAT_S32;
     }
 
     fprintf (stderr, "%s:%u UNREACHABLE\n", __FILE__, __LINE__);
     abort ();
 }
 
-static int
-alsa_open_and_configure (SinusContext *sc, const char *devname,
-                         SinusSettings *ss)
+static uint32_t
+alsa_period_frames (const SinusSettings *ss)
 {
-    snd_pcm_t *pcm;
+    uint32_t period = ss->hint_min_write_frames;
 
-    int err = snd_pcm_open (&pcm, devname, SND_PCM_STREAM_PLAYBACK, 0);
-    if (err < 0)
-    {
-        TODO ("real return values");
-        return -1;
-    }
+    if (period == 0 || period > ss->buffer_frames)
+        period = ss->buffer_frames;
+
+    return period;
+}
 
+/* What a device took last time, see alsa_probe_cache_load */
+typedef struct
+{
+    char device[64];
+    SinusFormat fmt;
+    uint32_t rate;
+} AlsaProbeHint;
+
+/* Negotiates ss with an open pcm. hint, when not NULL, has the format and
+ * rate to try right after the requested ones. */
+static int
+alsa_configure (SinusContext *sc, snd_pcm_t *pcm, const SinusSettings *ss,
+                const AlsaProbeHint *hint)
+{
     snd_pcm_hw_params_t *hw_params;
     snd_pcm_hw_params_alloca (&hw_params);
 
-    err = snd_pcm_hw_params_any (pcm, hw_params);
+    int err = snd_pcm_hw_params_any (pcm, hw_params);
     if (err < 0)
     {
         TODO ("real return values");
         return -1;
     }
 
-    snd_pcm_access_t access_type = SND_PCM_ACCESS_RW_NONINTERLEAVED;
-
-    if (ss->interleaved)
-    {
-        access_type = SND_PCM_ACCESS_RW_INTERLEAVED;
-    }
+    snd_pcm_access_t access_type = SND_PCM_ACCESS_RW_INTERLEAVED;
+
+    /* Planar streams are interleaved by us if the device can't take them.
+     * Otherwise prefer mmap, it lets sinus_frames_begin_write hand out the
+     * device buffer itself. */
+    if (!ss->interleaved
+        && snd_pcm_hw_params_test_access (pcm, hw_params,
+                                          SND_PCM_ACCESS_RW_NONINTERLEAVED)
+               == 0)
+        access_type = SND_PCM_ACCESS_RW_NONINTERLEAVED;
+    else if (snd_pcm_hw_params_test_access (pcm, hw_params,
+                                            SND_PCM_ACCESS_MMAP_INTERLEAVED)
+             == 0)
+        access_type = SND_PCM_ACCESS_MMAP_INTERLEAVED;
 
     err = snd_pcm_hw_params_set_access (pcm, hw_params, access_type);
     if (err < 0)
@@ -125,27 +233,34 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         return -1;
     }
 
-    snd_pcm_format_t formats[] = {
-        alsa_format_from_sinus (ss->fmt),
-        SND_PCM_FORMAT_S32_LE,
-        SND_PCM_FORMAT_S24_LE,
-        SND_PCM_FORMAT_S24_3LE,
-        SND_PCM_FORMAT_S16_LE,
+    sc->mmap_access = access_type == SND_PCM_ACCESS_MMAP_INTERLEAVED;
+    sc->planar_access = access_type == SND_PCM_ACCESS_RW_NONINTERLEAVED;
+
+    /* Anything but the requested format gets converted on the way out */
+    SinusFormat formats[] = {
+        ss->fmt,
+        hint ? hint->fmt : ss->fmt,
+        SINUS_FORMAT_S32,
+        SINUS_FORMAT_S24_U4,
+        SINUS_FORMAT_S24_P3,
+        SINUS_FORMAT_S16,
     };
 
     bool format_accepted = false;
 
     for (unsigned i = 0; i < arrlen (formats); ++i)
     {
-        err = snd_pcm_hw_params_test_format (pcm, hw_params, formats[i]);
+        snd_pcm_format_t alsa_fmt = alsa_format_from_sinus (formats[i]);
+
+        err = snd_pcm_hw_params_test_format (pcm, hw_params, alsa_fmt);
         if (err < 0)
             continue;
 
-        err = snd_pcm_hw_params_set_format (pcm, hw_params, formats[i]);
+        err = snd_pcm_hw_params_set_format (pcm, hw_params, alsa_fmt);
         if (err == 0)
         {
             format_accepted = true;
-            TODO("Update settings->fmt to real format");
+            sc->device_fmt = formats[i];
             break;
         }
     }
@@ -156,7 +271,12 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         return -1;
     }
 
-    unsigned int rates[] = { ss->sample_rate, 192000, 96000, 48000, 44100 };
+    unsigned int rates[] = { ss->sample_rate,
+                             hint ? hint->rate : ss->sample_rate,
+                             192000,
+                             96000,
+                             48000,
+                             44100 };
 
     bool rate_accepted = false;
 
@@ -170,7 +290,7 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         if (err == 0)
         {
             rate_accepted = true;
-            ss->sample_rate = rates[i];
+            sc->device_rate = rates[i];
             break;
         }
     }
@@ -188,6 +308,13 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         return -1;
     }
 
+    /* Not fatal: the device picks the nearest sizes it supports. */
+    snd_pcm_uframes_t buffer_size = ss->buffer_frames;
+    snd_pcm_hw_params_set_buffer_size_near (pcm, hw_params, &buffer_size);
+
+    snd_pcm_uframes_t period_size = alsa_period_frames (ss);
+    snd_pcm_hw_params_set_period_size_near (pcm, hw_params, &period_size, 0);
+
     err = snd_pcm_hw_params (pcm, hw_params);
     if (err < 0)
     {
@@ -195,6 +322,11 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         return -1;
     }
 
+    err = snd_pcm_hw_params_get_buffer_size (hw_params,
+                                             &sc->device_buffer_frames);
+    if (err < 0)
+        sc->device_buffer_frames = ss->buffer_frames;
+
     snd_pcm_sw_params_t *sw_params;
     snd_pcm_sw_params_alloca (&sw_params);
 
@@ -205,14 +337,21 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         return -1;
     }
 
-    err = snd_pcm_sw_params_set_avail_min (pcm, sw_params, ss->buffer_frames);
-    /* TODO: are we setting this correctly? */
+    /* Wake pollers (and the fill thread) once a period of space is free */
+    err = snd_pcm_sw_params_set_avail_min (pcm, sw_params,
+                                           alsa_period_frames (ss));
     if (err < 0)
     {
         TODO ("real return values");
         return -1;
     }
 
+    /* Stamp hardware pointer updates on CLOCK_MONOTONIC, see
+     * alsa_queue_end_ns. Not every plugin has them, so failing is fine. */
+    snd_pcm_sw_params_set_tstamp_mode (pcm, sw_params, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type (pcm, sw_params,
+                                       SND_PCM_TSTAMP_TYPE_MONOTONIC);
+
     err = snd_pcm_sw_params_set_start_threshold (pcm, sw_params, 0U);
     /* TODO: what does this do? */
     if (err < 0)
@@ -235,534 +374,3376 @@ alsa_open_and_configure (SinusContext *sc, const char *devname,
         return -1;
     }
 
-    sc->pcm = pcm;
     return 0;
 }
 
-int
-sinus_context_init (SinusContext **_sc, const SinusSettings *ss_nullable,
-                    void *user_data)
+/* Opens devname and configures it, or returns < 0 with nothing left open.
+ * The open doesn't wait for a busy device, it just fails with -EBUSY;
+ * writes block as usual afterwards. */
+static int
+alsa_open_and_configure (SinusContext *sc, const char *devname,
+                         const SinusSettings *ss, const AlsaProbeHint *hint)
 {
-    (void)user_data;
-
-    runtime_assert (_sc != NULL);
+    snd_pcm_t *pcm;
 
-    struct SinusContext *sc = malloc (sizeof (struct SinusContext));
-    runtime_assert (sc != NULL);
+    int err = snd_pcm_open (&pcm, devname, SND_PCM_STREAM_PLAYBACK,
+                            SND_PCM_NONBLOCK);
+    if (err < 0)
+        return err;
 
-    SinusSettings *_ss = (SinusSettings *)ss_nullable;
-    if (!_ss)
+    if (alsa_configure (sc, pcm, ss, hint) < 0 || snd_pcm_nonblock (pcm, 0) < 0)
     {
-        _ss = alloca (sizeof (SinusSettings));
-        sinus_settings_default (_ss);
+        snd_pcm_close (pcm);
+        return -1;
     }
 
-    const char *devnames[] = {
-        "default",    "plug:default", "hw:0,0",     "plughw:0,0", "hw:1,0",
-        "plughw:1,0", "pulse",        "plug:pulse", "jack",       "plug:jack",
-    };
+    sc->pcm = pcm;
+    return 0;
+}
 
-    bool configured = false;
+/* Tried in this order, the first one that takes the settings is used */
+static const char *const alsa_devnames[] = {
+    "default",    "plug:default", "hw:0,0",     "plughw:0,0", "hw:1,0",
+    "plughw:1,0", "pulse",        "plug:pulse", "jack",       "plug:jack",
+};
 
-    for (unsigned i = 0; i < arrlen (devnames); ++i)
-    {
-        int err = alsa_open_and_configure (sc, devnames[i], _ss);
-        if (err == 0)
-        {
-            configured = true;
-            break;
-        }
-    }
+#define ALSA_PROBE_CACHE_LINES 32
 
-    if (!configured)
+/* $SINUS_PROBE_CACHE, $XDG_CACHE_HOME/sinus/probe or ~/.cache/sinus/probe,
+ * false when caching is off. mkdirs creates the default directories. */
+static bool
+alsa_probe_cache_path (char *path, size_t size, bool mkdirs)
+{
+    const char *env = getenv ("SINUS_PROBE_CACHE");
+    if (env)
     {
-        free (sc);
-        fprintf (stderr, "Could not initialize ALSA (no device works)\n");
-        TODO ("real return values");
-        return -1;
+        if (env[0] == '\0' || strcmp (env, "off") == 0)
+            return false;
+        return (size_t)snprintf (path, size, "%s", env) < size;
     }
 
-    sc->running = false;
-    sc->settings
-        = (SinusSettings){ .buffer_frames = _ss->buffer_frames,
-                           .hint_min_write_frames = _ss->hint_min_write_frames,
-                           .hint_update_us = _ss->hint_min_write_frames,
-                           .channels = _ss->channels,
-                           .fmt = _ss->fmt,
-                           .interleaved = _ss->interleaved,
-                           .sample_rate = _ss->sample_rate };
+    const char *xdg = getenv ("XDG_CACHE_HOME");
+    const char *home = getenv ("HOME");
+    int len;
+
+    if (xdg && xdg[0] == '/')
+        len = snprintf (path, size, "%s", xdg);
+    else if (home && home[0] != '\0')
+        len = snprintf (path, size, "%s/.cache", home);
+    else
+        return false;
+
+    if (len < 0 || (size_t)len + sizeof ("/sinus/probe") > size)
+        return false;
+
+    if (mkdirs)
+        mkdir (path, 0700);
+    strcat (path, "/sinus");
+    if (mkdirs)
+        mkdir (path, 0700);
+    strcat (path, "/probe");
+    return true;
+}
 
-    *_sc = sc;
-    return 0;
+/* Lines are keyed by everything that decides whether a device works */
+static int
+alsa_probe_cache_key (char *buf, size_t size, const SinusSettings *ss)
+{
+    return snprintf (buf, size, "%u %u %u %u %u", (unsigned)ss->fmt,
+                     ss->sample_rate, ss->channels, ss->interleaved ? 1U : 0U,
+                     (ss->flags & SINUS_FLAG_NO_RESAMPLE) ? 1U : 0U);
 }
 
-void
-sinus_context_deinit (SinusContext *sc)
+/* The device that worked for ss last time, as an index into alsa_devnames,
+ * or -1. hint receives the format and rate it took. */
+static int
+alsa_probe_cache_load (const SinusSettings *ss, AlsaProbeHint *hint)
 {
-    runtime_assert (sc != NULL);
+    char path[4096];
+    char key[64];
+    char line[256];
+    int found = -1;
 
-    sc->running = false;
+    if (!alsa_probe_cache_path (path, sizeof (path), false))
+        return -1;
 
-    if (sc->pcm != NULL)
+    FILE *in = fopen (path, "r");
+    if (!in)
+        return -1;
+
+    size_t keylen = (size_t)alsa_probe_cache_key (key, sizeof (key), ss);
+
+    while (found < 0 && fgets (line, sizeof (line), in))
     {
-        // snd_pcm_drain (sc->pcm);
-        snd_pcm_close (sc->pcm);
-        sc->pcm = NULL;
+        unsigned fmt, rate;
+
+        if (strncmp (line, key, keylen) != 0 || line[keylen] != ' '
+            || sscanf (line + keylen, " %63s %u %u", hint->device, &fmt,
+                       &rate)
+                   != 3
+            || fmt == SINUS_FORMAT_UNKNOWN || fmt > SINUS_FORMAT_S32)
+            continue;
+
+        /* Only names we'd probe anyway, whatever the file says */
+        for (unsigned i = 0; i < arrlen (alsa_devnames); ++i)
+            if (strcmp (hint->device, alsa_devnames[i]) == 0)
+                found = (int)i;
+
+        hint->fmt = (SinusFormat)fmt;
+        hint->rate = rate;
     }
 
-    free (sc);
+    fclose (in);
+    return found;
 }
 
-/* Start processing frames */
-int
-sinus_control_start (SinusContext *sc)
+/* Puts ss's line first, keeps the most recent others. Written to a
+ * temporary file and renamed, so concurrent starts never see half a file. */
+static void
+alsa_probe_cache_store (const SinusSettings *ss, const char *device,
+                        SinusFormat fmt, uint32_t rate)
 {
-    runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+    char path[4096];
+    char tmp[4096 + 32];
+    char key[64];
+    char line[256];
 
-    if (sc->running)
-        return 0;
+    if (!alsa_probe_cache_path (path, sizeof (path), true))
+        return;
 
-    snd_pcm_state_t st = snd_pcm_state (sc->pcm);
-    if (st == SND_PCM_STATE_SUSPENDED)
-    {
-        int r = snd_pcm_resume (sc->pcm);
-        if (r < 0)
-        {
-            snd_pcm_prepare (sc->pcm);
-        }
-    }
+    snprintf (tmp, sizeof (tmp), "%s.%ld", path, (long)getpid ());
+    size_t keylen = (size_t)alsa_probe_cache_key (key, sizeof (key), ss);
 
-    int err = snd_pcm_pause (sc->pcm, 0);
-    if (err < 0)
+    FILE *out = fopen (tmp, "w");
+    if (!out)
+        return;
+
+    fprintf (out, "# sinus probe cache: fmt rate channels interleaved "
+                  "no_resample device device_fmt device_rate\n");
+    fprintf (out, "%s %s %u %u\n", key, device, (unsigned)fmt, rate);
+
+    FILE *in = fopen (path, "r");
+    if (in)
     {
-        if (err == -ENOSYS || err == -EOPNOTSUPP)
-        {
-            err = snd_pcm_start (sc->pcm);
-            if (err < 0)
-            {
-                snd_pcm_prepare (sc->pcm);
-                err = snd_pcm_start (sc->pcm);
-            }
-        }
-        else
+        unsigned kept = 1;
+
+        while (kept < ALSA_PROBE_CACHE_LINES && fgets (line, sizeof (line), in))
         {
-            snd_pcm_prepare (sc->pcm);
-            err = snd_pcm_start (sc->pcm);
+            if (line[0] == '#' || strchr (line, '\n') == NULL
+                || (strncmp (line, key, keylen) == 0 && line[keylen] == ' '))
+                continue;
+            fputs (line, out);
+            ++kept;
         }
+        fclose (in);
     }
 
-    if (err == 0)
-    {
-        sc->running = true;
-        return 0;
-    }
-
-    return -1;
+    if (fclose (out) != 0 || rename (tmp, path) < 0)
+        unlink (tmp);
 }
 
-/* Stop processing frames */
-int
-sinus_control_pause (SinusContext *sc)
+static void
+alsa_probe_record (SinusContext *sc, const char *device, int result,
+                   uint64_t ns)
 {
-    runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+    SinusProbeStats *stats = &sc->probe;
 
-    if (!sc->running)
-        return 0;
+    if (stats->count == SINUS_PROBE_MAX)
+        return;
 
-    int err = snd_pcm_pause (sc->pcm, 1);
-    if (err < 0)
-    {
-        if (err == -ENOSYS || err == -EOPNOTSUPP)
-        {
-            /* Pause not supported */
-            TODO ("Keep internal pause flag or something :3");
-            return -1;
-        }
-        return -1;
-    }
+    stats->candidates[stats->count++] = (SinusProbeCandidate){
+        .device = device,
+        .result = result,
+        .ns = ns,
+    };
+    if (result == 0)
+        stats->chosen = stats->count - 1;
+}
 
-    sc->running = false;
+static int
+alsa_probe_one (SinusContext *sc, unsigned index, const SinusSettings *ss,
+                const AlsaProbeHint *hint)
+{
+    uint64_t start = sinus_stats_now_ns ();
+    int err = alsa_open_and_configure (sc, alsa_devnames[index], ss, hint);
 
-    return 0;
+    alsa_probe_record (sc, alsa_devnames[index], err,
+                       sinus_stats_now_ns () - start);
+    return err;
 }
 
-/* Stop processing frames & Reset internal state */
-int
-sinus_control_stop (SinusContext *sc)
+typedef struct
 {
-    runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+    SinusContext *sc; // scratch, only gets the fields alsa_configure sets
+    const SinusSettings *ss;
+    const char *device;
+    int result;
+    uint64_t ns;
+    pthread_t thread;
+    bool started;
+} AlsaProbe;
+
+static void *
+alsa_probe_thread (void *arg)
+{
+    AlsaProbe *p = arg;
+    uint64_t start = sinus_stats_now_ns ();
 
-    if (!sc->running)
-        return 0;
+    p->result = alsa_open_and_configure (p->sc, p->device, p->ss, NULL);
+    p->ns = sinus_stats_now_ns () - start;
+    return NULL;
+}
 
-    int err = snd_pcm_drop (sc->pcm);
-    if (err < 0)
+/* Every candidate at once, the first one in alsa_devnames order that worked
+ * wins. The probes can lock each other out of shared hardware (default and
+ * hw:0,0, say), so busy candidates ahead of the winner, or all of them when
+ * nothing won, get another go one at a time once the others are closed
+ * again. */
+static int
+alsa_probe_parallel (SinusContext *sc, const SinusSettings *ss)
+{
+    AlsaProbe probes[arrlen (alsa_devnames)];
+    int found = -1;
+
+    for (unsigned i = 0; i < arrlen (alsa_devnames); ++i)
     {
-        snd_pcm_prepare (sc->pcm);
-        return -1;
+        AlsaProbe *p = &probes[i];
+
+        p->sc = calloc (1, sizeof (SinusContext));
+        runtime_assert (p->sc != NULL);
+        p->ss = ss;
+        p->device = alsa_devnames[i];
+        p->result = -1;
+        p->ns = 0;
+        p->started
+            = pthread_create (&p->thread, NULL, alsa_probe_thread, p) == 0;
+        if (!p->started)
+            alsa_probe_thread (p);
     }
 
-    err = snd_pcm_prepare (sc->pcm);
-    if (err < 0)
-        return -1;
+    sc->probe.parallel = true;
 
-    sc->running = false;
+    for (unsigned i = 0; i < arrlen (alsa_devnames); ++i)
+    {
+        AlsaProbe *p = &probes[i];
 
-    return 0;
-}
+        if (p->started)
+            pthread_join (p->thread, NULL);
 
-sinus_ssize_t
-sinus_frames_write (SinusContext *sc, const void *frames, uint32_t nframes)
-{
-    runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+        alsa_probe_record (sc, p->device, p->result, p->ns);
 
-    if (!sc->running)
-        return 0;
+        if (p->result == 0 && found < 0)
+        {
+            found = (int)i;
+            sc->pcm = p->sc->pcm;
+            sc->mmap_access = p->sc->mmap_access;
+            sc->planar_access = p->sc->planar_access;
+            sc->device_fmt = p->sc->device_fmt;
+            sc->device_rate = p->sc->device_rate;
+            sc->device_buffer_frames = p->sc->device_buffer_frames;
+        }
+        else if (p->result == 0)
+            snd_pcm_close (p->sc->pcm);
 
-    snd_pcm_state_t st = snd_pcm_state (sc->pcm);
-    if (st != SND_PCM_STATE_RUNNING)
-    {
-        return 0;
+        free (p->sc);
     }
 
-    snd_pcm_sframes_t ret = snd_pcm_writei (sc->pcm, frames, nframes);
-    if (ret >= 0)
-        return ret;
+    int ahead = found < 0 ? (int)arrlen (alsa_devnames) : found;
+    bool busy = false;
+    for (int i = 0; i < ahead; ++i)
+        busy |= probes[i].result == -EBUSY;
 
-    if (ret == -EPIPE)
+    if (busy)
     {
-        snd_pcm_prepare (sc->pcm);
-        return 0;
+        int winner = found;
+
+        if (sc->pcm)
+        {
+            snd_pcm_close (sc->pcm);
+            sc->pcm = NULL;
+        }
+        found = -1;
+
+        for (int i = 0; i < (int)arrlen (alsa_devnames) && found < 0; ++i)
+            if ((i == winner || (i < ahead && probes[i].result == -EBUSY))
+                && alsa_probe_one (sc, (unsigned)i, ss, NULL) == 0)
+                found = i;
     }
-    if (ret == -ESTRPIPE)
+
+    return found;
+}
+
+/* Finds a device for ss and leaves it open in sc, see sinus_probe_stats.
+ * The cached device goes first, with the format and rate it took last time
+ * tried early; then alsa_devnames, one after the other or all at once. */
+static int
+alsa_probe (SinusContext *sc, const SinusSettings *ss)
+{
+    uint64_t start = sinus_stats_now_ns ();
+    AlsaProbeHint hint;
+    int cached = alsa_probe_cache_load (ss, &hint);
+    int found = -1;
+
+    if (cached >= 0 && alsa_probe_one (sc, (unsigned)cached, ss, &hint) == 0)
     {
-        while ((ret = snd_pcm_resume (sc->pcm)) == -EAGAIN)
-            sleep (1);
-        if (ret < 0)
-            snd_pcm_prepare (sc->pcm);
-        return 0;
+        found = cached;
+        sc->probe.cached = true;
     }
+    else if (ss->flags & SINUS_FLAG_PARALLEL_PROBE)
+        found = alsa_probe_parallel (sc, ss);
+    else
+        for (unsigned i = 0; i < arrlen (alsa_devnames) && found < 0; ++i)
+            if (alsa_probe_one (sc, i, ss, NULL) == 0)
+                found = (int)i;
+
+    sc->probe.total_ns = sinus_stats_now_ns () - start;
+
+    if (found < 0)
+        return -1;
 
-    snd_pcm_recover (sc->pcm, ret, 1);
+    if (found != cached || sc->device_fmt != hint.fmt
+        || sc->device_rate != hint.rate)
+        alsa_probe_cache_store (ss, alsa_devnames[found], sc->device_fmt,
+                                sc->device_rate);
     return 0;
 }
 
-sinus_ssize_t
-sinus_frames_write_timed (SinusContext *sc, const void *frames,
-                          uint32_t nframes, uint32_t timeout_us)
+/* The capture side takes the settings as they are, except for a format it
+ * would rather convert from: no resampling, the plug devices in
+ * alsa_devnames do that if the hardware can't. */
+static int
+alsa_capture_configure (SinusContext *sc, snd_pcm_t *pcm,
+                        const SinusSettings *ss)
 {
-    runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_hw_params_alloca (&hw_params);
 
-    if (nframes == 0 || !frames)
-        return 0;
+    if (snd_pcm_hw_params_any (pcm, hw_params) < 0
+        || snd_pcm_hw_params_set_access (pcm, hw_params,
+                                         SND_PCM_ACCESS_RW_INTERLEAVED)
+               < 0)
+        return -1;
 
-    if (snd_pcm_state (sc->pcm) != SND_PCM_STATE_RUNNING
-        || sc->running == false)
-        return 0;
+    SinusFormat formats[] = {
+        ss->fmt,
+        SINUS_FORMAT_S32,
+        SINUS_FORMAT_S24_U4,
+        SINUS_FORMAT_S24_P3,
+        SINUS_FORMAT_S16,
+    };
 
-    uint64_t deadline = now_us () + (uint64_t)timeout_us;
-    uint32_t frames_left = nframes;
-    sinus_ssize_t total_written = 0;
+    bool format_accepted = false;
 
-    while (frames_left > 0)
+    for (unsigned i = 0; i < arrlen (formats) && !format_accepted; ++i)
     {
-        uint64_t now = now_us ();
-        if (now >= deadline)
-            break; /* timeout expired */
-        uint64_t rem_us = deadline - now;
-        long rem_ms = (long)((rem_us + 999) / 1000); /* ceil to ms */
+        snd_pcm_format_t alsa_fmt = alsa_format_from_sinus (formats[i]);
 
-        snd_pcm_sframes_t avail = snd_pcm_avail_update (sc->pcm);
-        if (avail < 0)
+        if (snd_pcm_hw_params_test_format (pcm, hw_params, alsa_fmt) == 0
+            && snd_pcm_hw_params_set_format (pcm, hw_params, alsa_fmt) == 0)
         {
-            if (avail == -EPIPE)
-            {
-                snd_pcm_prepare (sc->pcm);
-                continue;
-            }
-            if (avail == -ESTRPIPE)
-            {
-                int r = snd_pcm_resume (sc->pcm);
-                if (r == -EAGAIN)
-                {
-                    int w = snd_pcm_wait (sc->pcm, rem_ms);
-                    if (w <= 0)
-                        break;
-                    continue;
-                }
-                if (r < 0)
-                {
-                    snd_pcm_prepare (sc->pcm);
-                    continue;
-                }
-                continue;
-            }
+            format_accepted = true;
+            sc->capture_fmt = formats[i];
+        }
+    }
 
-            int rec = snd_pcm_recover (sc->pcm, (int)avail, 1);
-            if (rec < 0)
-                return -rec;
+    if (!format_accepted
+        || snd_pcm_hw_params_set_rate (pcm, hw_params, ss->sample_rate, 0) < 0
+        || snd_pcm_hw_params_set_channels (pcm, hw_params, ss->channels) < 0)
+        return -1;
+
+    snd_pcm_uframes_t buffer_size = ss->buffer_frames;
+    snd_pcm_hw_params_set_buffer_size_near (pcm, hw_params, &buffer_size);
+
+    snd_pcm_uframes_t period_size = alsa_period_frames (ss);
+    snd_pcm_hw_params_set_period_size_near (pcm, hw_params, &period_size, 0);
+
+    if (snd_pcm_hw_params (pcm, hw_params) < 0)
+        return -1;
+
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_sw_params_alloca (&sw_params);
+
+    if (snd_pcm_sw_params_current (pcm, sw_params) < 0
+        || snd_pcm_sw_params_set_avail_min (pcm, sw_params,
+                                            alsa_period_frames (ss))
+               < 0)
+        return -1;
+
+    snd_pcm_sw_params_set_tstamp_mode (pcm, sw_params, SND_PCM_TSTAMP_ENABLE);
+    snd_pcm_sw_params_set_tstamp_type (pcm, sw_params,
+                                       SND_PCM_TSTAMP_TYPE_MONOTONIC);
+
+    if (snd_pcm_sw_params (pcm, sw_params) < 0 || snd_pcm_prepare (pcm) < 0)
+        return -1;
+
+    return 0;
+}
+
+/* Finds a capture device, the playback one first when there is one, and
+ * links the two. Unlinked streams (different cards, plugins that can't)
+ * still work, they're just started and stopped one after the other. */
+static int
+alsa_capture_open (SinusContext *sc, const SinusSettings *ss)
+{
+    const char *playback = sc->pcm ? snd_pcm_name (sc->pcm) : NULL;
+
+    for (int i = playback ? -1 : 0; i < (int)arrlen (alsa_devnames); ++i)
+    {
+        const char *devname = i < 0 ? playback : alsa_devnames[i];
+        snd_pcm_t *pcm;
+
+        if (snd_pcm_open (&pcm, devname, SND_PCM_STREAM_CAPTURE,
+                          SND_PCM_NONBLOCK)
+            < 0)
             continue;
-        }
 
-        if (avail == 0)
+        if (alsa_capture_configure (sc, pcm, ss) < 0
+            || snd_pcm_nonblock (pcm, 0) < 0)
         {
-            int w = snd_pcm_wait (sc->pcm, rem_ms);
-            if (w == 0)
-                break;
-            if (w < 0)
-            {
-                snd_pcm_sframes_t rec = snd_pcm_recover (sc->pcm, w, 1);
-                if (rec < 0)
-                    return -rec;
-                continue;
-            }
+            snd_pcm_close (pcm);
             continue;
         }
 
-        uint32_t to_write = (uint32_t)avail;
-        if (to_write > frames_left)
-            to_write = frames_left;
+        sc->capture_pcm = pcm;
+        sc->linked = sc->pcm && snd_pcm_link (sc->pcm, pcm) == 0;
 
-        char *ptr = (char *)frames;
-
-        snd_pcm_sframes_t wr = snd_pcm_writei (sc->pcm, ptr, to_write);
-        if (wr >= 0)
+        if (sc->capture_fmt != ss->fmt)
         {
-            ptr += (size_t)wr * sinus_format_to_size (sc->settings.fmt);
-            frames_left -= (uint32_t)wr;
-            total_written += wr;
+            sc->capture_buffer
+                = malloc ((size_t)ss->buffer_frames * ss->channels
+                          * (size_t)sinus_format_to_size (sc->capture_fmt));
+            runtime_assert (sc->capture_buffer != NULL);
+        }
+        return 0;
+    }
+
+    return -1;
+}
+
+static void
+alsa_capture_close (SinusContext *sc)
+{
+    if (sc->capture_pcm)
+        snd_pcm_close (sc->capture_pcm);
+    free (sc->capture_buffer);
+
+    sc->capture_pcm = NULL;
+    sc->capture_buffer = NULL;
+}
+
+static uint32_t
+alsa_frame_bytes (const SinusContext *sc)
+{
+    return (uint32_t)sinus_format_to_size (sc->settings.fmt)
+           * sc->settings.channels;
+}
+
+static uint32_t
+alsa_device_frame_bytes (const SinusContext *sc)
+{
+    return (uint32_t)sinus_format_to_size (sc->device_fmt)
+           * sc->settings.channels;
+}
+
+static bool
+alsa_resampling (const SinusContext *sc)
+{
+    return sc->device_rate != sc->settings.sample_rate;
+}
+
+static bool
+alsa_converting (const SinusContext *sc)
+{
+    return sc->device_fmt != sc->settings.fmt || alsa_resampling (sc);
+}
+
+/* Device frames -> the caller's frames, for anything reported to the caller */
+static uint32_t
+alsa_to_user_frames (const SinusContext *sc, uint64_t device_frames)
+{
+    if (!alsa_resampling (sc))
+        return (uint32_t)device_frames;
+
+    return (uint32_t)(device_frames * sc->settings.sample_rate
+                      / sc->device_rate);
+}
+
+static uint32_t
+alsa_to_device_frames (const SinusContext *sc, uint64_t user_frames)
+{
+    if (!alsa_resampling (sc))
+        return (uint32_t)user_frames;
+
+    return (uint32_t)(user_frames * sc->device_rate
+                      / sc->settings.sample_rate);
+}
+
+/* How much may be queued, in device frames: the SINUS_FLAG_ADAPTIVE target
+ * or the whole buffer */
+static uint64_t
+alsa_target_frames (SinusContext *sc)
+{
+    if (!sc->adaptive)
+        return sc->ring_enabled ? UINT64_MAX : sc->device_buffer_frames;
+
+    uint64_t target
+        = alsa_to_device_frames (sc, sinus_latency_target (&sc->latency));
+    if (!sc->ring_enabled && target > sc->device_buffer_frames)
+        target = sc->device_buffer_frames;
+    return target;
+}
+
+/* avail less the space SINUS_FLAG_ADAPTIVE keeps empty */
+static snd_pcm_sframes_t
+alsa_avail_under_target (SinusContext *sc, snd_pcm_sframes_t avail)
+{
+    if (avail <= 0 || !sc->adaptive)
+        return avail;
+
+    snd_pcm_uframes_t reserve
+        = sc->device_buffer_frames - (snd_pcm_uframes_t)alsa_target_frames (sc);
+    return (snd_pcm_uframes_t)avail > reserve
+               ? avail - (snd_pcm_sframes_t)reserve
+               : 0;
+}
+
+static snd_pcm_sframes_t
+alsa_avail (SinusContext *sc)
+{
+    return alsa_avail_under_target (sc, snd_pcm_avail_update (sc->pcm));
+}
+
+/* alsa_avail for the direct write paths, which keep the raw count around so
+ * the fill level doesn't cost another snd_pcm_avail_update */
+static snd_pcm_sframes_t
+alsa_write_avail (SinusContext *sc)
+{
+    sc->write_avail = snd_pcm_avail_update (sc->pcm);
+    return alsa_avail_under_target (sc, sc->write_avail);
+}
+
+/* Ring space writers may fill, in device frames. With SINUS_FLAG_ADAPTIVE
+ * what the device holds counts against the target too. */
+static uint32_t
+alsa_ring_room (SinusContext *sc)
+{
+    uint32_t room = sinus_ring_free (&sc->ring);
+    if (!sc->adaptive)
+        return room;
+
+    uint64_t queued = sinus_ring_buffered (&sc->ring)
+                      + __atomic_load_n (&sc->device_buffered,
+                                         __ATOMIC_RELAXED);
+    uint64_t target = alsa_target_frames (sc);
+    uint64_t left = queued < target ? target - queued : 0;
+
+    return left < room ? (uint32_t)left : room;
+}
+
+/* Move avail_min along with the SINUS_FLAG_ADAPTIVE target, so the PCM
+ * wakes pollers and blocked writers once a period fits under it. Ring mode
+ * has its own wakeups, see alsa_ring_signal. */
+static void
+alsa_apply_target (SinusContext *sc)
+{
+    if (sc->ring_enabled)
+        return;
+
+    snd_pcm_uframes_t period = alsa_period_frames (&sc->settings);
+    snd_pcm_uframes_t avail_min = sc->device_buffer_frames + period
+                                  - (snd_pcm_uframes_t)alsa_target_frames (sc);
+    if (avail_min > sc->device_buffer_frames)
+        avail_min = sc->device_buffer_frames;
+
+    snd_pcm_sw_params_t *sw_params;
+    snd_pcm_sw_params_alloca (&sw_params);
+
+    if (snd_pcm_sw_params_current (sc->pcm, sw_params) < 0)
+        return;
+    if (snd_pcm_sw_params_set_avail_min (sc->pcm, sw_params, avail_min) < 0)
+        return;
+    snd_pcm_sw_params (sc->pcm, sw_params);
+}
+
+/* Resample up to *nframes of the caller's frames into at most *dev_frames
+ * device frames in convert_buffer. */
+static const void *
+alsa_resample (SinusContext *sc, const void *frames, uint32_t *nframes,
+               uint32_t *dev_frames)
+{
+    uint32_t channels = sc->settings.channels;
+
+    /* Don't convert much more input than the output has room for */
+    uint32_t needed = alsa_to_user_frames (sc, *dev_frames) + 1;
+    if (*nframes > needed)
+        *nframes = needed;
+
+    const float *in = frames;
+    if (sc->settings.fmt != SINUS_FORMAT_FLOAT)
+    {
+        sinus_convert_to_float (sc->resample_in, frames, sc->settings.fmt,
+                                (size_t)*nframes * channels);
+        in = sc->resample_in;
+    }
+
+    float *out = sc->resample_out ? sc->resample_out : sc->convert_buffer;
+    sinus_resampler_process (sc->resampler, in, nframes, out, dev_frames);
+
+    if (sc->resample_out)
+        sinus_convert_from_float (sc->convert_buffer, sc->device_fmt,
+                                  sc->resample_out,
+                                  (size_t)*dev_frames * channels);
+
+    return sc->convert_buffer;
+}
+
+/* The caller's frames in the device format: either the frames themselves or
+ * a converted copy in convert_buffer. On input *nframes is what the caller
+ * has and *dev_frames what the device takes, on output they are the frames
+ * consumed and the device frames returned. Only the resampler makes the two
+ * differ. */
+static const void *
+alsa_to_device (SinusContext *sc, const void *frames, uint32_t *nframes,
+                uint32_t *dev_frames)
+{
+    uint32_t limit = sc->settings.buffer_frames;
+
+    if (alsa_resampling (sc))
+    {
+        if (*dev_frames > limit)
+            *dev_frames = limit;
+        if (*nframes > limit)
+            *nframes = limit;
+        return alsa_resample (sc, frames, nframes, dev_frames);
+    }
+
+    if (*nframes > *dev_frames)
+        *nframes = *dev_frames;
+
+    if (!alsa_converting (sc))
+    {
+        *dev_frames = *nframes;
+        return frames;
+    }
+
+    if (*nframes > limit)
+        *nframes = limit;
+    *dev_frames = *nframes;
+
+    sinus_convert (sc->convert_buffer, sc->device_fmt, frames,
+                   sc->settings.fmt, (size_t)*nframes * sc->settings.channels);
+    return sc->convert_buffer;
+}
+
+/* Producer side of ring mode, converting straight into the ring */
+static uint32_t
+alsa_ring_push (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    if (!alsa_resampling (sc))
+    {
+        uint32_t room = alsa_ring_room (sc);
+        if (nframes > room)
+            nframes = room;
+    }
+
+    if (!alsa_converting (sc))
+        return sinus_ring_write (&sc->ring, frames, nframes);
+
+    const uint8_t *src = frames;
+    uint32_t frame_bytes = alsa_frame_bytes (sc);
+    uint32_t written = 0;
+
+    if (alsa_resampling (sc))
+    {
+        /* Frame counts change on the way, so go through convert_buffer and
+         * never produce more than the ring can take */
+        while (written < nframes)
+        {
+            uint32_t n = nframes - written;
+            uint32_t dev_n = alsa_ring_room (sc);
+            const void *dev = alsa_to_device (sc, src, &n, &dev_n);
+            if (n == 0 && dev_n == 0)
+                break;
+
+            sinus_ring_write (&sc->ring, dev, dev_n);
+            src += (size_t)n * frame_bytes;
+            written += n;
+        }
+
+        return written;
+    }
+
+    while (written < nframes)
+    {
+        uint32_t n = nframes - written;
+        void *dst = sinus_ring_write_region (&sc->ring, &n);
+        if (n == 0)
+            break;
+
+        sinus_convert (dst, sc->device_fmt, src, sc->settings.fmt,
+                       (size_t)n * sc->settings.channels);
+        src += (size_t)n * frame_bytes;
+        written += n;
+        sinus_ring_commit (&sc->ring, n);
+    }
+
+    return written;
+}
+
+/* Plane c of planar_buffer, settings.buffer_frames device samples */
+static void *
+alsa_device_plane (const SinusContext *sc, uint32_t c)
+{
+    size_t plane_bytes = (size_t)sc->settings.buffer_frames
+                         * (size_t)sinus_format_to_size (sc->device_fmt);
+
+    return (uint8_t *)sc->planar_buffer + plane_bytes * c;
+}
+
+/* Keeps write_avail in step with what went to the device */
+static snd_pcm_sframes_t
+alsa_wrote (SinusContext *sc, snd_pcm_sframes_t ret)
+{
+    if (ret > 0 && sc->write_avail >= 0)
+        sc->write_avail = ret < sc->write_avail ? sc->write_avail - ret : 0;
+    return ret;
+}
+
+/* snd_pcm_writei only works on RW access, mmap access has its own and
+ * non-interleaved access wants one pointer per channel */
+static snd_pcm_sframes_t
+alsa_writei (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    if (sc->mmap_access)
+        return alsa_wrote (sc, snd_pcm_mmap_writei (sc->pcm, frames, nframes));
+    if (!sc->planar_access)
+        return alsa_wrote (sc, snd_pcm_writei (sc->pcm, frames, nframes));
+
+    uint32_t channels = sc->settings.channels;
+    void **planes = alloca (sizeof (void *) * channels);
+
+    if (nframes > sc->settings.buffer_frames)
+        nframes = sc->settings.buffer_frames;
+
+    for (uint32_t c = 0; c < channels; ++c)
+        planes[c] = alsa_device_plane (sc, c);
+
+    sinus_deinterleave (planes, frames, sc->device_fmt, channels, nframes);
+    return alsa_wrote (sc, snd_pcm_writen (sc->pcm, planes, nframes));
+}
+
+static void *
+alsa_stage (SinusContext *sc)
+{
+    if (!sc->stage)
+    {
+        sc->stage = malloc ((size_t)sc->settings.buffer_frames
+                            * alsa_frame_bytes (sc));
+        runtime_assert (sc->stage != NULL);
+    }
+
+    return sc->stage;
+}
+
+static void
+alsa_stats_error (SinusContext *sc, int err)
+{
+    if (err == -EPIPE)
+        sinus_stats_add (&sc->stats.underruns, 1);
+    else if (err == -ESTRPIPE)
+        sinus_stats_add (&sc->stats.suspends, 1);
+}
+
+static void
+alsa_stats_recovered (SinusContext *sc, int r)
+{
+    if (r >= 0)
+        sinus_stats_add (&sc->stats.recoveries, 1);
+}
+
+/* Frames queued ahead of the speaker, cheap enough to sample per write: the
+ * direct paths reuse the avail the write read, only a write that read none
+ * (no SINUS_FLAG_ADAPTIVE) asks the device again */
+static uint64_t
+alsa_fill_level (SinusContext *sc)
+{
+    uint64_t queued;
+
+    if (sc->ring_enabled)
+        queued = sinus_ring_buffered (&sc->ring)
+                 + __atomic_load_n (&sc->device_buffered, __ATOMIC_RELAXED);
+    else
+    {
+        snd_pcm_sframes_t avail = sc->write_avail >= 0
+                                      ? sc->write_avail
+                                      : snd_pcm_avail_update (sc->pcm);
+        sc->write_avail = -1;
+        if (avail < 0 || (snd_pcm_uframes_t)avail >= sc->device_buffer_frames)
+            return 0;
+        queued = sc->device_buffer_frames - (snd_pcm_uframes_t)avail;
+    }
+
+    return alsa_to_user_frames (sc, queued);
+}
+
+/* Feed a write to the SINUS_FLAG_ADAPTIVE controller, queued being what the
+ * write found */
+static void
+alsa_adapt (SinusContext *sc, uint64_t queued)
+{
+    uint64_t underruns
+        = __atomic_load_n (&sc->stats.underruns, __ATOMIC_RELAXED);
+
+    if (sinus_latency_update (&sc->latency, underruns, queued,
+                              sinus_stats_now_ns ()))
+        alsa_apply_target (sc);
+}
+
+static void
+alsa_stats_write (SinusContext *sc, uint32_t requested, sinus_ssize_t written,
+                  uint64_t start_ns)
+{
+    uint64_t elapsed = sinus_stats_now_ns () - start_ns;
+    uint64_t fill = alsa_fill_level (sc);
+
+    sinus_stats_write (&sc->stats, requested, written, elapsed, fill);
+
+    if (sc->adaptive && sc->running && written > 0)
+        alsa_adapt (sc, fill > (uint64_t)written ? fill - (uint64_t)written
+                                                 : 0);
+}
+
+/* Bring the PCM back after a failed write/avail call. Returns 0 when the
+ * stream is usable again. */
+static int
+alsa_recover (SinusContext *sc, int err)
+{
+    int r;
+
+    alsa_stats_error (sc, err);
+
+    if (err == -EPIPE)
+        r = snd_pcm_prepare (sc->pcm);
+    else if (err == -ESTRPIPE)
+    {
+        while ((r = snd_pcm_resume (sc->pcm)) == -EAGAIN)
+            sleep (1);
+        if (r < 0)
+            r = snd_pcm_prepare (sc->pcm);
+    }
+    else
+        r = snd_pcm_recover (sc->pcm, err, 1);
+
+    alsa_stats_recovered (sc, r);
+    return r;
+}
+
+/* alsa_recover for timed writes: a device still resuming (or just full, on
+ * -EAGAIN) is waited for at most timeout_ms. Returns 0 to try again, 1 when
+ * the wait timed out and the snd_pcm_recover error when that failed. */
+static int
+alsa_recover_timed (SinusContext *sc, int err, long timeout_ms)
+{
+    int r;
+
+    if (err == -EAGAIN)
+        return snd_pcm_wait (sc->pcm, (int)timeout_ms) <= 0 ? 1 : 0;
+
+    alsa_stats_error (sc, err);
+
+    if (err == -EPIPE)
+        r = snd_pcm_prepare (sc->pcm);
+    else if (err == -ESTRPIPE)
+    {
+        r = snd_pcm_resume (sc->pcm);
+        if (r == -EAGAIN)
+            return snd_pcm_wait (sc->pcm, (int)timeout_ms) <= 0 ? 1 : 0;
+        if (r < 0)
+            r = snd_pcm_prepare (sc->pcm);
+    }
+    else
+    {
+        r = snd_pcm_recover (sc->pcm, err, 1);
+        alsa_stats_recovered (sc, r);
+        return r < 0 ? r : 0;
+    }
+
+    /* Same as before: a failed prepare is retried on the next round */
+    alsa_stats_recovered (sc, r);
+    return 0;
+}
+
+static int
+alsa_thread_start (SinusContext *sc, void *(*fn) (void *))
+{
+    __atomic_store_n (&sc->thread_quit, false, __ATOMIC_RELEASE);
+
+    if (pthread_create (&sc->thread, NULL, fn, sc) != 0)
+        return -1;
+
+    sc->thread_started = true;
+    return 0;
+}
+
+static void
+alsa_thread_stop (SinusContext *sc)
+{
+    if (!sc->thread_started)
+        return;
+
+    __atomic_store_n (&sc->thread_quit, true, __ATOMIC_RELEASE);
+    pthread_join (sc->thread, NULL);
+    sc->thread_started = false;
+}
+
+static bool
+alsa_thread_should_quit (SinusContext *sc)
+{
+    return __atomic_load_n (&sc->thread_quit, __ATOMIC_ACQUIRE);
+}
+
+/* Best effort: SCHED_FIFO needs CAP_SYS_NICE or an rtprio rlimit, without
+ * them the thread keeps running with normal priority. */
+static void
+alsa_thread_make_realtime (void)
+{
+    int lo = sched_get_priority_min (SCHED_FIFO);
+    int hi = sched_get_priority_max (SCHED_FIFO);
+    struct sched_param param = { .sched_priority = lo + (hi - lo) / 2 };
+
+    pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+}
+
+/* Write all of frames (already in the device format), recovering from xruns
+ * on the way. */
+static bool
+alsa_write_device (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    const uint8_t *ptr = frames;
+    uint32_t frame_bytes = alsa_device_frame_bytes (sc);
+
+    while (nframes > 0)
+    {
+        snd_pcm_sframes_t wr = alsa_writei (sc, ptr, nframes);
+        if (wr < 0)
+        {
+            if (wr == -EAGAIN)
+                continue;
+            if (alsa_recover (sc, (int)wr) < 0)
+                return false;
             continue;
         }
 
-        if (wr == -EPIPE)
+        ptr += (size_t)wr * frame_bytes;
+        nframes -= (uint32_t)wr;
+    }
+
+    return true;
+}
+
+/* Write all of frames, recovering from xruns on the way. */
+static bool
+alsa_write_all (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    const uint8_t *ptr = frames;
+    uint32_t frame_bytes = alsa_frame_bytes (sc);
+
+    while (nframes > 0)
+    {
+        uint32_t n = nframes;
+        uint32_t dev_n = UINT32_MAX;
+        const void *dev = alsa_to_device (sc, ptr, &n, &dev_n);
+
+        if (!alsa_write_device (sc, dev, dev_n))
+            return false;
+
+        ptr += (size_t)n * frame_bytes;
+        nframes -= n;
+    }
+
+    return true;
+}
+
+/* Block until the device has room (or timeout_ms passes). */
+static void
+alsa_wait_for_space (SinusContext *sc, struct pollfd *fds, int nfds,
+                     int timeout_ms)
+{
+    if (poll (fds, (nfds_t)nfds, timeout_ms) > 0)
+    {
+        unsigned short revents = 0;
+        snd_pcm_poll_descriptors_revents (sc->pcm, fds, (unsigned)nfds,
+                                          &revents);
+    }
+}
+
+static int
+alsa_period_ms (const SinusContext *sc)
+{
+    return (int)((uint64_t)alsa_period_frames (&sc->settings) * 1000
+                 / sc->settings.sample_rate)
+           + 1;
+}
+
+/* Pull mode: wait on the PCM poll descriptors and ask the fill callback for
+ * every frame of free space, one period at a time. */
+static void *
+alsa_fill_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = alsa_period_frames (&sc->settings);
+    int period_ms = alsa_period_ms (sc);
+
+    alsa_thread_make_realtime ();
+
+    int nfds = snd_pcm_poll_descriptors_count (sc->pcm);
+    if (nfds <= 0)
+        return NULL;
+
+    struct pollfd *fds = alloca (sizeof (struct pollfd) * (unsigned)nfds);
+    nfds = snd_pcm_poll_descriptors (sc->pcm, fds, (unsigned)nfds);
+
+    while (!alsa_thread_should_quit (sc))
+    {
+        if (!sc->running)
         {
-            snd_pcm_prepare (sc->pcm);
+            poll (NULL, 0, period_ms);
             continue;
         }
-        if (wr == -ESTRPIPE)
+
+        snd_pcm_sframes_t avail = alsa_write_avail (sc);
+        if (avail < 0)
         {
-            int r = snd_pcm_resume (sc->pcm);
-            if (r == -EAGAIN)
-            {
-                int w = snd_pcm_wait (sc->pcm, rem_ms);
-                if (w <= 0)
-                    break;
-                continue;
-            }
-            if (r < 0)
-                snd_pcm_prepare (sc->pcm);
+            if (alsa_recover (sc, (int)avail) < 0)
+                poll (NULL, 0, period_ms);
             continue;
         }
-        if (wr == -EAGAIN)
+
+        if ((uint32_t)avail < period)
         {
-            int w = snd_pcm_wait (sc->pcm, rem_ms);
-            if (w <= 0)
-                break;
+            /* Timeout only so thread_quit gets noticed */
+            alsa_wait_for_space (sc, fds, nfds, period_ms);
             continue;
         }
 
+        /* Ask for the caller's frames, the resampler keeps any excess */
+        avail = alsa_to_user_frames (sc, (uint64_t)avail);
+        if ((uint32_t)avail > sc->settings.buffer_frames)
+            avail = sc->settings.buffer_frames;
+
+        sinus_ssize_t got = sc->fill_cb (sc->stage, (uint32_t)avail);
+        if (got < 0)
+            break;
+        if (got == 0)
         {
-            int rec = snd_pcm_recover (sc->pcm, (int)wr, 1);
-            if (rec < 0)
-                return -rec;
+            /* Producer has nothing yet, don't spin on it */
+            poll (NULL, 0, period_ms);
             continue;
         }
+        if (got > avail)
+            got = avail;
+
+        uint64_t start = sinus_stats_now_ns ();
+        bool ok = alsa_write_all (sc, sc->stage, (uint32_t)got);
+
+        alsa_stats_write (sc, (uint32_t)got, ok ? got : 0, start);
+        if (!ok)
+            poll (NULL, 0, period_ms);
+    }
+
+    return NULL;
+}
+
+/* Submission queue: the head buffer goes to the device as space opens up,
+ * straight from the caller's memory unless it has to be converted. */
+static void *
+alsa_submit_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = alsa_period_frames (&sc->settings);
+    int period_ms = alsa_period_ms (sc);
+    uint32_t frame_bytes = alsa_frame_bytes (sc);
+
+    alsa_thread_make_realtime ();
+
+    int nfds = snd_pcm_poll_descriptors_count (sc->pcm);
+    if (nfds <= 0)
+        return NULL;
+
+    struct pollfd *fds = alloca (sizeof (struct pollfd) * (unsigned)nfds);
+    nfds = snd_pcm_poll_descriptors (sc->pcm, fds, (unsigned)nfds);
+
+    while (!alsa_thread_should_quit (sc))
+    {
+        const void *frames;
+        uint32_t nframes;
+
+        /* Timeout only so thread_quit gets noticed */
+        if (!sinus_submit_peek (sc->submit, frame_bytes, &frames, &nframes,
+                                (uint64_t)period_ms * 1000000))
+            continue;
+
+        if (nframes == 0)
+        {
+            sinus_submit_advance (sc->submit, 0);
+            continue;
+        }
+
+        if (!sc->running)
+        {
+            poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        snd_pcm_sframes_t avail = alsa_write_avail (sc);
+        if (avail < 0)
+        {
+            if (alsa_recover (sc, (int)avail) < 0)
+                poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        /* A period at a time, or the tail of the buffer */
+        uint32_t room = alsa_to_user_frames (sc, (uint64_t)avail);
+        if ((uint32_t)avail < period && room < nframes)
+        {
+            alsa_wait_for_space (sc, fds, nfds, period_ms);
+            continue;
+        }
+
+        uint32_t n = nframes < room ? nframes : room;
+        uint32_t dev_n = (uint32_t)avail;
+        uint64_t start = sinus_stats_now_ns ();
+        const void *dev = alsa_to_device (sc, frames, &n, &dev_n);
+        bool ok = alsa_write_device (sc, dev, dev_n);
+
+        alsa_stats_write (sc, n, ok ? n : 0, start);
+        if (!ok)
+        {
+            poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        sinus_submit_advance (sc->submit, n);
+    }
+
+    return NULL;
+}
+
+/* Ring mode: the PCM descriptors say nothing about ring space, so pollers
+ * wait on ring_event instead. Signalled after every consume that leaves a
+ * period free, cleared by sinus_poll_revents. */
+static void
+alsa_ring_signal (SinusContext *sc, uint32_t period)
+{
+    if (alsa_ring_room (sc) >= period)
+        eventfd_write (sc->ring_event, 1);
+}
+
+/* Ring mode: move whatever the writers queued into the PCM, one period of
+ * device space at a time. */
+static void *
+alsa_ring_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = alsa_period_frames (&sc->settings);
+    int period_ms = alsa_period_ms (sc);
+
+    alsa_thread_make_realtime ();
+
+    int nfds = snd_pcm_poll_descriptors_count (sc->pcm);
+    if (nfds <= 0)
+        return NULL;
+
+    struct pollfd *fds = alloca (sizeof (struct pollfd) * (unsigned)nfds);
+    nfds = snd_pcm_poll_descriptors (sc->pcm, fds, (unsigned)nfds);
+
+    while (!alsa_thread_should_quit (sc))
+    {
+        if (!sc->running)
+        {
+            poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        snd_pcm_sframes_t avail = snd_pcm_avail_update (sc->pcm);
+        if (avail < 0)
+        {
+            if (alsa_recover (sc, (int)avail) < 0)
+                poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        snd_pcm_uframes_t device_buffered
+            = (snd_pcm_uframes_t)avail < sc->device_buffer_frames
+                  ? sc->device_buffer_frames - (snd_pcm_uframes_t)avail
+                  : 0;
+        __atomic_store_n (&sc->device_buffered, (uint32_t)device_buffered,
+                          __ATOMIC_RELAXED);
+
+        const void *frames;
+        uint32_t n = sinus_ring_read_region (&sc->ring, &frames);
+        if (n == 0)
+        {
+            /* With SINUS_FLAG_ADAPTIVE room also opens up as the device
+             * plays, not only when the ring is consumed */
+            if (sc->adaptive)
+                alsa_ring_signal (sc, period);
+
+            /* Writers are behind, look again well within a period */
+            poll (NULL, 0, period_ms / 4 + 1);
+            continue;
+        }
+
+        if ((uint32_t)avail < period)
+        {
+            alsa_wait_for_space (sc, fds, nfds, period_ms);
+            continue;
+        }
+
+        if (n > (uint32_t)avail)
+            n = (uint32_t)avail;
+
+        snd_pcm_sframes_t wr = alsa_writei (sc, frames, n);
+        if (wr < 0)
+        {
+            alsa_recover (sc, (int)wr);
+            continue;
+        }
+
+        sinus_ring_consume (&sc->ring, (uint32_t)wr);
+        alsa_ring_signal (sc, period);
+        __atomic_store_n (&sc->device_buffered,
+                          (uint32_t)(device_buffered + (snd_pcm_uframes_t)wr),
+                          __ATOMIC_RELAXED);
+    }
+
+    return NULL;
+}
+
+/* alsa_recover for the capture stream, where -EPIPE is an overrun. The
+ * stream is started again right away, it doesn't restart on reads. */
+static int
+alsa_capture_recover (SinusContext *sc, int err)
+{
+    snd_pcm_t *pcm = sc->capture_pcm;
+    int r;
+
+    if (err == -EPIPE)
+    {
+        sinus_stats_add (&sc->stats.overruns, 1);
+        r = snd_pcm_prepare (pcm);
+    }
+    else if (err == -ESTRPIPE)
+    {
+        sinus_stats_add (&sc->stats.suspends, 1);
+        while ((r = snd_pcm_resume (pcm)) == -EAGAIN)
+            sleep (1);
+        if (r < 0)
+            r = snd_pcm_prepare (pcm);
+    }
+    else
+        r = snd_pcm_recover (pcm, err, 1);
+
+    if (r == 0 && snd_pcm_state (pcm) == SND_PCM_STATE_PREPARED)
+        r = snd_pcm_start (pcm);
+
+    alsa_stats_recovered (sc, r);
+    return r;
+}
+
+/* Read up to nframes of settings.fmt, waiting at most timeout_ms for them
+ * (< 0: until all are there). Returns frames read or < 0. */
+static sinus_ssize_t
+alsa_read_frames (SinusContext *sc, void *frames, uint32_t nframes,
+                  int timeout_ms)
+{
+    snd_pcm_t *pcm = sc->capture_pcm;
+    uint64_t deadline = now_us () + (uint64_t)(timeout_ms > 0 ? timeout_ms : 0)
+                                        * 1000;
+    uint32_t frame_bytes = alsa_frame_bytes (sc);
+    uint8_t *dst = frames;
+    uint32_t done = 0;
+
+    while (done < nframes)
+    {
+        uint32_t n = nframes - done;
+
+        if (sc->capture_buffer && n > sc->settings.buffer_frames)
+            n = sc->settings.buffer_frames;
+
+        if (timeout_ms >= 0)
+        {
+            snd_pcm_sframes_t avail = snd_pcm_avail_update (pcm);
+            if (avail < 0)
+            {
+                if (alsa_capture_recover (sc, (int)avail) < 0)
+                    return done > 0 ? (sinus_ssize_t)done : -1;
+                continue;
+            }
+
+            if (avail == 0)
+            {
+                uint64_t now = now_us ();
+                if (now >= deadline)
+                    break;
+                snd_pcm_wait (pcm, (int)((deadline - now) / 1000) + 1);
+                continue;
+            }
+
+            if (n > (uint32_t)avail)
+                n = (uint32_t)avail;
+        }
+
+        void *buf = sc->capture_buffer ? sc->capture_buffer : dst;
+        snd_pcm_sframes_t rd = snd_pcm_readi (pcm, buf, n);
+        if (rd == -EAGAIN)
+            continue;
+        if (rd < 0)
+        {
+            if (alsa_capture_recover (sc, (int)rd) < 0)
+                return done > 0 ? (sinus_ssize_t)done : -1;
+            continue;
+        }
+
+        if (sc->capture_buffer)
+            sinus_convert (dst, sc->settings.fmt, buf, sc->capture_fmt,
+                           (size_t)rd * sc->settings.channels);
+
+        dst += (size_t)rd * frame_bytes;
+        done += (uint32_t)rd;
+    }
+
+    sinus_stats_add (&sc->stats.frames_read, done);
+    return done;
+}
+
+/* Capture callback: one period at a time while the context runs */
+static void *
+alsa_capture_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = alsa_period_frames (&sc->settings);
+    int period_ms = alsa_period_ms (sc);
+    void *frames = malloc ((size_t)period * alsa_frame_bytes (sc));
+
+    if (!frames)
+        return NULL;
+
+    alsa_thread_make_realtime ();
+
+    while (!__atomic_load_n (&sc->capture_quit, __ATOMIC_ACQUIRE))
+    {
+        if (!sc->running)
+        {
+            poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        /* Timeout only so capture_quit gets noticed */
+        sinus_ssize_t got = alsa_read_frames (sc, frames, period, period_ms);
+        if (got < 0)
+        {
+            poll (NULL, 0, period_ms);
+            continue;
+        }
+
+        if (got > 0 && sc->capture_cb (frames, (uint32_t)got) < 0)
+            break;
+    }
+
+    free (frames);
+    return NULL;
+}
+
+static void
+alsa_capture_thread_stop (SinusContext *sc)
+{
+    if (!sc->capture_thread_started)
+        return;
+
+    __atomic_store_n (&sc->capture_quit, true, __ATOMIC_RELEASE);
+    pthread_join (sc->capture_thread, NULL);
+    sc->capture_thread_started = false;
+}
+
+/* Reads start a stopped stream, linked playback along with it */
+static int
+alsa_capture_autostart (SinusContext *sc)
+{
+    if (!sc->running && sinus_control_start (sc) < 0)
+        return -1;
+
+    /* An xrun on linked playback leaves capture prepared until the next
+     * write starts both again */
+    if (snd_pcm_state (sc->capture_pcm) == SND_PCM_STATE_PREPARED)
+        return snd_pcm_start (sc->capture_pcm);
+    return 0;
+}
+
+static void
+alsa_resample_free (SinusContext *sc)
+{
+    sinus_resampler_deinit (sc->resampler);
+    free (sc->resample_in);
+    free (sc->resample_out);
+}
+
+/* Start whichever thread the current mode needs, if any. */
+static int
+alsa_thread_start_default (SinusContext *sc)
+{
+    if (sc->fill_cb)
+        return alsa_thread_start (sc, alsa_fill_thread);
+    if (sc->ring_enabled)
+        return alsa_thread_start (sc, alsa_ring_thread);
+    if (sc->submit)
+        return alsa_thread_start (sc, alsa_submit_thread);
+    return 0;
+}
+
+/* Takes over ss, the device already being configured for it */
+static void
+alsa_settings_apply (SinusContext *sc, const SinusSettings *ss)
+{
+    sc->settings
+        = (SinusSettings){ .buffer_frames = ss->buffer_frames,
+                           .hint_min_write_frames = ss->hint_min_write_frames,
+                           .hint_update_us = ss->hint_update_us,
+                           .channels = ss->channels,
+                           .fmt = ss->fmt,
+                           .interleaved = ss->interleaved,
+                           .sample_rate = ss->sample_rate,
+                           .flags = ss->flags,
+                           .resample_quality = ss->resample_quality,
+                           .min_buffer_frames = ss->min_buffer_frames };
+
+    sc->adaptive = (sc->settings.flags & SINUS_FLAG_ADAPTIVE) != 0;
+    if (sc->adaptive)
+    {
+        sinus_latency_init (&sc->latency, sc->settings.min_buffer_frames,
+                            sc->settings.buffer_frames,
+                            alsa_period_frames (&sc->settings),
+                            sinus_stats_now_ns ());
+        alsa_apply_target (sc);
+    }
+}
+
+/* Everything sized by the settings and the device: conversion, planar and
+ * resampling buffers. The stage follows lazily, see alsa_stage. */
+static int
+alsa_buffers_init (SinusContext *sc)
+{
+    if (alsa_converting (sc))
+    {
+        sc->convert_buffer = malloc ((size_t)sc->settings.buffer_frames
+                                     * alsa_device_frame_bytes (sc));
+        runtime_assert (sc->convert_buffer != NULL);
+    }
+
+    if (sc->planar_access)
+    {
+        sc->planar_buffer = malloc ((size_t)sc->settings.buffer_frames
+                                    * alsa_device_frame_bytes (sc));
+        runtime_assert (sc->planar_buffer != NULL);
+    }
+
+    if (alsa_resampling (sc))
+    {
+        size_t floats
+            = (size_t)sc->settings.buffer_frames * sc->settings.channels;
+
+        if (sinus_resampler_init (&sc->resampler, sc->settings.channels,
+                                  sc->settings.sample_rate, sc->device_rate,
+                                  sc->settings.resample_quality)
+            < 0)
+            return -1;
+
+        if (sc->settings.fmt != SINUS_FORMAT_FLOAT)
+        {
+            sc->resample_in = malloc (floats * sizeof (float));
+            runtime_assert (sc->resample_in != NULL);
+        }
+        if (sc->device_fmt != SINUS_FORMAT_FLOAT)
+        {
+            sc->resample_out = malloc (floats * sizeof (float));
+            runtime_assert (sc->resample_out != NULL);
+        }
+    }
+
+    return 0;
+}
+
+static void
+alsa_buffers_free (SinusContext *sc)
+{
+    free (sc->stage);
+    alsa_resample_free (sc);
+    free (sc->planar_buffer);
+    free (sc->convert_buffer);
+
+    sc->stage = NULL;
+    sc->resampler = NULL;
+    sc->resample_in = NULL;
+    sc->resample_out = NULL;
+    sc->planar_buffer = NULL;
+    sc->convert_buffer = NULL;
+}
+
+int
+sinus_context_init (SinusContext **_sc, const SinusSettings *ss_nullable,
+                    void *user_data)
+{
+    (void)user_data;
+
+    runtime_assert (_sc != NULL);
+
+    struct SinusContext *sc = calloc (1, sizeof (struct SinusContext));
+    runtime_assert (sc != NULL);
+
+    SinusSettings *_ss = (SinusSettings *)ss_nullable;
+    if (!_ss)
+    {
+        _ss = alloca (sizeof (SinusSettings));
+        sinus_settings_default (_ss);
+    }
+
+    uint32_t flags = _ss->flags;
+    bool playback
+        = !(flags & SINUS_FLAG_CAPTURE) || (flags & SINUS_FLAG_DUPLEX);
+    bool capture = (flags & (SINUS_FLAG_CAPTURE | SINUS_FLAG_DUPLEX)) != 0;
+
+    /* Packed formats are for the MCU backends, frames here are whole bytes */
+    if (sinus_format_to_size (_ss->fmt) == 0)
+    {
+        free (sc);
+        fprintf (stderr, "ALSA: sample format %d has no byte size\n",
+                 (int)_ss->fmt);
+        return -1;
+    }
+
+    SinusSettings capture_ss;
+    if (!playback)
+    {
+        /* Nothing to ring, adapt or probe in parallel for */
+        capture_ss = *_ss;
+        capture_ss.flags &= ~(SINUS_FLAG_RING | SINUS_FLAG_ADAPTIVE
+                              | SINUS_FLAG_PARALLEL_PROBE);
+        _ss = &capture_ss;
+    }
+
+    if (playback ? alsa_probe (sc, _ss) < 0 : alsa_capture_open (sc, _ss) < 0)
+    {
+        free (sc);
+        fprintf (stderr, "Could not initialize ALSA (no device works)\n");
+        TODO ("real return values");
+        return -1;
+    }
+
+    /* Capture converts the format itself, the playback path is unused */
+    if (!playback)
+    {
+        sc->device_fmt = _ss->fmt;
+        sc->device_rate = _ss->sample_rate;
+    }
+
+    /* Without the resampler the caller has to follow the device */
+    if (_ss->flags & SINUS_FLAG_NO_RESAMPLE)
+        _ss->sample_rate = sc->device_rate;
+
+    if (playback && capture && alsa_capture_open (sc, _ss) < 0)
+    {
+        snd_pcm_close (sc->pcm);
+        free (sc);
+        fprintf (stderr, "Could not initialize ALSA (no capture device)\n");
+        return -1;
+    }
+
+    sc->running = false;
+    sc->ring_event = -1;
+    sc->write_avail = -1;
+    alsa_settings_apply (sc, _ss);
+
+    if (alsa_buffers_init (sc) < 0)
+    {
+        snd_pcm_close (sc->pcm);
+        alsa_capture_close (sc);
+        alsa_buffers_free (sc);
+        free (sc);
+        return -1;
+    }
+
+    if (sc->settings.flags & SINUS_FLAG_RING)
+    {
+        if (sinus_ring_init (&sc->ring, sc->settings.buffer_frames,
+                             alsa_device_frame_bytes (sc))
+            < 0)
+        {
+            snd_pcm_close (sc->pcm);
+            alsa_capture_close (sc);
+            alsa_buffers_free (sc);
+            free (sc);
+            return -1;
+        }
+        sc->ring_enabled = true;
+        sc->ring_event = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        if (sc->ring_event < 0 || alsa_thread_start_default (sc) < 0)
+        {
+            if (sc->ring_event >= 0)
+                close (sc->ring_event);
+            sinus_ring_deinit (&sc->ring);
+            snd_pcm_close (sc->pcm);
+            alsa_capture_close (sc);
+            alsa_buffers_free (sc);
+            free (sc);
+            return -1;
+        }
+    }
+
+    *_sc = sc;
+    return 0;
+}
+
+void
+sinus_context_deinit (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    sinus_mixer_destroy (sc->mixer);
+    alsa_thread_stop (sc);
+    alsa_capture_thread_stop (sc);
+    sc->running = false;
+
+    if (sc->pcm != NULL)
+    {
+        // snd_pcm_drain (sc->pcm);
+        snd_pcm_close (sc->pcm);
+        sc->pcm = NULL;
+    }
+    alsa_capture_close (sc);
+
+    if (sc->ring_enabled)
+    {
+        close (sc->ring_event);
+        sinus_ring_deinit (&sc->ring);
+    }
+    if (sc->submit)
+    {
+        sinus_submit_deinit (sc->submit);
+        free (sc->submit);
+    }
+    alsa_buffers_free (sc);
+    free (sc);
+}
+
+/* Whether ss needs hw params the device doesn't have now: a different
+ * layout, or a format or rate the device would take directly instead of
+ * having it converted. Only refines a scratch configuration, the stream
+ * keeps playing meanwhile. */
+static bool
+alsa_device_needs_change (SinusContext *sc, const SinusSettings *ss)
+{
+    const SinusSettings *cur = &sc->settings;
+
+    if (ss->channels != cur->channels || ss->buffer_frames != cur->buffer_frames
+        || alsa_period_frames (ss) != alsa_period_frames (cur)
+        || !ss->interleaved != !cur->interleaved)
+        return true;
+
+    snd_pcm_hw_params_t *hw_params;
+    snd_pcm_hw_params_alloca (&hw_params);
+
+    if (snd_pcm_hw_params_any (sc->pcm, hw_params) < 0)
+        return true;
+
+    if (ss->fmt != sc->device_fmt
+        && snd_pcm_hw_params_test_format (sc->pcm, hw_params,
+                                          alsa_format_from_sinus (ss->fmt))
+               == 0)
+        return true;
+
+    return ss->sample_rate != sc->device_rate
+           && snd_pcm_hw_params_test_rate (sc->pcm, hw_params, ss->sample_rate,
+                                           0)
+                  == 0;
+}
+
+static int
+alsa_pcm_start (snd_pcm_t *pcm)
+{
+    snd_pcm_state_t st = snd_pcm_state (pcm);
+    if (st == SND_PCM_STATE_SUSPENDED)
+    {
+        int r = snd_pcm_resume (pcm);
+        if (r < 0)
+        {
+            snd_pcm_prepare (pcm);
+        }
+    }
+
+    int err = snd_pcm_pause (pcm, 0);
+    if (err < 0)
+    {
+        if (err == -ENOSYS || err == -EOPNOTSUPP)
+        {
+            err = snd_pcm_start (pcm);
+            if (err < 0)
+            {
+                snd_pcm_prepare (pcm);
+                err = snd_pcm_start (pcm);
+            }
+        }
+        else
+        {
+            snd_pcm_prepare (pcm);
+            err = snd_pcm_start (pcm);
+        }
+    }
+
+    return err;
+}
+
+/* Let everything queued in the ring and the device play, then leave the
+ * pcm in SETUP for new hw params. A paused or stopped stream isn't going
+ * to play anything, its frames are dropped. Not with the thread running. */
+static void
+alsa_play_out (SinusContext *sc)
+{
+    if (sc->running)
+    {
+        const void *frames;
+        uint32_t n;
+
+        while (sc->ring_enabled
+               && (n = sinus_ring_read_region (&sc->ring, &frames)) > 0)
+        {
+            if (!alsa_write_device (sc, frames, n))
+                break;
+            sinus_ring_consume (&sc->ring, n);
+        }
+
+        while (snd_pcm_drain (sc->pcm) == -EINTR)
+            ;
+    }
+
+    snd_pcm_drop (sc->pcm);
+
+    if (sc->ring_enabled)
+    {
+        sinus_ring_reset (&sc->ring);
+        __atomic_store_n (&sc->device_buffered, 0, __ATOMIC_RELAXED);
+    }
+}
+
+/* A renegotiated pcm is left PREPARED: running again if it was before, so
+ * the write paths see it RUNNING, else the context is stopped */
+static void
+alsa_reconfigure_resume (SinusContext *sc, bool was_running)
+{
+    if (was_running && alsa_pcm_start (sc->pcm) == 0)
+        return;
+    sc->running = false;
+}
+
+/* Neither the new settings nor the old ones got a device or buffers back:
+ * the context keeps no pcm and only deinit is left to do */
+static int
+alsa_reconfigure_fail (SinusContext *sc)
+{
+    alsa_buffers_free (sc);
+    if (sc->pcm)
+    {
+        snd_pcm_close (sc->pcm);
+        sc->pcm = NULL;
+    }
+    sc->running = false;
+    return -1;
+}
+
+int
+sinus_context_reconfigure (SinusContext *sc, const SinusSettings *ss)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (ss != NULL);
+
+    if (!sc->pcm || sc->capture_pcm || sinus_format_to_size (ss->fmt) == 0
+        || ss->channels == 0 || ss->sample_rate == 0 || ss->buffer_frames == 0
+        || ((ss->flags ^ sc->settings.flags) & SINUS_FLAG_RING)
+        || !sinus_mixer_idle (sc->mixer))
+        return -1;
+
+    /* Mixes in the old format and channels, sinus_stream_open makes a new
+     * one */
+    sinus_mixer_destroy (sc->mixer);
+    sc->mixer = NULL;
+
+    SinusSettings next = *ss;
+    SinusSettings prev = sc->settings;
+    bool was_running = sc->running;
+    bool renegotiate;
+
+    /* The thread goes back to whatever mode is set when we're done */
+    alsa_thread_stop (sc);
+
+    renegotiate = alsa_device_needs_change (sc, &next);
+    if (renegotiate)
+    {
+        alsa_play_out (sc);
+
+        /* Same pcm if it takes the new settings at all, which is most of
+         * the time; a full probe otherwise, back to the old settings if
+         * that finds nothing either */
+        if (alsa_configure (sc, sc->pcm, &next, NULL) < 0)
+        {
+            snd_pcm_close (sc->pcm);
+            sc->pcm = NULL;
+            sc->probe = (SinusProbeStats){ 0 };
+
+            if (alsa_probe (sc, &next) < 0)
+            {
+                if (alsa_probe (sc, &prev) < 0)
+                    return alsa_reconfigure_fail (sc);
+                alsa_reconfigure_resume (sc, was_running);
+                return -1;
+            }
+        }
+    }
+
+    if (next.flags & SINUS_FLAG_NO_RESAMPLE)
+        next.sample_rate = sc->device_rate;
+
+    alsa_buffers_free (sc);
+    alsa_settings_apply (sc, &next);
+
+    if (alsa_buffers_init (sc) < 0)
+    {
+        /* Only the resampler can fail, and it worked for prev */
+        alsa_buffers_free (sc);
+        if (renegotiate)
+        {
+            alsa_play_out (sc);
+            alsa_configure (sc, sc->pcm, &prev, NULL);
+        }
+        alsa_settings_apply (sc, &prev);
+        if (alsa_buffers_init (sc) < 0)
+            return alsa_reconfigure_fail (sc);
+        if (renegotiate)
+            alsa_reconfigure_resume (sc, was_running);
+        alsa_thread_start_default (sc);
+        return -1;
+    }
+
+    /* Same device setup, same ring and whatever is queued in it. After a
+     * play out it's empty and may have to change size. */
+    if (sc->ring_enabled && renegotiate)
+    {
+        SinusRing ring;
+
+        if (sinus_ring_init (&ring, sc->settings.buffer_frames,
+                             alsa_device_frame_bytes (sc))
+            < 0)
+            return alsa_reconfigure_fail (sc);
+        sinus_ring_deinit (&sc->ring);
+        sc->ring = ring;
+    }
+
+    if (renegotiate)
+        alsa_reconfigure_resume (sc, was_running);
+
+    if (sc->fill_cb)
+        alsa_stage (sc);
+
+    return alsa_thread_start_default (sc);
+}
+
+/* The streams a control call has to move: playback, capture, or both
+ * unless they're linked and moving one moves the other. Returns how many. */
+static unsigned
+alsa_control_pcms (SinusContext *sc, snd_pcm_t **pcms)
+{
+    unsigned n = 0;
+
+    if (sc->pcm)
+        pcms[n++] = sc->pcm;
+    if (sc->capture_pcm && !(sc->pcm && sc->linked))
+        pcms[n++] = sc->capture_pcm;
+
+    return n;
+}
+
+/* Start processing frames */
+int
+sinus_control_start (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm && !sc->capture_pcm)
+        return -1; // a failed sinus_context_reconfigure
+
+    if (sc->running)
+        return 0;
+
+    snd_pcm_t *pcms[2];
+    unsigned npcms = alsa_control_pcms (sc, pcms);
+    int err = 0;
+
+    for (unsigned i = 0; i < npcms && err == 0; ++i)
+        err = alsa_pcm_start (pcms[i]);
+
+    if (err == 0)
+    {
+        sc->running = true;
+        return 0;
+    }
+
+    return -1;
+}
+
+/* Stop processing frames */
+int
+sinus_control_pause (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm && !sc->capture_pcm)
+        return -1; // a failed sinus_context_reconfigure
+
+    if (!sc->running)
+        return 0;
+
+    snd_pcm_t *pcms[2];
+    unsigned npcms = alsa_control_pcms (sc, pcms);
+
+    for (unsigned i = 0; i < npcms; ++i)
+    {
+        int err = snd_pcm_pause (pcms[i], 1);
+        if (err < 0)
+        {
+            if (err == -ENOSYS || err == -EOPNOTSUPP)
+            {
+                /* Pause not supported */
+                TODO ("Keep internal pause flag or something :3");
+                return -1;
+            }
+            return -1;
+        }
+    }
+
+    sc->running = false;
+
+    return 0;
+}
+
+/* Stop processing frames & Reset internal state */
+int
+sinus_control_stop (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm && !sc->capture_pcm)
+        return -1; // a failed sinus_context_reconfigure
+
+    if (!sc->running)
+        return 0;
+
+    /* Not mid-write into the dropped stream, which would restart it, nor
+     * inside the resampler or the ring reset below */
+    alsa_thread_stop (sc);
+
+    snd_pcm_t *pcms[2];
+    unsigned npcms = alsa_control_pcms (sc, pcms);
+    int err = 0;
+
+    for (unsigned i = 0; i < npcms && err == 0; ++i)
+    {
+        err = snd_pcm_drop (pcms[i]);
+        if (err < 0)
+        {
+            snd_pcm_prepare (pcms[i]);
+            break;
+        }
+
+        err = snd_pcm_prepare (pcms[i]);
+    }
+
+    if (err < 0)
+    {
+        alsa_thread_start_default (sc);
+        return -1;
+    }
+
+    sc->running = false;
+
+    if (sc->resampler)
+        sinus_resampler_reset (sc->resampler);
+
+    if (sc->ring_enabled)
+    {
+        sinus_ring_reset (&sc->ring);
+        __atomic_store_n (&sc->device_buffered, 0, __ATOMIC_RELAXED);
+    }
+
+    if (sc->submit)
+        sinus_submit_flush (sc->submit);
+
+    return alsa_thread_start_default (sc);
+}
+
+static sinus_ssize_t
+alsa_ring_write_timed (SinusContext *sc, const void *frames, uint32_t nframes,
+                       uint32_t timeout_us)
+{
+    uint64_t deadline = now_us () + (uint64_t)timeout_us;
+    uint32_t period = alsa_period_frames (&sc->settings);
+    const uint8_t *ptr = frames;
+    uint32_t frames_left = nframes;
+
+    for (;;)
+    {
+        uint32_t wr = alsa_ring_push (sc, ptr, frames_left);
+        ptr += (size_t)wr * alsa_frame_bytes (sc);
+        frames_left -= wr;
+
+        if (frames_left == 0 || !sc->running)
+            break;
+
+        uint64_t now = now_us ();
+        if (now >= deadline)
+            break; /* timeout expired */
+
+        /* Space opens up at the sample rate, no need to ask anyone */
+        uint32_t want = frames_left < period ? frames_left : period;
+        uint64_t wait_us
+            = (uint64_t)want * 1000000 / sc->settings.sample_rate + 1;
+        if (wait_us > deadline - now)
+            wait_us = deadline - now;
+        usleep ((useconds_t)wait_us);
+    }
+
+    return nframes - frames_left;
+}
+
+/* Whether a direct write may go ahead. An xrun or suspend goes through
+ * alsa_recover (alsa_recover_timed when timeout_ms isn't negative) so it gets
+ * counted, and a prepared stream is left for the write to start. */
+static bool
+alsa_write_ready (SinusContext *sc, long timeout_ms)
+{
+    int err;
+
+    sc->write_avail = -1;
+
+    switch (snd_pcm_state (sc->pcm))
+    {
+    case SND_PCM_STATE_RUNNING:
+    case SND_PCM_STATE_PREPARED:
+        return true;
+    case SND_PCM_STATE_XRUN:
+        err = -EPIPE;
+        break;
+    case SND_PCM_STATE_SUSPENDED:
+        err = -ESTRPIPE;
+        break;
+    default:
+        return false;
+    }
+
+    if (timeout_ms < 0)
+        return alsa_recover (sc, err) == 0;
+    return alsa_recover_timed (sc, err, timeout_ms) == 0;
+}
+
+/* Device frames a blocking write may queue. With SINUS_FLAG_ADAPTIVE that's
+ * the room under the target, waited for up to a period (avail_min wakes us
+ * once there's a period of it), otherwise no limit. */
+static uint32_t
+alsa_write_room (SinusContext *sc)
+{
+    if (!sc->adaptive)
+        return UINT32_MAX;
+
+    snd_pcm_sframes_t avail = alsa_write_avail (sc);
+    if (avail == 0)
+    {
+        snd_pcm_wait (sc->pcm, alsa_period_ms (sc));
+        avail = alsa_write_avail (sc);
+    }
+
+    if (avail < 0)
+    {
+        alsa_recover (sc, (int)avail);
+        return 0;
+    }
+
+    return (uint32_t)avail;
+}
+
+/* Interleaved frames in settings.fmt, whatever the device wants */
+static sinus_ssize_t
+alsa_write_frames (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    if (!sc->running)
+        return 0;
+
+    if (sc->ring_enabled)
+        return alsa_ring_push (sc, frames, nframes);
+
+    if (!alsa_write_ready (sc, -1))
+        return 0;
+
+    uint32_t dev_n = alsa_write_room (sc);
+    if (dev_n == 0)
+        return 0;
+
+    const void *dev = alsa_to_device (sc, frames, &nframes, &dev_n);
+
+    /* The resampler already took the frames, so all of its output has to go
+     * out for the count to mean anything */
+    if (alsa_resampling (sc))
+        return alsa_write_device (sc, dev, dev_n) ? nframes : 0;
+
+    snd_pcm_sframes_t ret = alsa_writei (sc, dev, dev_n);
+    if (ret >= 0)
+        return ret;
+
+    alsa_recover (sc, (int)ret);
+    return 0;
+}
+
+static sinus_ssize_t
+alsa_write_planar (SinusContext *sc, const void *const *channels,
+                   uint32_t nframes)
+{
+    uint32_t nchannels = sc->settings.channels;
+    size_t sample_bytes = (size_t)sinus_format_to_size (sc->settings.fmt);
+
+    if (!sc->running)
+        return 0;
+
+    if (sc->planar_access && !alsa_converting (sc) && !sc->ring_enabled)
+    {
+        /* The device takes the caller's planes as they are */
+        if (!alsa_write_ready (sc, -1))
+            return 0;
+
+        uint32_t room = alsa_write_room (sc);
+        if (nframes > room)
+            nframes = room;
+
+        void **planes = alloca (sizeof (void *) * nchannels);
+        memcpy (planes, channels, sizeof (void *) * nchannels);
+
+        snd_pcm_sframes_t ret
+            = alsa_wrote (sc, snd_pcm_writen (sc->pcm, planes, nframes));
+        if (ret >= 0)
+            return ret;
+
+        alsa_recover (sc, (int)ret);
+        return 0;
+    }
+
+    /* Interleave a stage's worth at a time and take the usual path */
+    const void **chunk = alloca (sizeof (void *) * nchannels);
+    void *stage = alsa_stage (sc);
+    uint32_t total = 0;
+
+    while (total < nframes)
+    {
+        uint32_t n = nframes - total;
+        if (n > sc->settings.buffer_frames)
+            n = sc->settings.buffer_frames;
+
+        for (uint32_t c = 0; c < nchannels; ++c)
+            chunk[c] = (const uint8_t *)channels[c] + total * sample_bytes;
+
+        sinus_interleave (stage, chunk, sc->settings.fmt, nchannels, n);
+
+        sinus_ssize_t wr = alsa_write_frames (sc, stage, n);
+        if (wr <= 0)
+            break;
+
+        total += (uint32_t)wr;
+        if ((uint32_t)wr < n)
+            break;
+    }
+
+    return total;
+}
+
+/* With interleaved = false the caller's buffer is one block of nframes
+ * samples per channel */
+static void
+alsa_channel_blocks (const SinusContext *sc, const void *frames,
+                     uint32_t nframes, const void **channels)
+{
+    size_t block_bytes
+        = (size_t)nframes * (size_t)sinus_format_to_size (sc->settings.fmt);
+
+    for (uint32_t c = 0; c < sc->settings.channels; ++c)
+        channels[c] = (const uint8_t *)frames + block_bytes * c;
+}
+
+sinus_ssize_t
+sinus_frames_write (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    uint64_t start = sinus_stats_now_ns ();
+    sinus_ssize_t ret;
+
+    if (sc->settings.interleaved)
+        ret = alsa_write_frames (sc, frames, nframes);
+    else
+    {
+        const void **channels
+            = alloca (sizeof (void *) * sc->settings.channels);
+        alsa_channel_blocks (sc, frames, nframes, channels);
+        ret = alsa_write_planar (sc, channels, nframes);
+    }
+
+    alsa_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+/* Read position in a sinus_frames_writev chain */
+typedef struct
+{
+    const SinusIovec *iov;
+    int iovcnt;
+    int index;
+    uint32_t offset; // frames into iov[index]
+} AlsaGather;
+
+/* Copies the next nframes of the chain to dst as fmt, without moving on */
+static void
+alsa_gather (SinusContext *sc, const AlsaGather *g, void *dst, SinusFormat fmt,
+             uint32_t nframes)
+{
+    uint32_t frame_bytes = alsa_frame_bytes (sc);
+    uint32_t dst_bytes
+        = (uint32_t)sinus_format_to_size (fmt) * sc->settings.channels;
+    uint8_t *d = dst;
+    int i = g->index;
+    uint32_t offset = g->offset;
+
+    while (nframes > 0 && i < g->iovcnt)
+    {
+        uint32_t n = g->iov[i].nframes - offset;
+        if (n > nframes)
+            n = nframes;
+
+        const uint8_t *src
+            = (const uint8_t *)g->iov[i].frames + (size_t)offset * frame_bytes;
+        if (fmt == sc->settings.fmt)
+            memcpy (d, src, (size_t)n * frame_bytes);
+        else
+            sinus_convert (d, fmt, src, sc->settings.fmt,
+                           (size_t)n * sc->settings.channels);
+
+        d += (size_t)n * dst_bytes;
+        nframes -= n;
+        offset += n;
+        if (offset == g->iov[i].nframes)
+        {
+            ++i;
+            offset = 0;
+        }
+    }
+}
+
+static void
+alsa_gather_skip (AlsaGather *g, uint64_t nframes)
+{
+    while (g->index < g->iovcnt)
+    {
+        uint32_t left = g->iov[g->index].nframes - g->offset;
+        if (nframes < left)
+        {
+            g->offset += (uint32_t)nframes;
+            return;
+        }
+
+        nframes -= left;
+        ++g->index;
+        g->offset = 0;
+    }
+}
+
+/* Writes the gathered chain into device space, blocking for room like
+ * sinus_frames_write does (adaptive contexts stop after one period's wait
+ * instead). Only for interleaved, non-resampling, ring-less contexts. */
+static uint64_t
+alsa_writev_device (SinusContext *sc, const SinusIovec *iov, int iovcnt,
+                    uint64_t total)
+{
+    AlsaGather g = { .iov = iov, .iovcnt = iovcnt };
+    uint64_t done = 0;
+    bool waited = false;
+
+    if (!alsa_write_ready (sc, -1))
+        return 0;
+
+    while (done < total)
+    {
+        snd_pcm_sframes_t avail = alsa_write_avail (sc);
+        if (avail < 0)
+        {
+            if (alsa_recover (sc, (int)avail) < 0)
+                break;
+            continue;
+        }
+
+        if (avail == 0)
+        {
+            if (waited && sc->adaptive)
+                break;
+            snd_pcm_wait (sc->pcm, alsa_period_ms (sc));
+            waited = true;
+            continue;
+        }
+
+        snd_pcm_uframes_t n = (snd_pcm_uframes_t)avail;
+        if (n > total - done)
+            n = (snd_pcm_uframes_t)(total - done);
+
+        snd_pcm_sframes_t ret;
+
+        if (sc->mmap_access)
+        {
+            const snd_pcm_channel_area_t *areas;
+            snd_pcm_uframes_t offset;
+
+            int err = snd_pcm_mmap_begin (sc->pcm, &areas, &offset, &n);
+            if (err < 0)
+            {
+                if (alsa_recover (sc, err) < 0)
+                    break;
+                continue;
+            }
+
+            /* Interleaved: one area, first/step are in bits */
+            alsa_gather (sc, &g,
+                         (uint8_t *)areas[0].addr
+                             + (areas[0].first + offset * areas[0].step) / 8,
+                         sc->device_fmt, (uint32_t)n);
+            ret = snd_pcm_mmap_commit (sc->pcm, offset, n);
+        }
+        else
+        {
+            void *dev = alsa_converting (sc) ? sc->convert_buffer
+                                             : alsa_stage (sc);
+            if (n > sc->settings.buffer_frames)
+                n = sc->settings.buffer_frames;
+
+            alsa_gather (sc, &g, dev, sc->device_fmt, (uint32_t)n);
+            ret = alsa_writei (sc, dev, (uint32_t)n);
+        }
+
+        if (ret < 0)
+        {
+            if (alsa_recover (sc, (int)ret) < 0)
+                break;
+            continue;
+        }
+
+        alsa_gather_skip (&g, (uint64_t)ret);
+        done += (uint64_t)ret;
+
+        /* mmap commits don't trigger the start threshold like writes do */
+        if (snd_pcm_state (sc->pcm) == SND_PCM_STATE_PREPARED)
+            snd_pcm_start (sc->pcm);
+    }
+
+    return done;
+}
+
+sinus_ssize_t
+sinus_frames_writev (SinusContext *sc, const SinusIovec *iov, int iovcnt)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    if (iovcnt < 0 || (iovcnt > 0 && !iov))
+        return -1;
+
+    uint64_t start = sinus_stats_now_ns ();
+    uint64_t total = 0;
+    sinus_ssize_t ret = 0;
+
+    for (int i = 0; i < iovcnt; ++i)
+        total += iov[i].nframes;
+
+    if (!sc->running)
+        ret = 0;
+    else if (sc->settings.interleaved && !sc->ring_enabled
+             && !alsa_resampling (sc))
+        ret = (sinus_ssize_t)alsa_writev_device (sc, iov, iovcnt, total);
+    else
+    {
+        /* The ring is syscall-free already, and the resampler and planar
+         * layouts don't gather: one buffer after the other */
+        const void **channels
+            = alloca (sizeof (void *) * sc->settings.channels);
+
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            sinus_ssize_t n;
+
+            if (sc->settings.interleaved)
+                n = alsa_write_frames (sc, iov[i].frames, iov[i].nframes);
+            else
+            {
+                alsa_channel_blocks (sc, iov[i].frames, iov[i].nframes,
+                                     channels);
+                n = alsa_write_planar (sc, channels, iov[i].nframes);
+            }
+
+            if (n > 0)
+                ret += n;
+            if (n < (sinus_ssize_t)iov[i].nframes)
+                break;
+        }
+    }
+
+    alsa_stats_write (sc, total > UINT32_MAX ? UINT32_MAX : (uint32_t)total,
+                      ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_write_planar (SinusContext *sc, const void *const *channels,
+                           uint32_t nframes)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+    runtime_assert (channels != NULL);
+
+    uint64_t start = sinus_stats_now_ns ();
+    sinus_ssize_t ret = alsa_write_planar (sc, channels, nframes);
+
+    alsa_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+static sinus_ssize_t
+alsa_write_timed (SinusContext *sc, const void *frames, uint32_t nframes,
+                  uint32_t timeout_us)
+{
+    if (nframes == 0 || !frames)
+        return 0;
+
+    /* Planar layout: time one stage's worth, the caller resubmits the rest */
+    if (!sc->settings.interleaved)
+    {
+        const void **channels
+            = alloca (sizeof (void *) * sc->settings.channels);
+        alsa_channel_blocks (sc, frames, nframes, channels);
+
+        if (nframes > sc->settings.buffer_frames)
+            nframes = sc->settings.buffer_frames;
+        sinus_interleave (alsa_stage (sc), channels, sc->settings.fmt,
+                          sc->settings.channels, nframes);
+        frames = sc->stage;
+    }
+
+    if (sc->ring_enabled)
+        return sc->running ? alsa_ring_write_timed (sc, frames, nframes,
+                                                    timeout_us)
+                           : 0;
+
+    long timeout_ms = (long)(((uint64_t)timeout_us + 999) / 1000);
+    if (!sc->running || !alsa_write_ready (sc, timeout_ms))
+        return 0;
+
+    uint64_t deadline = now_us () + (uint64_t)timeout_us;
+    uint32_t frames_left = nframes;
+    sinus_ssize_t total_written = 0;
+    const uint8_t *ptr = frames;
+
+    while (frames_left > 0)
+    {
+        uint64_t now = now_us ();
+        if (now >= deadline)
+            break; /* timeout expired */
+        uint64_t rem_us = deadline - now;
+        long rem_ms = (long)((rem_us + 999) / 1000); /* ceil to ms */
+
+        snd_pcm_sframes_t avail = alsa_write_avail (sc);
+        if (avail < 0)
+        {
+            int rec = alsa_recover_timed (sc, (int)avail, rem_ms);
+            if (rec > 0)
+                break;
+            if (rec < 0)
+                return total_written > 0 ? total_written : rec;
+            continue;
+        }
+
+        if (avail == 0)
+        {
+            int w = snd_pcm_wait (sc->pcm, rem_ms);
+            if (w == 0)
+                break;
+            if (w < 0)
+            {
+                int rec = alsa_recover_timed (sc, w, rem_ms);
+                if (rec > 0)
+                    break;
+                if (rec < 0)
+                    return total_written > 0 ? total_written : rec;
+            }
+            continue;
+        }
+
+        /* alsa_to_device fits what's left into avail device frames */
+        uint32_t to_write = frames_left;
+        uint32_t dev_n = (uint32_t)avail;
+        const void *dev = alsa_to_device (sc, ptr, &to_write, &dev_n);
+        snd_pcm_sframes_t wr = alsa_writei (sc, dev, dev_n);
+
+        if (alsa_resampling (sc))
+        {
+            /* The resampler has taken to_write frames whatever happens */
+            ptr += (size_t)to_write * alsa_frame_bytes (sc);
+            frames_left -= to_write;
+            total_written += to_write;
+            if (wr >= 0)
+                continue;
+        }
+        else if (wr >= 0)
+        {
+            ptr += (size_t)wr * alsa_frame_bytes (sc);
+            frames_left -= (uint32_t)wr;
+            total_written += wr;
+            continue;
+        }
+
+        int rec = alsa_recover_timed (sc, (int)wr, rem_ms);
+        if (rec > 0)
+            break;
+        if (rec < 0)
+            return total_written > 0 ? total_written : rec;
+    }
+
+    return total_written;
+}
+
+sinus_ssize_t
+sinus_frames_write_timed (SinusContext *sc, const void *frames,
+                          uint32_t nframes, uint32_t timeout_us)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    uint64_t start = sinus_stats_now_ns ();
+    sinus_ssize_t ret = alsa_write_timed (sc, frames, nframes, timeout_us);
+
+    alsa_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+/* snd_pcm_drain, then pause. Called with the thread stopped. */
+static int
+alsa_drain (SinusContext *sc)
+{
+    int err;
+
+    for (;;)
+    {
+        err = snd_pcm_drain (sc->pcm);
+        if (err == 0)
+            break;
+        if (err == -EINTR)
+            continue;
+
+        alsa_stats_error (sc, err);
+
+        if (err == -ESTRPIPE)
+        {
+            int r;
+            while ((r = snd_pcm_resume (sc->pcm)) == -EAGAIN)
+                sleep (1);
+            if (r < 0)
+                r = snd_pcm_prepare (sc->pcm);
+            alsa_stats_recovered (sc, r);
+            continue;
+        }
+
+        if (err == -EPIPE)
+        {
+            alsa_stats_recovered (sc, snd_pcm_prepare (sc->pcm));
+            return err;
+        }
+
+        {
+            int r = snd_pcm_recover (sc->pcm, err, 1);
+            alsa_stats_recovered (sc, r);
+            if (r == 0)
+            {
+                continue;
+            }
+            else
+            {
+                return r;
+            }
+        }
+    }
+
+    err = snd_pcm_pause (sc->pcm, 1);
+    if (err < 0)
+    {
+        if (err == -ENOSYS || err == -EOPNOTSUPP)
+        {
+            snd_pcm_prepare (sc->pcm);
+        }
+        else if (err == -ESTRPIPE)
+        {
+            snd_pcm_prepare (sc->pcm);
+        }
+        else
+        {
+            snd_pcm_prepare (sc->pcm);
+        }
+    }
+
+    /* Linked capture already went down with playback */
+    if (sc->capture_pcm && !sc->linked)
+    {
+        snd_pcm_drop (sc->capture_pcm);
+        snd_pcm_prepare (sc->capture_pcm);
+    }
+
+    return 0;
+}
+
+int
+sinus_control_drain (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm && !sc->capture_pcm)
+        return -1; // a failed sinus_context_reconfigure
+
+    /* Nothing queued on the way in, capture just stops where it is */
+    if (!sc->pcm)
+        return sinus_control_pause (sc);
+
+    snd_pcm_state_t st = snd_pcm_state (sc->pcm);
+
+    if (!sc->running || st == SND_PCM_STATE_PAUSED)
+    {
+        return -1;
+    }
+
+    if (sc->ring_enabled)
+    {
+        /* Let the thread hand everything queued to the device first */
+        useconds_t period_us = (useconds_t)alsa_period_ms (sc) * 1000;
+        while (sinus_ring_buffered (&sc->ring) > 0 && sc->thread_started)
+            usleep (period_us);
+    }
+
+    if (sc->submit)
+    {
+        /* Same for submitted buffers */
+        useconds_t period_us = (useconds_t)alsa_period_ms (sc) * 1000;
+        while (sinus_submit_pending (sc->submit) > 0 && sc->thread_started)
+            usleep (period_us);
+    }
+
+    /* Not writing into the stream while it drains, which would keep it
+     * going */
+    alsa_thread_stop (sc);
+
+    int err = alsa_drain (sc);
+    if (err == 0)
+        sc->running = false;
+
+    if (alsa_thread_start_default (sc) < 0)
+        return -1;
+
+    return err;
+}
+
+/* Frames queued in front of the speaker, in device frames */
+static sinus_ssize_t
+alsa_device_buffered (SinusContext *sc)
+{
+    if (sc->ring_enabled)
+        return sinus_ring_buffered (&sc->ring)
+               + __atomic_load_n (&sc->device_buffered, __ATOMIC_RELAXED);
+
+    snd_pcm_sframes_t avail = 0;
+    snd_pcm_sframes_t delay = 0;
+
+    int err = snd_pcm_avail_delay (sc->pcm, &avail, &delay);
+    if (err == 0)
+    {
+        if (delay < 0)
+            return 0;
+        return (sinus_ssize_t)delay;
+    }
+
+    if (err == -ENOSYS || err == -EOPNOTSUPP || err < 0)
+    {
+        snd_pcm_status_t *status;
+        snd_pcm_status_alloca (&status);
+        err = snd_pcm_status (sc->pcm, status);
+        if (err == 0)
+        {
+            snd_pcm_sframes_t sdelay = snd_pcm_status_get_delay (status);
+            if (sdelay < 0)
+                return 0;
+            return (sinus_ssize_t)sdelay;
+        }
+    }
+
+    alsa_stats_error (sc, err);
+
+    if (err == -EPIPE)
+    {
+        alsa_stats_recovered (sc, snd_pcm_prepare (sc->pcm));
+        return 0;
+    }
+
+    if (err == -ESTRPIPE)
+    {
+        int r = snd_pcm_resume (sc->pcm);
+        if (r < 0)
+            r = snd_pcm_prepare (sc->pcm);
+        alsa_stats_recovered (sc, r);
+        return 0;
+    }
+
+    int rec = snd_pcm_recover (sc->pcm, err, 1);
+    alsa_stats_recovered (sc, rec);
+    if (rec >= 0)
+    {
+        if (snd_pcm_avail_delay (sc->pcm, &avail, &delay) == 0)
+        {
+            if (delay < 0)
+                return 0;
+            return (sinus_ssize_t)delay;
+        }
+    }
+
+    return (sinus_ssize_t)err;
+}
+
+/* Room for more frames, in device frames */
+static sinus_ssize_t
+alsa_device_free (SinusContext *sc)
+{
+    if (sc->ring_enabled)
+        return alsa_ring_room (sc);
+
+    snd_pcm_sframes_t nframes = alsa_avail (sc);
+
+    if (nframes == -ENOSYS || nframes == -EOPNOTSUPP || nframes < 0)
+    {
+        snd_pcm_status_t *status;
+        snd_pcm_status_alloca (&status);
+        int err = snd_pcm_status (sc->pcm, status);
+
+        if (err == 0)
+        {
+            nframes = snd_pcm_status_get_avail (status);
+            if (nframes < 0)
+                return 0;
+            return (sinus_ssize_t)nframes;
+        }
+    }
+
+    alsa_stats_error (sc, (int)nframes);
+
+    if (nframes == -EPIPE)
+    {
+        alsa_stats_recovered (sc, snd_pcm_prepare (sc->pcm));
+        return 0;
+    }
+
+    if (nframes == -ESTRPIPE)
+    {
+        int r = snd_pcm_resume (sc->pcm);
+        if (r < 0)
+            r = snd_pcm_prepare (sc->pcm);
+        alsa_stats_recovered (sc, r);
+        return 0;
+    }
+
+    int rec = snd_pcm_recover (sc->pcm, (int)nframes, 1);
+    alsa_stats_recovered (sc, rec);
+    if (rec >= 0)
+        return alsa_device_free (sc);
+
+    return nframes;
+}
+
+/* When a frame written now starts to play, on CLOCK_MONOTONIC. The delay is
+ * counted from the last hardware pointer update when the device stamps
+ * them, from now otherwise. */
+static uint64_t
+alsa_queue_end_ns (SinusContext *sc)
+{
+    uint64_t stamp_ns = 0;
+    uint64_t delay = 0; // device frames
+    snd_pcm_uframes_t avail = 0;
+    snd_htimestamp_t ts;
+
+    if (snd_pcm_htimestamp (sc->pcm, &avail, &ts) == 0
+        && (ts.tv_sec != 0 || ts.tv_nsec != 0))
+    {
+        stamp_ns = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        if (avail < sc->device_buffer_frames)
+            delay = sc->device_buffer_frames - avail;
+        if (sc->ring_enabled)
+            delay += sinus_ring_buffered (&sc->ring);
+    }
+    else
+    {
+        sinus_ssize_t n = alsa_device_buffered (sc);
+        stamp_ns = sinus_stats_now_ns ();
+        if (n > 0)
+            delay = (uint64_t)n;
+    }
+
+    uint64_t ns = stamp_ns + delay * 1000000000ULL / sc->device_rate;
+    if (sc->resampler)
+        ns += (uint64_t)sinus_resampler_latency (sc->resampler)
+              * 1000000000ULL / sc->settings.sample_rate;
+    return ns;
+}
+
+static sinus_ssize_t
+alsa_write_at (SinusContext *sc, const void *frames, uint32_t nframes,
+               uint64_t presentation_ns, int64_t *error_ns)
+{
+    if (error_ns)
+        *error_ns = 0;
+    if (!sc->running || nframes == 0 || !frames)
+        return 0;
+
+    int64_t rate = (int64_t)sc->settings.sample_rate;
+    uint64_t start_ns = alsa_queue_end_ns (sc);
+    int64_t offset = (int64_t)(presentation_ns - start_ns);
+    uint64_t pad = 0;
+    uint32_t skip = 0;
+
+    /* To the nearest frame, which is as close as it gets */
+    if (offset > 0)
+        pad = ((uint64_t)offset * (uint64_t)rate + 500000000) / 1000000000;
+    else
+    {
+        uint64_t late
+            = ((uint64_t)-offset * (uint64_t)rate + 500000000) / 1000000000;
+        skip = late < nframes ? (uint32_t)late : nframes;
+    }
+
+    uint64_t padded = 0;
+    if (pad > 0)
+    {
+        uint32_t chunk = sc->settings.buffer_frames;
+        if (pad < chunk)
+            chunk = (uint32_t)pad;
+
+        void *stage = alsa_stage (sc);
+        sinus_silence (stage, sc->settings.fmt,
+                       (size_t)chunk * sc->settings.channels);
+
+        while (padded < pad)
+        {
+            uint32_t n = pad - padded < chunk ? (uint32_t)(pad - padded)
+                                               : chunk;
+            sinus_ssize_t wr = alsa_write_frames (sc, stage, n);
+            if (wr < 0)
+                return wr;
+
+            padded += (uint64_t)wr;
+            if ((uint32_t)wr < n)
+                break;
+        }
+    }
+
+    if (error_ns)
+        *error_ns = (int64_t)(start_ns - presentation_ns)
+                    + ((int64_t)padded - (int64_t)skip) * 1000000000 / rate;
+
+    /* The rest of the silence goes first, next time */
+    if (padded < pad)
+        return 0;
+
+    sinus_ssize_t wr;
+    if (sc->settings.interleaved)
+        wr = alsa_write_frames (sc,
+                                (const uint8_t *)frames
+                                    + (size_t)skip * alsa_frame_bytes (sc),
+                                nframes - skip);
+    else
+    {
+        size_t sample_bytes = (size_t)sinus_format_to_size (sc->settings.fmt);
+        const void **channels
+            = alloca (sizeof (void *) * sc->settings.channels);
+        alsa_channel_blocks (sc, frames, nframes, channels);
+        for (uint32_t c = 0; c < sc->settings.channels; ++c)
+            channels[c] = (const uint8_t *)channels[c] + skip * sample_bytes;
+        wr = alsa_write_planar (sc, channels, nframes - skip);
+    }
+
+    if (wr < 0)
+        return wr;
+    return (sinus_ssize_t)skip + wr;
+}
+
+sinus_ssize_t
+sinus_frames_write_at (SinusContext *sc, const void *frames, uint32_t nframes,
+                       uint64_t presentation_ns, int64_t *error_ns)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    uint64_t start = sinus_stats_now_ns ();
+    sinus_ssize_t ret
+        = alsa_write_at (sc, frames, nframes, presentation_ns, error_ns);
+
+    alsa_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_get_n_frames_buffered (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    sinus_ssize_t n = alsa_device_buffered (sc);
+    if (n <= 0)
+        return n;
+
+    return alsa_to_user_frames (sc, (uint64_t)n);
+}
+
+sinus_ssize_t
+sinus_frames_get_n_frames_free (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    sinus_ssize_t n = alsa_device_free (sc);
+    if (n <= 0)
+        return n;
+
+    return alsa_to_user_frames (sc, (uint64_t)n);
+}
+
+int
+sinus_poll_fds_count (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    if (sc->ring_enabled)
+        return 1;
+
+    return snd_pcm_poll_descriptors_count (sc->pcm);
+}
+
+int
+sinus_poll_fds_get (SinusContext *sc, struct pollfd *fds, uint32_t nfds)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+    runtime_assert (fds != NULL || nfds == 0);
+
+    if (!sc->ring_enabled)
+        return snd_pcm_poll_descriptors (sc->pcm, fds, nfds);
+
+    if (nfds < 1)
+        return 0;
+
+    fds[0] = (struct pollfd){ .fd = sc->ring_event, .events = POLLIN };
+    return 1;
+}
+
+/* avail_min is one period (see alsa_open_and_configure, and
+ * alsa_apply_target for SINUS_FLAG_ADAPTIVE), so the PCM's own POLLOUT
+ * already means hint_min_write_frames of space */
+int
+sinus_poll_revents (SinusContext *sc, struct pollfd *fds, uint32_t nfds,
+                    unsigned short *revents)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+    runtime_assert (revents != NULL);
+
+    if (!sc->ring_enabled)
+        return snd_pcm_poll_descriptors_revents (sc->pcm, fds, nfds, revents);
+
+    *revents = 0;
+    if (nfds < 1 || !(fds[0].revents & POLLIN))
+        return 0;
+
+    /* Clear first, then look: a signal from a consume in between survives,
+     * and while there's room the descriptor stays ready */
+    eventfd_t ignored;
+    eventfd_read (sc->ring_event, &ignored);
+
+    if (alsa_ring_room (sc) >= alsa_period_frames (&sc->settings))
+    {
+        eventfd_write (sc->ring_event, 1);
+        *revents = POLLOUT;
     }
 
-    return total_written;
+    return 0;
 }
 
-int
-sinus_control_drain (SinusContext *sc)
+uint32_t
+sinus_info_get_sample_rate (SinusContext *sc)
+{
+    // TODO: get straight from ALSA?
+    return sc->settings.sample_rate; // resampled to device_rate if needed
+}
+
+uint32_t
+sinus_info_get_channels (SinusContext *sc)
+{
+    return sc->settings.channels;
+}
+
+SinusFormat
+sinus_info_get_format (SinusContext *sc)
+{
+    return sc->settings.fmt;
+}
+
+uint32_t
+sinus_info_get_buffer_target (SinusContext *sc)
+{
+    if (!sc->adaptive)
+        return sc->settings.buffer_frames;
+
+    return sinus_latency_target (&sc->latency);
+}
+
+sinus_ssize_t
+sinus_frames_fill_callback_set (SinusContext *sc, SinusFillCallback cb)
 {
     runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+    if (!sc->pcm)
+        return -1;
 
-    int err;
+    if (cb && sc->submit)
+        return -1;
 
-    snd_pcm_state_t st = snd_pcm_state (sc->pcm);
+    alsa_thread_stop (sc);
 
-    if (!sc->running || st == SND_PCM_STATE_PAUSED)
+    sc->fill_cb = cb;
+    if (cb == NULL)
+        return alsa_thread_start_default (sc);
+
+    alsa_stage (sc);
+
+    if (alsa_thread_start (sc, alsa_fill_thread) < 0)
     {
+        sc->fill_cb = NULL;
         return -1;
     }
 
-    for (;;)
-    {
-        err = snd_pcm_drain (sc->pcm);
-        if (err == 0)
-            break;
-        if (err == -EINTR)
-            continue;
-
-        if (err == -ESTRPIPE)
-        {
-            int r;
-            while ((r = snd_pcm_resume (sc->pcm)) == -EAGAIN)
-                sleep (1);
-            if (r < 0)
-                snd_pcm_prepare (sc->pcm);
-            continue;
-        }
+    return 0;
+}
 
-        if (err == -EPIPE)
-        {
-            snd_pcm_prepare (sc->pcm);
-            return err;
-        }
+/* The queue and its thread, on first use */
+static int
+alsa_submit_setup (SinusContext *sc)
+{
+    if (sc->submit)
+        return 0;
+    if (sc->fill_cb || sc->ring_enabled)
+        return -1;
 
-        {
-            int r = snd_pcm_recover (sc->pcm, err, 1);
-            if (r == 0)
-            {
-                continue;
-            }
-            else
-            {
-                return r;
-            }
-        }
+    SinusSubmitQueue *q = malloc (sizeof (SinusSubmitQueue));
+    if (!q)
+        return -1;
+    if (sinus_submit_init (q) < 0)
+    {
+        free (q);
+        return -1;
     }
 
-    err = snd_pcm_pause (sc->pcm, 1);
-    if (err < 0)
+    sc->submit = q;
+    if (alsa_thread_start_default (sc) < 0)
     {
-        if (err == -ENOSYS || err == -EOPNOTSUPP)
-        {
-            snd_pcm_prepare (sc->pcm);
-        }
-        else if (err == -ESTRPIPE)
-        {
-            snd_pcm_prepare (sc->pcm);
-        }
-        else
-        {
-            snd_pcm_prepare (sc->pcm);
-        }
+        sc->submit = NULL;
+        sinus_submit_deinit (q);
+        free (q);
+        return -1;
     }
 
     return 0;
 }
 
+int
+sinus_submit (SinusContext *sc, const void *frames, uint32_t nframes,
+              void *cookie)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    if ((!frames && nframes > 0) || alsa_submit_setup (sc) < 0)
+        return -1;
+
+    return sinus_submit_push (sc->submit, frames, nframes, cookie);
+}
+
+int
+sinus_reap (SinusContext *sc, SinusCompletion *completions, uint32_t max)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->submit)
+        return 0;
+    if (!completions && max > 0)
+        return -1;
+
+    return sinus_submit_reap (sc->submit, completions, max);
+}
+
+int
+sinus_submit_fd (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    if (alsa_submit_setup (sc) < 0)
+        return -1;
+
+    return sc->submit->event;
+}
+
 sinus_ssize_t
-sinus_frames_get_n_frames_buffered (SinusContext *sc)
+sinus_frames_read (SinusContext *sc, void *frames, uint32_t nframes)
 {
     runtime_assert (sc != NULL);
-    runtime_assert (sc->pcm != NULL);
+    if (!sc->capture_pcm)
+        return -1;
 
-    snd_pcm_sframes_t avail = 0;
-    snd_pcm_sframes_t delay = 0;
+    if (alsa_capture_autostart (sc) < 0)
+        return -1;
 
-    int err = snd_pcm_avail_delay (sc->pcm, &avail, &delay);
-    if (err == 0)
+    return alsa_read_frames (sc, frames, nframes, -1);
+}
+
+sinus_ssize_t
+sinus_frames_read_timed (SinusContext *sc, void *frames, uint32_t nframes,
+                         uint32_t timeout_us)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->capture_pcm)
+        return -1;
+
+    if (alsa_capture_autostart (sc) < 0)
+        return -1;
+
+    return alsa_read_frames (sc, frames, nframes,
+                             (int)((timeout_us + 999) / 1000));
+}
+
+sinus_ssize_t
+sinus_frames_get_n_frames_available (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->capture_pcm)
+        return -1;
+
+    snd_pcm_sframes_t avail = snd_pcm_avail_update (sc->capture_pcm);
+    if (avail < 0)
     {
-        if (delay < 0)
-            return 0;
-        return (sinus_ssize_t)delay;
+        /* An overrun stops the stream, bring it back like a read would */
+        int r = alsa_capture_recover (sc, (int)avail);
+        if (r < 0)
+            return r;
+        avail = snd_pcm_avail_update (sc->capture_pcm);
     }
 
-    if (err == -ENOSYS || err == -EOPNOTSUPP || err < 0)
+    return avail;
+}
+
+sinus_ssize_t
+sinus_frames_capture_callback_set (SinusContext *sc, SinusCaptureCallback cb)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->capture_pcm)
+        return -1;
+
+    alsa_capture_thread_stop (sc);
+
+    sc->capture_cb = cb;
+    if (cb == NULL)
+        return 0;
+
+    __atomic_store_n (&sc->capture_quit, false, __ATOMIC_RELEASE);
+    if (pthread_create (&sc->capture_thread, NULL, alsa_capture_thread, sc)
+        != 0)
     {
-        snd_pcm_status_t *status;
-        snd_pcm_status_alloca (&status);
-        err = snd_pcm_status (sc->pcm, status);
-        if (err == 0)
-        {
-            snd_pcm_sframes_t sdelay = snd_pcm_status_get_delay (status);
-            if (sdelay < 0)
-                return 0;
-            return (sinus_ssize_t)sdelay;
-        }
+        sc->capture_cb = NULL;
+        return -1;
     }
 
-    if (err == -EPIPE)
+    sc->capture_thread_started = true;
+    return 0;
+}
+
+int
+sinus_frames_begin_write (SinusContext *sc, void **frames, uint32_t *nframes)
+{
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+    runtime_assert (frames != NULL && nframes != NULL);
+
+    if (!sc->running)
     {
-        snd_pcm_prepare (sc->pcm);
+        *nframes = 0;
         return 0;
     }
 
-    if (err == -ESTRPIPE)
+    if (sc->ring_enabled && !alsa_converting (sc))
     {
-        int r = snd_pcm_resume (sc->pcm);
-        if (r < 0)
-            snd_pcm_prepare (sc->pcm);
+        uint32_t room = alsa_ring_room (sc);
+        if (*nframes > room)
+            *nframes = room;
+        *frames = sinus_ring_write_region (&sc->ring, nframes);
         return 0;
     }
 
-    int rec = snd_pcm_recover (sc->pcm, err, 1);
-    if (rec >= 0)
+    if (sc->ring_enabled)
     {
-        if (snd_pcm_avail_delay (sc->pcm, &avail, &delay) == 0)
-        {
-            if (delay < 0)
-                return 0;
-            return (sinus_ssize_t)delay;
-        }
+        /* Render into the staging area, commit converts into the ring */
+        uint32_t free_frames = alsa_to_user_frames (sc, alsa_ring_room (sc));
+        if (*nframes > free_frames)
+            *nframes = free_frames;
+        if (*nframes > sc->settings.buffer_frames)
+            *nframes = sc->settings.buffer_frames;
+        *frames = alsa_stage (sc);
+        return 0;
     }
 
-    return (sinus_ssize_t)err;
-}
+    snd_pcm_sframes_t avail = alsa_avail (sc);
+    if (avail < 0)
+    {
+        *nframes = 0;
+        return alsa_recover (sc, (int)avail) < 0 ? -1 : 0;
+    }
 
-sinus_ssize_t
-sinus_frames_get_n_frames_free (SinusContext *sc)
-{
-    snd_pcm_sframes_t nframes = snd_pcm_avail_update (sc->pcm);
+    avail = alsa_to_user_frames (sc, (uint64_t)avail);
+    if (*nframes > (uint32_t)avail)
+        *nframes = (uint32_t)avail;
 
-    if (nframes == -ENOSYS || nframes == -EOPNOTSUPP || nframes < 0)
+    /* The mmap area is in the device format, converting needs a detour */
+    if (!sc->mmap_access || alsa_converting (sc))
     {
-        snd_pcm_status_t *status;
-        snd_pcm_status_alloca (&status);
-        int err = snd_pcm_status (sc->pcm, status);
-
-        if (err == 0)
-        {
-            nframes = snd_pcm_status_get_avail (status);
-            if (nframes < 0)
-                return 0;
-            return (sinus_ssize_t)nframes;
-        }
+        if (*nframes > sc->settings.buffer_frames)
+            *nframes = sc->settings.buffer_frames;
+        *frames = alsa_stage (sc);
+        return 0;
     }
 
-    if (nframes == -EPIPE)
+    const snd_pcm_channel_area_t *areas;
+    snd_pcm_uframes_t offset;
+    snd_pcm_uframes_t n = *nframes;
+
+    int err = snd_pcm_mmap_begin (sc->pcm, &areas, &offset, &n);
+    if (err < 0)
     {
-        snd_pcm_prepare (sc->pcm);
+        *nframes = 0;
+        return alsa_recover (sc, err) < 0 ? -1 : 0;
+    }
+
+    /* Interleaved: one area, first/step are in bits */
+    *frames = (uint8_t *)areas[0].addr
+              + (areas[0].first + offset * areas[0].step) / 8;
+    *nframes = (uint32_t)n;
+    sc->mmap_offset = offset;
+
+    return 0;
+}
+
+static sinus_ssize_t
+alsa_commit (SinusContext *sc, uint32_t nframes)
+{
+    if (!sc->running)
         return 0;
+
+    if (sc->ring_enabled && !alsa_converting (sc))
+    {
+        sinus_ring_commit (&sc->ring, nframes);
+        return nframes;
     }
 
-    if (nframes == -ESTRPIPE)
+    if (sc->ring_enabled)
+        return alsa_ring_push (sc, sc->stage, nframes);
+
+    if (!sc->mmap_access || alsa_converting (sc))
+        return alsa_write_all (sc, sc->stage, nframes) ? nframes : 0;
+
+    snd_pcm_sframes_t ret
+        = snd_pcm_mmap_commit (sc->pcm, sc->mmap_offset, nframes);
+    if (ret < 0)
     {
-        int r = snd_pcm_resume (sc->pcm);
-        if (r < 0)
-            snd_pcm_prepare (sc->pcm);
+        alsa_recover (sc, (int)ret);
         return 0;
     }
 
-    if (snd_pcm_recover (sc->pcm, nframes, 1) >= 0)
-        return sinus_frames_get_n_frames_free (sc);
+    /* mmap commits don't trigger the start threshold like writes do */
+    if (snd_pcm_state (sc->pcm) == SND_PCM_STATE_PREPARED)
+        snd_pcm_start (sc->pcm);
 
-    return nframes;
+    return ret;
 }
 
-uint32_t
-sinus_info_get_sample_rate (SinusContext *sc)
+sinus_ssize_t
+sinus_frames_commit (SinusContext *sc, uint32_t nframes)
 {
-    // TODO: get straight from ALSA?
-    return sc->settings.sample_rate; // updated at sinus_context_init
+    runtime_assert (sc != NULL);
+    if (!sc->pcm)
+        return -1;
+
+    uint64_t start = sinus_stats_now_ns ();
+    sinus_ssize_t ret = alsa_commit (sc, nframes);
+
+    alsa_stats_write (sc, nframes, ret, start);
+    return ret;
 }
 
-uint32_t
-sinus_info_get_channels (SinusContext *sc)
+SinusMixer **
+sinus_context_mixer (SinusContext *sc)
 {
-    return sc->settings.channels;
+    return &sc->mixer;
 }
 
-SinusFormat
-sinus_info_get_format (SinusContext *sc)
+void
+sinus_stats_get (SinusContext *sc, SinusStats *stats)
 {
-    return sc->settings.fmt;
+    runtime_assert (sc != NULL);
+    runtime_assert (stats != NULL);
+
+    sinus_stats_copy (stats, &sc->stats);
+}
+
+void
+sinus_probe_stats (SinusContext *sc, SinusProbeStats *stats)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (stats != NULL);
+
+    *stats = sc->probe;
 }
@@ -0,0 +1,153 @@
+/*
+ * Cycle count of the Timer0 ISR, for simavr (make sim) or a real attiny85
+ * with something listening on GPIOR0.
+ *
+ * The ISR is called directly with Timer1 counting CPU cycles around it, for
+ * every frame of a group, for an empty buffer and for a flash table. Counts
+ * include the call and the reti; a real interrupt adds about as much for
+ * the vector jump and the wake-up. The highest count bounds the sample rate
+ * from above, and what it leaves of each mode's frame is the main loop's.
+ */
+
+#ifndef __AVR__
+#error "This file has to be compiled with AVR C compiler"
+#endif
+
+#include "sinus.c"
+
+#include <avr/sleep.h>
+#include <square.h>
+
+#ifdef SINUS_SIMAVR
+#include <avr_mcu_section.h>
+AVR_MCU (F_CPU, "attiny85");
+AVR_MCU_SIMAVR_CONSOLE (&GPIOR0);
+#endif
+
+static void
+console_puts (const char *s)
+{
+    while (*s)
+        GPIOR0 = (uint8_t)*s++;
+}
+
+static void
+console_putu (uint32_t v)
+{
+    char buf[11];
+    uint8_t i = sizeof (buf) - 1;
+
+    buf[i] = '\0';
+    do
+    {
+        buf[--i] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v > 0);
+
+    console_puts (buf + i);
+}
+
+/* Timer1 at CK, the overflow flag covers counts up to 511 */
+static uint16_t
+isr_cycles (void)
+{
+    uint8_t t0;
+    uint8_t t1;
+
+    cli ();
+    TIFR = (1 << TOV1);
+    t0 = TCNT1;
+    TIMER0_COMPA_vect ();
+    t1 = TCNT1;
+    cli (); // reti set it again
+
+    return (uint16_t)((uint8_t)(t1 - t0)) + ((TIFR & (1 << TOV1)) ? 256 : 0);
+}
+
+int
+main (void)
+{
+    SinusContext *sc;
+    static const uint8_t group[5] = { 0x55, 0x55, 0x55, 0x55, 0x55 };
+    uint16_t worst = 0;
+
+    sinus_context_init (&sc, NULL, NULL);
+    USI_MODE_SPI;
+    TCCR1 = (1 << CS10);
+
+    /* Two groups, so the last frame of the first has another behind it */
+    sinus_frames_write (sc, group, 4);
+    sinus_frames_write (sc, group, 4);
+
+    for (uint8_t k = 0; k < 4; ++k)
+    {
+        uint16_t c = isr_cycles ();
+
+        console_puts ("frame ");
+        console_putu (k);
+        console_puts (": ");
+        console_putu (c);
+        console_puts (" cycles\n");
+        if (c > worst)
+            worst = c;
+    }
+
+    sinus_control_stop (sc);
+    console_puts ("empty: ");
+    console_putu (isr_cycles ());
+    console_puts (" cycles\n");
+
+    /* A one sample loop at half speed, every other call wraps */
+    const SinusTable table = {
+        .samples = square_sample_table,
+        .nsamples = SQUARE_SAMPLE_COUNT,
+        .loop_start = 0,
+        .loop_end = 1,
+        .increment = 0x80,
+    };
+    sinus_table_play (sc, &table);
+    for (uint8_t k = 0; k < 2; ++k)
+    {
+        uint16_t c = isr_cycles ();
+
+        console_puts ("table: ");
+        console_putu (c);
+        console_puts (" cycles\n");
+        if (c > worst)
+            worst = c;
+    }
+    sinus_table_stop (sc);
+
+    console_puts ("max sample rate: ");
+    console_putu ((uint32_t)(F_CPU) / worst);
+    console_puts (" Hz\n");
+
+    /* What each mode leaves the main loop */
+    static const uint32_t modes[] = { TIMER0_RATE (MODE_22K),
+                                      TIMER0_RATE (MODE_32K),
+                                      TIMER0_RATE (MODE_44K) };
+    for (uint8_t m = 0; m < sizeof (modes) / sizeof (modes[0]); ++m)
+    {
+        uint16_t budget = (uint16_t)((uint32_t)(F_CPU) / modes[m]);
+
+        console_putu (modes[m]);
+        console_puts (" Hz: ");
+        console_putu (budget);
+        console_puts (" cycles a frame, ");
+        if (budget > worst)
+        {
+            console_putu (budget - worst);
+            console_puts (" left\n");
+        }
+        else
+        {
+            console_puts ("too slow\n");
+        }
+    }
+
+    /* simavr stops on sleep with interrupts off */
+    cli ();
+    sleep_mode ();
+    for (;;)
+        ;
+}
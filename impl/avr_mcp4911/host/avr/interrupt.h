@@ -0,0 +1,21 @@
+#ifndef _SINUS_HOST_AVR_INTERRUPT_H
+#define _SINUS_HOST_AVR_INTERRUPT_H
+
+/*
+ * Host stand-in for avr-libc's <avr/interrupt.h>. Vectors are plain
+ * functions that the simulated clock in host.c calls while the I flag in
+ * SREG is set.
+ */
+
+#include <avr/io.h>
+
+#define TIMER0_COMPA_vect sinus_host_timer0_compa_vect
+
+#define ISR(vector, ...)                                                       \
+    void vector (void);                                                        \
+    void vector (void)
+
+#define sei() (SREG |= (1 << SREG_I))
+#define cli() (SREG &= (uint8_t) ~(1 << SREG_I))
+
+#endif
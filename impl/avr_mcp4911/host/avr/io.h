@@ -0,0 +1,66 @@
+#ifndef _SINUS_HOST_AVR_IO_H
+#define _SINUS_HOST_AVR_IO_H
+
+/*
+ * Host stand-in for avr-libc's <avr/io.h>, the attiny85 registers the
+ * backend uses at their real I/O addresses.
+ *
+ * Every access goes through sinus_host_io, which first plays out the side
+ * effects of the previous write (a USI clock strobe, the slave select
+ * edge) before handing out the register. See host.c.
+ */
+
+#include <stdint.h>
+
+volatile uint8_t *sinus_host_io (uint8_t addr);
+
+#define _SFR_IO8(addr) (*sinus_host_io (addr))
+
+#define SREG _SFR_IO8 (0x3F)
+#define TIMSK _SFR_IO8 (0x39)
+#define TCCR0B _SFR_IO8 (0x33)
+#define TCNT0 _SFR_IO8 (0x32)
+#define TCCR0A _SFR_IO8 (0x2A)
+#define OCR0A _SFR_IO8 (0x29)
+#define PORTB _SFR_IO8 (0x18)
+#define DDRB _SFR_IO8 (0x17)
+#define PINB _SFR_IO8 (0x16)
+#define GPIOR0 _SFR_IO8 (0x11)
+#define USIDR _SFR_IO8 (0x0F)
+#define USISR _SFR_IO8 (0x0E)
+#define USICR _SFR_IO8 (0x0D)
+
+#define SREG_I 7
+
+#define OCIE0A 4
+
+#define WGM00 0
+#define WGM01 1
+
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+
+#define USISIE 7
+#define USIOIE 6
+#define USIWM1 5
+#define USIWM0 4
+#define USICS1 3
+#define USICS0 2
+#define USICLK 1
+#define USITC 0
+
+#define USISIF 7
+#define USIOIF 6
+#define USIPF 5
+#define USIDC 4
+
+#endif
@@ -0,0 +1,15 @@
+#ifndef _SINUS_HOST_AVR_PGMSPACE_H
+#define _SINUS_HOST_AVR_PGMSPACE_H
+
+/*
+ * Host stand-in for avr-libc's <avr/pgmspace.h>: one address space, flash
+ * reads are plain loads.
+ */
+
+#include <stdint.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+
+#endif
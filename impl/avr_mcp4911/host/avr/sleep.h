@@ -0,0 +1,13 @@
+#ifndef _SINUS_HOST_AVR_SLEEP_H
+#define _SINUS_HOST_AVR_SLEEP_H
+
+/*
+ * Host stand-in for avr-libc's <avr/sleep.h>. Idle sleep lasts until the
+ * next interrupt, on the host that is giving the clock thread a turn.
+ */
+
+void sinus_host_sleep (void);
+
+#define sleep_mode() sinus_host_sleep ()
+
+#endif
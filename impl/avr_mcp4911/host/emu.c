@@ -0,0 +1,206 @@
+/*
+ * The MCP4911 backend on the host: every 10-bit value goes in as a ramp and
+ * has to come out of the DAC in order, once with the compare matches
+ * stepped between writes (uneven steps, so the ring wraps at every offset)
+ * and once with the clock thread running in real time behind blocking
+ * writes and a drain. Then flash tables: a looping one at a fractional
+ * increment and the square one-shot, each taking over from the ring and
+ * handing back to it. Last, asking for 44.1 kHz has to get the 22 kHz mode,
+ * the only one on offer.
+ */
+
+#include "../sinus.c"
+
+#include "sinus_host.h"
+
+#include <square.h>
+
+#include <stdio.h>
+
+#define EMU_FRAMES 1024U
+
+static uint8_t emu_packed[EMU_FRAMES / 4 * 5];
+static uint16_t emu_out[SINUS_HOST_DAC_LOG];
+
+/* U10_P5: upper bytes first, then the low 2 bits of frame k at bit 2 * k */
+static void
+emu_pack (void)
+{
+    for (uint32_t g = 0; g < EMU_FRAMES / 4; ++g)
+    {
+        uint8_t *d = emu_packed + g * 5;
+
+        d[4] = 0;
+        for (uint32_t k = 0; k < 4; ++k)
+        {
+            uint32_t v = (g * 4 + k) & 0x3FF;
+            d[k] = (uint8_t)(v >> 2);
+            d[4] |= (uint8_t)((v & 3) << (2 * k));
+        }
+    }
+}
+
+static uint32_t
+emu_check (const char *name, uint32_t got, const SinusHostStats *before)
+{
+    SinusHostStats st;
+    uint32_t mismatches = got == EMU_FRAMES ? 0 : 1;
+
+    for (uint32_t i = 0; i < got && i < EMU_FRAMES; ++i)
+        mismatches += emu_out[i] != i;
+
+    sinus_host_stats (&st);
+    printf ("%-9s %4u frames out, %u mismatches, %llu isr calls, "
+            "%llu holds, %llu bad words\n",
+            name, got, mismatches,
+            (unsigned long long)(st.isr_calls - before->isr_calls),
+            (unsigned long long)(st.holds - before->holds),
+            (unsigned long long)(st.bad_words - before->bad_words));
+
+    return mismatches;
+}
+
+/* What the DAC should see for frames of table, one per compare match */
+static uint32_t
+emu_table_expect (const SinusTable *table, uint16_t *expect, uint32_t max)
+{
+    uint32_t pos = 0; // 24.8 fixed point
+    uint32_t end = table->loop_end ? table->loop_end : table->nsamples;
+    uint32_t n = 0;
+
+    for (; n < max && pos >> 8 < end; ++n)
+    {
+        expect[n] = (uint16_t)(table->samples[pos >> 8] << 2);
+        pos += table->increment;
+        if (table->loop_end && pos >> 8 >= end)
+            pos -= (uint32_t)(table->loop_end - table->loop_start) << 8;
+    }
+
+    return n;
+}
+
+/* Frames of table, then ring_frames of the queued ramp from ring_first */
+static uint32_t
+emu_table (SinusContext *sc, const char *name, const SinusTable *table,
+           uint32_t frames, uint32_t ring_first, uint32_t ring_frames)
+{
+    static uint16_t expect[SINUS_HOST_DAC_LOG];
+    uint32_t n = emu_table_expect (table, expect, frames);
+    uint32_t got;
+    uint32_t mismatches = n == frames ? 0 : 1;
+
+    sinus_table_play (sc, table);
+    sinus_host_tick (frames);
+    if (table->loop_end)
+        sinus_table_stop (sc);
+    mismatches += (uint32_t)sinus_table_is_playing (sc);
+
+    sinus_host_tick (ring_frames);
+    got = sinus_host_dac_read (emu_out, frames + ring_frames);
+    mismatches += got == frames + ring_frames ? 0 : 1;
+    for (uint32_t i = 0; i < got; ++i)
+        mismatches += emu_out[i] != (i < n ? expect[i] : ring_first + i - n);
+
+    printf ("%-9s %4u frames out, %u mismatches\n", name, got, mismatches);
+    return mismatches;
+}
+
+/* Blocking writes against the clock thread, then a drain */
+static uint32_t
+emu_realtime (SinusContext *sc, const char *name)
+{
+    SinusHostStats before;
+    uint32_t out;
+
+    sinus_host_stats (&before);
+    sinus_control_start (sc);
+    sinus_host_clock_start ();
+
+    for (uint32_t in = 0; in < EMU_FRAMES;)
+        in += sinus_frames_write_timed (sc, emu_packed + in / 4 * 5,
+                                        EMU_FRAMES - in, 0);
+    sinus_control_drain (sc);
+    sinus_host_clock_stop ();
+
+    out = sinus_host_dac_read (emu_out, EMU_FRAMES);
+    return emu_check (name, out, &before);
+}
+
+int
+main (void)
+{
+    static const uint8_t ramp[100] PROGMEM = {
+#define R(i) (i) * 2, (i) * 2 + 1
+#define R10(i) R (i), R (i + 1), R (i + 2), R (i + 3), R (i + 4)
+        R10 (0), R10 (5), R10 (10), R10 (15), R10 (20),
+        R10 (25), R10 (30), R10 (35), R10 (40), R10 (45),
+#undef R10
+#undef R
+    };
+    const SinusTable looped = {
+        .samples = ramp,
+        .nsamples = 100,
+        .loop_start = 20,
+        .loop_end = 100,
+        .increment = 0x180,
+    };
+    const SinusTable square = {
+        .samples = square_sample_table,
+        .nsamples = SQUARE_SAMPLE_COUNT,
+        .increment = 0x400,
+    };
+
+    SinusContext *sc;
+    SinusHostStats before;
+    uint32_t failed = 0;
+
+    emu_pack ();
+    sinus_host_reset ();
+    sei ();
+
+    sinus_context_init (&sc, NULL, NULL);
+    printf ("sample rate %u Hz (modelled %u Hz), %u frame buffer\n",
+            sinus_info_get_sample_rate (sc), sinus_host_rate (),
+            (unsigned)FRAME_BUFFER_SIZE_FRAMES);
+
+    /* Stepped: write what fits, then 1 - 7 compare matches */
+    sinus_host_stats (&before);
+    sinus_control_start (sc);
+
+    uint32_t in = 0;
+    uint32_t out = 0;
+    for (uint32_t step = 0; out < EMU_FRAMES && step < 100000; ++step)
+    {
+        if (in < EMU_FRAMES)
+            in += sinus_frames_write (sc, emu_packed + in / 4 * 5,
+                                      EMU_FRAMES - in);
+
+        sinus_host_tick (1 + step * 5 % 7);
+        out += sinus_host_dac_read (emu_out + out, EMU_FRAMES - out);
+    }
+    failed += emu_check ("stepped", out, &before);
+
+    sinus_control_stop (sc);
+    failed += emu_realtime (sc, "realtime");
+
+    /* Tables in front of a full ring, which has to come out untouched */
+    sinus_control_stop (sc);
+    sinus_control_start (sc);
+    sinus_frames_write (sc, emu_packed, FRAME_BUFFER_SIZE_FRAMES);
+    failed += emu_table (sc, "looped", &looped, 300, 0, 8);
+    failed += emu_table (sc, "one-shot", &square, 256, 8, 8);
+    sinus_context_deinit (sc);
+
+    /* A faster mode, asked for the way an application would */
+    SinusSettings ss;
+    sinus_settings_default (&ss);
+    ss.sample_rate = 44100;
+    sinus_context_init (&sc, &ss, NULL);
+    printf ("asked for 44100 Hz, got %u Hz (modelled %u Hz)\n",
+            sinus_info_get_sample_rate (sc), sinus_host_rate ());
+    failed += sinus_info_get_sample_rate (sc) != TIMER0_RATE (MODE_22K);
+    failed += sinus_host_rate () != TIMER0_RATE (MODE_22K);
+    sinus_context_deinit (sc);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,312 @@
+/*
+ * attiny85 peripheral model for the host build, see sinus_host.h.
+ *
+ * Registers are plain bytes. Writes with side effects can't be trapped in
+ * C, so they are played out lazily: every register access first looks at
+ * what changed since the last one. A pending USITC strobe toggles USCK and
+ * clocks the USI, a PORTB change may be the DAC's chip select edge. Reads of
+ * USITC give 0 like on the chip, so back to back strobes are never lost;
+ * the harness syncs once more after every ISR for the last write.
+ */
+
+#define _GNU_SOURCE
+
+#include "sinus_host.h"
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define HOST_DAC_CS PB3
+
+/* I/O addresses, as in avr/io.h */
+#define IO_USICR 0x0D
+#define IO_USISR 0x0E
+#define IO_USIDR 0x0F
+#define IO_DDRB 0x17
+#define IO_PORTB 0x18
+#define IO_OCR0A 0x29
+#define IO_TCCR0B 0x33
+#define IO_TIMSK 0x39
+#define IO_SREG 0x3F
+
+/* Defined by the backend, ISR (TIMER0_COMPA_vect) */
+void TIMER0_COMPA_vect (void);
+
+static volatile uint8_t host_regs[64];
+
+static pthread_mutex_t host_lock = PTHREAD_MUTEX_INITIALIZER; // the model
+static pthread_mutex_t host_irq = PTHREAD_MUTEX_INITIALIZER;  // one ISR a time
+
+static uint8_t host_portb_seen;
+static uint8_t host_usi_counter;
+
+/* MCP4911 */
+static uint16_t host_dac_shift;
+static uint8_t host_dac_bits;
+static uint16_t host_dac_log[SINUS_HOST_DAC_LOG];
+static uint32_t host_dac_head;
+static uint32_t host_dac_tail;
+
+static SinusHostStats host_stats;
+
+static pthread_t host_clock_thread;
+static bool host_clock_running; // accessed atomically
+
+static void
+host_dac_latch (void)
+{
+    /* Write command: bit 15 clear (DAC A), SHDN (bit 12) set */
+    if (host_dac_bits != 16 || (host_dac_shift & 0x9000U) != 0x1000U)
+    {
+        host_stats.bad_words += 1;
+        return;
+    }
+
+    host_dac_log[host_dac_head % SINUS_HOST_DAC_LOG]
+        = (uint16_t)((host_dac_shift >> 2) & 0x3FFU);
+    host_dac_head += 1;
+    if (host_dac_head - host_dac_tail > SINUS_HOST_DAC_LOG)
+        host_dac_tail = host_dac_head - SINUS_HOST_DAC_LOG;
+
+    host_stats.dac_updates += 1;
+}
+
+/* One USITC strobe in three-wire mode: USCK toggles, the 4 bit counter
+ * counts the edge. The DAC samples DO on the rising edge, the data register
+ * shifts on the falling one. */
+static void
+host_usi_strobe (uint8_t cr)
+{
+    if (!(cr & (1 << USIWM0)) || (cr & (1 << USIWM1)))
+        return;
+
+    host_regs[IO_PORTB] ^= 1 << PB2;
+    host_portb_seen ^= 1 << PB2;
+    bool rising = host_regs[IO_PORTB] & (1 << PB2);
+
+    host_usi_counter = (host_usi_counter + 1) & 0x0F;
+    host_regs[IO_USISR]
+        = (uint8_t)((host_regs[IO_USISR] & 0xF0) | host_usi_counter);
+    if (host_usi_counter == 0)
+        host_regs[IO_USISR] |= 1 << USIOIF;
+
+    /* The pins only reach the DAC when they are outputs */
+    uint8_t outputs = (1 << PB1) | (1 << PB2);
+    bool wired = (host_regs[IO_DDRB] & outputs) == outputs;
+    bool selected = !(host_regs[IO_PORTB] & (1 << HOST_DAC_CS));
+
+    if (rising)
+    {
+        if (wired && selected)
+        {
+            host_dac_shift = (uint16_t)((host_dac_shift << 1)
+                                        | (host_regs[IO_USIDR] >> 7));
+            host_dac_bits += 1;
+        }
+    }
+    else
+    {
+        host_regs[IO_USIDR] = (uint8_t)(host_regs[IO_USIDR] << 1);
+    }
+}
+
+/* Called with host_lock held */
+static void
+host_sync (void)
+{
+    uint8_t cr = host_regs[IO_USICR];
+    if (cr & (1 << USITC))
+    {
+        host_regs[IO_USICR] = cr & (uint8_t) ~(1 << USITC);
+        host_usi_strobe (cr);
+    }
+
+    uint8_t changed = host_regs[IO_PORTB] ^ host_portb_seen;
+    host_portb_seen = host_regs[IO_PORTB];
+
+    if (changed & (1 << HOST_DAC_CS))
+    {
+        if (host_portb_seen & (1 << HOST_DAC_CS))
+            host_dac_latch ();
+        host_dac_shift = 0;
+        host_dac_bits = 0;
+    }
+}
+
+volatile uint8_t *
+sinus_host_io (uint8_t addr)
+{
+    pthread_mutex_lock (&host_lock);
+    host_sync ();
+    pthread_mutex_unlock (&host_lock);
+
+    return &host_regs[addr & 0x3F];
+}
+
+void
+sinus_host_sleep (void)
+{
+    if (__atomic_load_n (&host_clock_running, __ATOMIC_ACQUIRE))
+        sched_yield ();
+}
+
+void
+sinus_host_reset (void)
+{
+    pthread_mutex_lock (&host_lock);
+    memset ((void *)host_regs, 0, sizeof (host_regs));
+    host_portb_seen = 0;
+    host_usi_counter = 0;
+    host_dac_shift = 0;
+    host_dac_bits = 0;
+    host_dac_head = 0;
+    host_dac_tail = 0;
+    memset (&host_stats, 0, sizeof (host_stats));
+    pthread_mutex_unlock (&host_lock);
+}
+
+/* Called with host_lock held */
+static uint32_t
+host_rate (void)
+{
+    static const uint16_t prescalers[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+    uint16_t prescaler = prescalers[host_regs[IO_TCCR0B] & 0x07];
+
+    if (prescaler == 0)
+        return 0;
+
+    return (uint32_t)((F_CPU)
+                      / ((uint32_t)prescaler * (host_regs[IO_OCR0A] + 1U)));
+}
+
+uint32_t
+sinus_host_rate (void)
+{
+    pthread_mutex_lock (&host_lock);
+    uint32_t rate = host_rate ();
+    pthread_mutex_unlock (&host_lock);
+
+    return rate;
+}
+
+void
+sinus_host_tick (uint32_t n)
+{
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        pthread_mutex_lock (&host_irq);
+        pthread_mutex_lock (&host_lock);
+
+        bool running = host_rate () > 0;
+        bool enabled = (host_regs[IO_TIMSK] & (1 << OCIE0A))
+                       && (host_regs[IO_SREG] & (1 << SREG_I));
+        uint64_t updates = host_stats.dac_updates;
+
+        host_stats.matches += running;
+        host_stats.isr_calls += running && enabled;
+        pthread_mutex_unlock (&host_lock);
+
+        if (running && enabled)
+        {
+            TIMER0_COMPA_vect ();
+
+            pthread_mutex_lock (&host_lock);
+            host_sync ();
+            if (host_stats.dac_updates == updates)
+                host_stats.holds += 1;
+            pthread_mutex_unlock (&host_lock);
+        }
+
+        pthread_mutex_unlock (&host_irq);
+    }
+}
+
+static uint64_t
+host_now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Yields rather than sleeps: a compare match every few tens of
+ * microseconds is below what nanosleep keeps to */
+static void *
+host_clock (void *arg)
+{
+    (void)arg;
+    uint64_t next = host_now_ns ();
+
+    while (__atomic_load_n (&host_clock_running, __ATOMIC_ACQUIRE))
+    {
+        uint32_t rate = sinus_host_rate ();
+        uint64_t now = host_now_ns ();
+
+        if (rate == 0)
+        {
+            next = now;
+            continue;
+        }
+        if (now < next)
+        {
+            sched_yield ();
+            continue;
+        }
+
+        sinus_host_tick (1);
+        next += 1000000000ULL / rate;
+    }
+
+    return NULL;
+}
+
+int
+sinus_host_clock_start (void)
+{
+    __atomic_store_n (&host_clock_running, true, __ATOMIC_RELEASE);
+    if (pthread_create (&host_clock_thread, NULL, host_clock, NULL) != 0)
+    {
+        host_clock_running = false;
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+sinus_host_clock_stop (void)
+{
+    if (!__atomic_load_n (&host_clock_running, __ATOMIC_ACQUIRE))
+        return;
+
+    __atomic_store_n (&host_clock_running, false, __ATOMIC_RELEASE);
+    pthread_join (host_clock_thread, NULL);
+}
+
+uint32_t
+sinus_host_dac_read (uint16_t *values, uint32_t max)
+{
+    uint32_t n = 0;
+
+    pthread_mutex_lock (&host_lock);
+    for (; n < max && host_dac_tail != host_dac_head; ++n, ++host_dac_tail)
+        values[n] = host_dac_log[host_dac_tail % SINUS_HOST_DAC_LOG];
+    pthread_mutex_unlock (&host_lock);
+
+    return n;
+}
+
+void
+sinus_host_stats (SinusHostStats *stats)
+{
+    pthread_mutex_lock (&host_lock);
+    *stats = host_stats;
+    pthread_mutex_unlock (&host_lock);
+}
@@ -0,0 +1,49 @@
+#ifndef _SINUS_HOST_H
+#define _SINUS_HOST_H
+
+/*
+ * Host build of the MCP4911 backend: the backend compiled with
+ * SINUS_AVR_HOST against the register mocks in this directory, an attiny85
+ * peripheral model behind them (Timer0 compare matches, the USI in
+ * three-wire mode, PORTB/DDRB) and an MCP4911 listening on PB3.
+ *
+ * Time only passes when the harness says so: either sinus_host_tick for a
+ * given number of compare matches on the calling thread, or the clock
+ * thread, which keeps to the configured rate in real time so blocking calls
+ * like sinus_control_drain can return.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef struct sinus_host_stats_s
+{
+    uint64_t matches;     // Timer0 compare matches while it was running
+    uint64_t isr_calls;   // of those, with OCIE0A and the I flag set
+    uint64_t dac_updates; // 16 bit writes the DAC latched
+    uint64_t holds;       // ISR calls that left the DAC alone: underruns
+    uint64_t bad_words;   // transfers that weren't one clean write command
+} SinusHostStats;
+
+/* All registers to their reset values, DAC and statistics cleared */
+void sinus_host_reset (void);
+
+/* Compare matches per second for the current TCCR0B and OCR0A, 0 while the
+ * timer is stopped */
+uint32_t sinus_host_rate (void);
+
+/* Runs n compare matches now */
+void sinus_host_tick (uint32_t n);
+
+/* The same from a thread, at sinus_host_rate in real time */
+int sinus_host_clock_start (void);
+void sinus_host_clock_stop (void);
+
+/* DAC outputs since the last call, oldest first, at most max. The DAC keeps
+ * the last SINUS_HOST_DAC_LOG of them. */
+#define SINUS_HOST_DAC_LOG 4096U
+uint32_t sinus_host_dac_read (uint16_t *values, uint32_t max);
+
+void sinus_host_stats (SinusHostStats *stats);
+
+#endif
@@ -1,9 +1,13 @@
-#ifndef __AVR__
+/* SINUS_AVR_HOST builds against the register mocks in host/, see
+ * host/sinus_host.h */
+#if !defined(__AVR__) && !defined(SINUS_AVR_HOST)
 #error "This file has to be compiled with AVR C compiler"
 #endif
 
 #include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <string.h>
 
 #define SINUSDEF static inline
@@ -11,24 +15,65 @@ typedef uint8_t sinus_ssize_t;
 #define SINUS_SSIZE_T_DEFINED
 #include <sinus.h>
 
-#define PRESCALER 8U
-#define TIMER_COUNTER_TOP 44U
+// Timer0 in CTC mode matches at F_CPU / (prescaler * (top + 1)), prescaler
+// 1 where top fits 8 bits, else 8
+#define TIMER0_PRESCALER(hz) ((uint32_t)(F_CPU) / (hz) <= 256U ? 1U : 8U)
+#define TIMER0_TOP(hz)                                                         \
+    (((uint32_t)(F_CPU) / TIMER0_PRESCALER (hz) + (hz) / 2U) / (hz) - 1U)
+#define TIMER0_RATE(hz)                                                        \
+    ((uint32_t)(F_CPU) / (TIMER0_PRESCALER (hz) * (TIMER0_TOP (hz) + 1U)))
+#define TIMER0_CLOCK(hz)                                                       \
+    (TIMER0_PRESCALER (hz) == 1U ? (1 << CS00) : (1 << CS01))
+
+// Sample rate modes. The ISR has to fit a frame with room left for the main
+// loop, see cycles.c. Only MODE_22K is offered: MODE_32K and MODE_44K are
+// budgets for cycles.c to measure against until it shows they fit.
+#define MODE_22K 22050U
+#define MODE_32K 32000U
+#define MODE_44K 44100U
+
+// What sinus_settings_default offers, one of the modes on offer
+#ifndef SINUS_MCP4911_SAMPLE_RATE
+#define SINUS_MCP4911_SAMPLE_RATE MODE_22K
+#endif
+
+#if SINUS_MCP4911_SAMPLE_RATE != MODE_22K
+#error "SINUS_MCP4911_SAMPLE_RATE: only MODE_22K is on offer"
+#endif
 
-#define SAMPLE_RATE_HZ                                                         \
-    ((uint32_t)(F_CPU)                                                         \
-     / ((uint32_t)(PRESCALER) * ((uint32_t)(TIMER_COUNTER_TOP) + 1U)))
+#define SAMPLE_RATE_HZ TIMER0_RATE (SINUS_MCP4911_SAMPLE_RATE)
 
-#define FRAME_BUFFER_SIZE_FRAMES 8U
-#define FRAME_BUFFER_SIZE_BYTES (FRAME_BUFFER_SIZE_FRAMES * 10U / 8U)
+// U10_P5 frames, split the way the ISR reads them. A power of two up to 128,
+// so the free running 8 bit frame indices wrap on the ring and what's queued
+// fits in sinus_ssize_t.
+#define FRAME_BUFFER_SIZE_FRAMES 64U
+#define FRAME_BUFFER_MASK (FRAME_BUFFER_SIZE_FRAMES - 1U)
+
+#if (FRAME_BUFFER_SIZE_FRAMES & FRAME_BUFFER_MASK) != 0                       \
+    || FRAME_BUFFER_SIZE_FRAMES < 4U || FRAME_BUFFER_SIZE_FRAMES > 128U
+#error "FRAME_BUFFER_SIZE_FRAMES has to be a power of two from 4 to 128"
+#endif
 
-#define PIN_MOSI PB0
-#define PIN_MISO PB1
-#define PIN_SCK PB2
+// USI pins, the attiny85 is the SPI master: DO drives the MCP4911's SDI
+#define PIN_DI PB0
+#define PIN_DO PB1
+#define PIN_USCK PB2
 #define PIN_SLAVE_SELECT_DEFAULT PB3
 
+// a quarter of the buffer
+#define HINT_UPDATE_US(hz)                                                     \
+    ((uint32_t)(FRAME_BUFFER_SIZE_FRAMES / 4U * 1000000UL / (hz)))
+
 #define TIMER_START TIMSK |= (1 << OCIE0A)
 #define TIMER_STOP TIMSK &= ~(1 << OCIE0A)
 
+// three-wire mode, one USCK edge (and half a bit) per write
+#define USI_STROBE                                                             \
+    ((1 << USIWM0) | (1 << USICS1) | (1 << USICLK) | (1 << USITC))
+
+// MCP4911 write command: unbuffered VREF, 1x gain, output on
+#define MCP4911_CONFIG 0x3000U
+
 #define USI_MODE_SPI                                                           \
     do                                                                         \
     {                                                                          \
@@ -42,21 +87,47 @@ typedef uint8_t sinus_ssize_t;
         USICR &= ~(1 << USIWM1);                                               \
     } while (0)
 
+/* A table of U8 samples in flash (PROGMEM, e.g. tablegen --progmem) that the
+ * ISR plays instead of the ring. Samples go to the DAC as the upper 8 of
+ * its 10 bits. */
+typedef struct sinus_table_s
+{
+    const uint8_t *samples; // in flash
+    uint16_t nsamples;      // at most 0x7FFF
+    uint16_t loop_start;    // where playback goes on after loop_end
+    uint16_t loop_end;      // one past the loop, 0 plays once to nsamples
+    uint16_t increment;     // samples per frame, 8.8 fixed point: 0x100 is 1
+} SinusTable;
+
 struct SinusContext
 {
     SinusSettings ss;
     uint8_t slave_select_pin;
-
-    // frame ring buffer
-    uint8_t frame_buffer[FRAME_BUFFER_SIZE_BYTES];
-    uint8_t *buffer_head;
-    uint8_t buffer_len;
-    uint8_t *buffer_end;
+    uint8_t slave_select_mask; // 1 << slave_select_pin, for the ISR
+
+    // ring of U10_P5 frames (see sinus.h): ring_high has the upper 8 bits of
+    // every frame, ring_low byte 4 of every group. head and tail count frames
+    // and wrap at 256, head - tail is what's queued and tail & 3 the frame of
+    // its group. Each side only moves its own index, a single byte store, so
+    // neither needs an atomic block.
+    uint8_t ring_high[FRAME_BUFFER_SIZE_FRAMES];
+    uint8_t ring_low[FRAME_BUFFER_SIZE_FRAMES / 4U];
+    volatile uint8_t buffer_head; // frames written, whole groups
+    volatile uint8_t buffer_tail; // frames played
+    uint8_t low_bits; // ring_low of the tail's group, shifted down as it plays
+
+    // the table being played, see sinus_table_play. The ISR only reads the
+    // rest once table_active is set and only this side sets it.
+    volatile uint8_t table_active;
+    const uint8_t *table;
+    uint16_t table_index;
+    uint8_t table_frac;
+    uint16_t table_increment;
+    uint16_t table_end;      // loop_end, or nsamples for a one-shot
+    uint16_t table_loop_len; // 0 for a one-shot
 };
 
 static SinusContext _sc = { 0 };
-// table for multiplying numbers by 0.8, floored
-static const uint8_t mul08_table[11] = { 0, 0, 1, 2, 3, 4, 4, 5, 6, 7, 8 };
 
 SINUSDEF void
 sinus_settings_default (SinusSettings *ss)
@@ -64,44 +135,73 @@ sinus_settings_default (SinusSettings *ss)
     ss->buffer_frames = FRAME_BUFFER_SIZE_FRAMES;
     ss->channels = 1;
     ss->hint_min_write_frames = 4;
-    ss->fmt = SINUS_FORMAT_UNKNOWN; // 4U10_P5
+    ss->fmt = SINUS_FORMAT_U10_P5;
     ss->interleaved = 0;
     ss->sample_rate = SAMPLE_RATE_HZ;
-    ss->hint_update_us = 181;
+    ss->hint_update_us = HINT_UPDATE_US (SAMPLE_RATE_HZ);
+    ss->flags = 0;
+    ss->resample_quality = SINUS_RESAMPLE_FAST;
+    ss->min_buffer_frames = 0;
 }
 
+/* Runs the timer in the mode nearest to ss->sample_rate and puts the real
+ * rate there; for now that is always MODE_22K. Constants per mode, no 32 bit
+ * division at run time. */
 static inline void
-timer0_setup (void)
+timer0_setup (SinusSettings *ss)
 {
-    TCCR0B = 0;                          // stop the timer
-    TCNT0 = 0;                           // clear timer counter
-    TCCR0A = (1 << WGM01);               // CTC mode
-    TCCR0B = (1 << WGM01) | (1 << CS01); // prescaler = 8
-    OCR0A = TIMER_COUNTER_TOP;           // 22.2 kHz
+    uint8_t clock;
+    uint8_t top;
+
+#define TIMER0_MODE(hz)                                                        \
+    do                                                                         \
+    {                                                                          \
+        clock = TIMER0_CLOCK (hz);                                             \
+        top = (uint8_t)TIMER0_TOP (hz);                                        \
+        ss->sample_rate = TIMER0_RATE (hz);                                    \
+        ss->hint_update_us = HINT_UPDATE_US (TIMER0_RATE (hz));                \
+    } while (0)
+
+    // The one mode on offer, see MODE_22K
+    TIMER0_MODE (MODE_22K);
+
+#undef TIMER0_MODE
+
+    TCCR0B = 0;            // stop the timer
+    TCNT0 = 0;             // clear timer counter
+    TCCR0A = (1 << WGM01); // CTC mode
+    OCR0A = top;
+    TCCR0B = clock;
 }
 
+/* Only ss->sample_rate is taken, see timer0_setup; format, channels and
+ * buffer are fixed */
 SINUSDEF int
 sinus_context_init (SinusContext **sc, const SinusSettings *ss, void *user_data)
 {
-    (void)ss; // we don't accept config
-
     *sc = &_sc;
 
     sinus_settings_default (&_sc.ss);
+    if (ss)
+        _sc.ss.sample_rate = ss->sample_rate;
     if (user_data)
         _sc.slave_select_pin = *(uint8_t *)user_data;
     else
         _sc.slave_select_pin = PIN_SLAVE_SELECT_DEFAULT;
-    memset (_sc.frame_buffer, 0, FRAME_BUFFER_SIZE_BYTES);
-    _sc.buffer_head = _sc.frame_buffer;
-    _sc.buffer_len = 0;
-    _sc.buffer_end = _sc.buffer_head + FRAME_BUFFER_SIZE_BYTES;
-
-    DDRB |= (1 << PIN_MOSI) | (1 << _sc.slave_select_pin); // outputs
-    PORTB |= (1 << _sc.slave_select_pin);                  // active-low
+    _sc.slave_select_mask = (uint8_t)(1 << _sc.slave_select_pin);
+    memset (_sc.ring_high, 0, sizeof (_sc.ring_high));
+    memset (_sc.ring_low, 0, sizeof (_sc.ring_low));
+    _sc.buffer_head = 0;
+    _sc.buffer_tail = 0;
+    _sc.low_bits = 0;
+    _sc.table_active = 0;
+
+    DDRB |= (1 << PIN_DO) | (1 << PIN_USCK)
+            | (1 << _sc.slave_select_pin); // outputs
+    PORTB |= (1 << _sc.slave_select_pin);  // active-low
 
     USI_MODE_OFF;
-    timer0_setup ();
+    timer0_setup (&_sc.ss);
 
     return 0;
 }
@@ -114,11 +214,148 @@ sinus_context_deinit (SinusContext *sc)
     return;
 }
 
+/* A byte out at half the CPU clock: 16 strobes, unrolled so each is a
+ * single out from a register */
+static inline void
+usi_transfer (uint8_t byte)
+{
+    const uint8_t strobe = USI_STROBE;
+
+    USIDR = byte;
+    USICR = strobe; // bit 7
+    USICR = strobe;
+    USICR = strobe; // bit 6
+    USICR = strobe;
+    USICR = strobe; // bit 5
+    USICR = strobe;
+    USICR = strobe; // bit 4
+    USICR = strobe;
+    USICR = strobe; // bit 3
+    USICR = strobe;
+    USICR = strobe; // bit 2
+    USICR = strobe;
+    USICR = strobe; // bit 1
+    USICR = strobe;
+    USICR = strobe; // bit 0
+    USICR = strobe;
+}
+
+/* Next table sample, straight from flash. The phase wraps back by the loop
+ * length at most once, sinus_table_play keeps the increment below it. */
+static inline uint8_t
+isr_table_sample (SinusContext *sc)
+{
+    uint8_t sample = pgm_read_byte (sc->table + sc->table_index);
+    uint16_t frac = (uint16_t)(sc->table_frac + (uint8_t)sc->table_increment);
+    uint16_t index = (uint16_t)(sc->table_index + (sc->table_increment >> 8)
+                                + (frac >> 8));
+
+    if (index >= sc->table_end)
+    {
+        if (sc->table_loop_len == 0)
+            sc->table_active = 0; // one-shot done, back to the ring
+        index = (uint16_t)(index - sc->table_loop_len);
+    }
+
+    sc->table_frac = (uint8_t)frac;
+    sc->table_index = index;
+    return sample;
+}
+
+/* One frame per compare match, from the table while one plays, else from
+ * the ring with the same work for each frame: the upper 8 bits from
+ * ring_high, the low 2 off low_bits. An empty ring leaves the DAC holding
+ * the last frame. Byte math on a few registers only, so the prologue
+ * avr-gcc emits (-mgas-isr-prologues, the default with optimization) saves
+ * little; cycles.c counts the whole thing. */
+ISR (TIMER0_COMPA_vect)
+{
+    SinusContext *sc = &_sc;
+    uint8_t high;
+    uint8_t low;
+
+    if (sc->table_active)
+    {
+        high = isr_table_sample (sc);
+        low = 0;
+    }
+    else
+    {
+        uint8_t tail = sc->buffer_tail;
+
+        if (tail == sc->buffer_head)
+            return;
+
+        high = sc->ring_high[tail & FRAME_BUFFER_MASK];
+        low = sc->low_bits;
+        if ((tail & 3) == 0)
+            low = sc->ring_low[(uint8_t)(tail >> 2) & (FRAME_BUFFER_MASK >> 2)];
+
+        sc->low_bits = (uint8_t)(low >> 2);
+        sc->buffer_tail = (uint8_t)(tail + 1);
+    }
+
+    // 0011 hhhh hhhh ll00, see MCP4911_CONFIG
+    PORTB &= (uint8_t)~sc->slave_select_mask;
+    usi_transfer ((uint8_t)((MCP4911_CONFIG >> 8) | (high >> 4)));
+    usi_transfer ((uint8_t)((uint8_t)(high << 4) | (uint8_t)((low & 3) << 2)));
+    PORTB |= sc->slave_select_mask;
+}
+
+/* Plays table from its first sample on the next compare match, replacing
+ * whatever table played before. The ring keeps what's queued and resumes
+ * when a one-shot ends or sinus_table_stop is called. Start the timer with
+ * sinus_control_start as usual. */
+SINUSDEF int
+sinus_table_play (SinusContext *sc, const SinusTable *table)
+{
+    uint16_t end = table->loop_end ? table->loop_end : table->nsamples;
+    uint16_t loop_len
+        = table->loop_end ? (uint16_t)(table->loop_end - table->loop_start)
+                          : 0;
+
+    if (!table->samples || table->nsamples == 0 || table->nsamples > 0x7FFF
+        || end > table->nsamples || table->loop_start >= end
+        || table->increment == 0)
+        return -1;
+    if (loop_len && (table->increment >> 8) >= loop_len)
+        return -1; // would wrap more than once per frame
+
+    sc->table_active = 0;
+    __asm__ __volatile__ ("" ::: "memory");
+
+    sc->table = table->samples;
+    sc->table_index = 0;
+    sc->table_frac = 0;
+    sc->table_increment = table->increment;
+    sc->table_end = end;
+    sc->table_loop_len = loop_len;
+
+    __asm__ __volatile__ ("" ::: "memory");
+    sc->table_active = 1;
+    return 0;
+}
+
+SINUSDEF int
+sinus_table_stop (SinusContext *sc)
+{
+    sc->table_active = 0;
+    return 0;
+}
+
+/* 0 once a one-shot has played out */
+SINUSDEF int
+sinus_table_is_playing (SinusContext *sc)
+{
+    return sc->table_active;
+}
+
 /* Start processing frames */
 SINUSDEF int
 sinus_control_start (SinusContext *sc)
 {
     (void)sc;
+    USI_MODE_SPI;
     TIMER_START;
     return 0;
 }
@@ -136,100 +373,108 @@ SINUSDEF int
 sinus_control_stop (SinusContext *sc)
 {
     TIMER_STOP;
-    sc->buffer_head = sc->frame_buffer;
-    sc->buffer_len = 0;
+    sc->table_active = 0;
+    sc->buffer_head = 0;
+    sc->buffer_tail = 0;
     return 0;
 }
-/* Process all queued frames and pause */
+/* Process all queued frames and pause. A one-shot table plays out first, a
+ * looping one would never end and is stopped. */
 SINUSDEF int
 sinus_control_drain (SinusContext *sc)
 {
+    if (sc->table_loop_len)
+        sc->table_active = 0;
     TIMER_START;
-    while (sc->buffer_len > 0)
-        ;
+    while (sc->table_active)
+        sleep_mode ();
+    while (sc->buffer_tail != sc->buffer_head) // volatile, the ISR moves it
+        sleep_mode ();
     TIMER_STOP;
     return 0;
 }
 
-SINUSDEF sinus_ssize_t
-sinus_frames_write (SinusContext *sc, const void *frames, uint32_t nframes)
+/* Copies whole groups while they fit and returns frames taken. A group is
+ * free once its last frame is out, the ISR reads byte 4 on the first. */
+static inline uint8_t
+frames_write_groups (SinusContext *sc, const uint8_t *ptr, uint32_t nframes)
 {
-    if (sc->buffer_len == FRAME_BUFFER_SIZE_BYTES)
-        return 0;
-
-    uint8_t to_write = (nframes > sc->buffer_len) ? sc->buffer_len : nframes;
-    uint8_t retval = to_write;
-    const uint8_t *ptr = frames;
+    uint8_t head = sc->buffer_head;
+    uint8_t queued = (uint8_t)(head - sc->buffer_tail);
+    uint8_t free_groups = (uint8_t)((FRAME_BUFFER_SIZE_FRAMES - queued) / 4U);
+    uint8_t groups = nframes / 4 < free_groups ? (uint8_t)(nframes / 4)
+                                                : free_groups;
 
-    sc->buffer_len += to_write;
-
-    while (to_write > 0)
+    for (uint8_t g = 0; g < groups; ++g, ptr += 5)
     {
-        *sc->buffer_head = *ptr;
-        if (sc->buffer_head == sc->buffer_end)
-            sc->buffer_head = sc->frame_buffer;
-        else
-            sc->buffer_head += 1;
-        ptr += 1;
-        to_write -= 1;
+        uint8_t at = (uint8_t)(head + g * 4U) & FRAME_BUFFER_MASK;
+
+        memcpy (&sc->ring_high[at], ptr, 4);
+        sc->ring_low[at / 4U] = ptr[4];
     }
 
-    return retval;
+    // the frames have to be in place before the ISR sees the new head
+    __asm__ __volatile__ ("" ::: "memory");
+    sc->buffer_head = (uint8_t)(head + groups * 4U);
+
+    return (uint8_t)(groups * 4U);
+}
+
+/* frames are U10_P5. nframes is rounded down to whole groups of 4. */
+SINUSDEF sinus_ssize_t
+sinus_frames_write (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    return frames_write_groups (sc, frames, nframes);
 }
 
 SINUSDEF sinus_ssize_t
 sinus_frames_write_timed (SinusContext *sc, const void *frames,
                           uint32_t nframes, uint32_t timeout_us)
 {
+    (void)timeout_us;
     // get start time in us
 
-    if (sc->buffer_len == FRAME_BUFFER_SIZE_BYTES)
-        return 0;
-
-    uint8_t to_write = nframes;
     const uint8_t *ptr = frames;
+    uint8_t written = 0;
 
-    while (to_write > 0)
+    if (nframes > 252)
+        nframes = 252; // what sinus_ssize_t can count, in whole groups
+
+    while (nframes - written >= 4)
     {
-        while (sc->buffer_len == 0)
-        {
-            // wait
-
-            // if now - start > timeout_us then return nframes - to_write
-
-            // TODO: use timer1 for this somehow???
-        }
-
-        *sc->buffer_head = *ptr;
-        if (sc->buffer_head == sc->buffer_end)
-            sc->buffer_head = sc->frame_buffer;
-        else
-            sc->buffer_head += 1;
-        ptr += 1;
-        to_write -= 1;
-        sc->buffer_len += 1;
+        // if now - start > timeout_us then return written
+
+        // TODO: use timer1 for this somehow???
+        uint8_t n = frames_write_groups (sc, ptr, nframes - written);
+
+        if (n == 0)
+            sleep_mode (); // idle until the ISR frees a group
+
+        ptr += n / 4 * 5;
+        written += n;
     }
 
-    return nframes;
+    return written;
 }
 
 SINUSDEF sinus_ssize_t
 sinus_frames_get_n_frames_buffered (SinusContext *sc)
 {
-    return mul08_table[sc->buffer_len];
+    return (uint8_t)(sc->buffer_head - sc->buffer_tail);
 }
 
+/* In whole groups, see frames_write_groups */
 SINUSDEF sinus_ssize_t
 sinus_frames_get_n_frames_free (SinusContext *sc)
 {
-    uint8_t avail = (uint8_t)(FRAME_BUFFER_SIZE_BYTES - sc->buffer_len);
-    return mul08_table[avail];
+    uint8_t queued = (uint8_t)(sc->buffer_head - sc->buffer_tail);
+    return (uint8_t)((FRAME_BUFFER_SIZE_FRAMES - queued) & ~3U);
 }
 
 SINUSDEF uint32_t
 sinus_info_get_sample_rate (SinusContext *sc)
 {
-    return SAMPLE_RATE_HZ;
+    return sc->ss.sample_rate;
 }
 SINUSDEF uint32_t
 sinus_info_get_channels (SinusContext *sc)
@@ -239,5 +484,5 @@ sinus_info_get_channels (SinusContext *sc)
 SINUSDEF SinusFormat
 sinus_info_get_format (SinusContext *sc)
 {
-    return SINUS_FORMAT_UNKNOWN;
+    return SINUS_FORMAT_U10_P5;
 }
@@ -0,0 +1,905 @@
+#include <sinus_convert.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERT_X86 1
+#include <immintrin.h>
+#endif
+
+#define arrlen(arr) (sizeof (arr) / sizeof (arr[0]))
+
+typedef void (*ToFloatFn) (float *dst, const void *src, size_t n);
+typedef void (*FromFloatFn) (void *dst, const float *src, size_t n);
+
+#define SCALE_8 128.0f
+#define SCALE_10 512.0f
+#define SCALE_16 32768.0f
+#define SCALE_24 8388608.0f
+#define SCALE_32 2147483648.0f
+
+/* Largest float below 2^31, (float)INT32_MAX rounds up and overflows */
+#define S32_MAX_F 2147483520.0f
+
+static inline int32_t
+clamp_round (float v, float scale, int32_t lo, int32_t hi)
+{
+    float x = v * scale;
+
+    /* NaN goes to hi as well, like the SIMD kernels' minps against hi */
+    if (!(x < (float)hi))
+        return hi;
+    if (x <= (float)lo)
+        return lo;
+
+    /* Round half to even like cvtps2dq, so every ISA gives the same bytes */
+    double r = ((double)x + 6755399441055744.0) - 6755399441055744.0;
+    return (int32_t)r;
+}
+
+/* --- scalar kernels, also used for the tails of the SIMD ones --- */
+
+static void
+s8_to_f32 (float *dst, const void *src, size_t n)
+{
+    const int8_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)s[i] * (1.0f / SCALE_8);
+}
+
+static void
+f32_to_s8 (void *dst, const float *src, size_t n)
+{
+    int8_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (int8_t)clamp_round (src[i], SCALE_8, INT8_MIN, INT8_MAX);
+}
+
+static void
+u8_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint8_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)((int32_t)s[i] - 0x80) * (1.0f / SCALE_8);
+}
+
+static void
+f32_to_u8 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (uint8_t)(clamp_round (src[i], SCALE_8, INT8_MIN, INT8_MAX)
+                         + 0x80);
+}
+
+static void
+s16_to_f32 (float *dst, const void *src, size_t n)
+{
+    const int16_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)s[i] * (1.0f / SCALE_16);
+}
+
+static void
+f32_to_s16 (void *dst, const float *src, size_t n)
+{
+    int16_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (int16_t)clamp_round (src[i], SCALE_16, INT16_MIN, INT16_MAX);
+}
+
+static void
+u16_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint16_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)((int32_t)s[i] - 0x8000) * (1.0f / SCALE_16);
+}
+
+static void
+f32_to_u16 (void *dst, const float *src, size_t n)
+{
+    uint16_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (uint16_t)(clamp_round (src[i], SCALE_16, INT16_MIN, INT16_MAX)
+                          + 0x8000);
+}
+
+static void
+s24_u4_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint32_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)((int32_t)(s[i] << 8) >> 8) * (1.0f / SCALE_24);
+}
+
+static void
+f32_to_s24_u4 (void *dst, const float *src, size_t n)
+{
+    int32_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = clamp_round (src[i], SCALE_24, -0x800000, 0x7FFFFF);
+}
+
+static void
+u24_u4_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint32_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)((int32_t)(s[i] & 0xFFFFFF) - 0x800000)
+                 * (1.0f / SCALE_24);
+}
+
+static void
+f32_to_u24_u4 (void *dst, const float *src, size_t n)
+{
+    uint32_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (uint32_t)(clamp_round (src[i], SCALE_24, -0x800000, 0x7FFFFF)
+                          + 0x800000);
+}
+
+static void
+s24_p3_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint8_t *s = src;
+    for (size_t i = 0; i < n; ++i, s += 3)
+    {
+        uint32_t v = (uint32_t)s[0] << 8 | (uint32_t)s[1] << 16
+                     | (uint32_t)s[2] << 24;
+        dst[i] = (float)((int32_t)v >> 8) * (1.0f / SCALE_24);
+    }
+}
+
+static void
+f32_to_s24_p3 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; ++i, d += 3)
+    {
+        uint32_t v = (uint32_t)clamp_round (src[i], SCALE_24, -0x800000,
+                                            0x7FFFFF);
+        d[0] = (uint8_t)v;
+        d[1] = (uint8_t)(v >> 8);
+        d[2] = (uint8_t)(v >> 16);
+    }
+}
+
+static void
+u24_p3_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint8_t *s = src;
+    for (size_t i = 0; i < n; ++i, s += 3)
+    {
+        int32_t v = (int32_t)((uint32_t)s[0] | (uint32_t)s[1] << 8
+                              | (uint32_t)s[2] << 16);
+        dst[i] = (float)(v - 0x800000) * (1.0f / SCALE_24);
+    }
+}
+
+static void
+f32_to_u24_p3 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; ++i, d += 3)
+    {
+        uint32_t v = (uint32_t)(clamp_round (src[i], SCALE_24, -0x800000,
+                                             0x7FFFFF)
+                                + 0x800000);
+        d[0] = (uint8_t)v;
+        d[1] = (uint8_t)(v >> 8);
+        d[2] = (uint8_t)(v >> 16);
+    }
+}
+
+static void
+f32_to_f32 (float *dst, const void *src, size_t n)
+{
+    memcpy (dst, src, n * sizeof (float));
+}
+
+static void
+f32_from_f32 (void *dst, const float *src, size_t n)
+{
+    memcpy (dst, src, n * sizeof (float));
+}
+
+static void
+f64_to_f32 (float *dst, const void *src, size_t n)
+{
+    const double *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)s[i];
+}
+
+static void
+f32_to_f64 (void *dst, const float *src, size_t n)
+{
+    double *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = (double)src[i];
+}
+
+static void
+s32_to_f32 (float *dst, const void *src, size_t n)
+{
+    const int32_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = (float)s[i] * (1.0f / SCALE_32);
+}
+
+static void
+f32_to_s32 (void *dst, const float *src, size_t n)
+{
+    int32_t *d = dst;
+    for (size_t i = 0; i < n; ++i)
+        d[i] = clamp_round (src[i], SCALE_32, INT32_MIN, (int32_t)S32_MAX_F);
+}
+
+/* U10_P5, see sinus.h. A partial last group is padded with midscale. */
+static inline void
+u10_p5_put (uint8_t *d, const int32_t *v)
+{
+    d[0] = (uint8_t)(v[0] >> 2);
+    d[1] = (uint8_t)(v[1] >> 2);
+    d[2] = (uint8_t)(v[2] >> 2);
+    d[3] = (uint8_t)(v[3] >> 2);
+    d[4] = (uint8_t)((v[0] & 3) | (v[1] & 3) << 2 | (v[2] & 3) << 4
+                     | (v[3] & 3) << 6);
+}
+
+static void
+u10_p5_to_f32 (float *dst, const void *src, size_t n)
+{
+    const uint8_t *s = src;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const uint8_t *g = s + i / 4 * 5;
+        int32_t v = (int32_t)g[i % 4] << 2 | (g[4] >> (i % 4 * 2) & 3);
+        dst[i] = (float)(v - 0x200) * (1.0f / SCALE_10);
+    }
+}
+
+static void
+f32_to_u10_p5 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; i += 4, d += 5)
+    {
+        int32_t v[4] = { 0x200, 0x200, 0x200, 0x200 };
+        for (size_t k = 0; k < 4 && i + k < n; ++k)
+            v[k] = clamp_round (src[i + k], SCALE_10, -0x200, 0x1FF) + 0x200;
+        u10_p5_put (d, v);
+    }
+}
+
+/* S16 straight to U10_P5, rounding like the trip through float would */
+static void
+s16_to_u10_p5 (void *dst, const int16_t *src, size_t n)
+{
+    uint8_t *d = dst;
+    for (size_t i = 0; i < n; i += 4, d += 5)
+    {
+        int32_t v[4] = { 0x200, 0x200, 0x200, 0x200 };
+        for (size_t k = 0; k < 4 && i + k < n; ++k)
+        {
+            int32_t x = src[i + k];
+            int32_t q = x >> 6; // floor
+            int32_t r = x & 0x3F;
+            q += r > 0x20 || (r == 0x20 && (q & 1));
+            v[k] = (q > 0x1FF ? 0x1FF : q) + 0x200;
+        }
+        u10_p5_put (d, v);
+    }
+}
+
+/* --- x86 kernels --- */
+
+#ifdef CONVERT_X86
+
+__attribute__ ((target ("sse2"))) static void
+s16_to_f32_sse2 (float *dst, const void *src, size_t n)
+{
+    const int16_t *s = src;
+    const __m128 scale = _mm_set1_ps (1.0f / SCALE_16);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i x = _mm_loadu_si128 ((const __m128i *)(s + i));
+        __m128i lo = _mm_srai_epi32 (_mm_unpacklo_epi16 (x, x), 16);
+        __m128i hi = _mm_srai_epi32 (_mm_unpackhi_epi16 (x, x), 16);
+        _mm_storeu_ps (dst + i, _mm_mul_ps (_mm_cvtepi32_ps (lo), scale));
+        _mm_storeu_ps (dst + i + 4, _mm_mul_ps (_mm_cvtepi32_ps (hi), scale));
+    }
+
+    s16_to_f32 (dst + i, s + i, n - i);
+}
+
+__attribute__ ((target ("sse2"))) static void
+f32_to_s16_sse2 (void *dst, const float *src, size_t n)
+{
+    int16_t *d = dst;
+    const __m128 scale = _mm_set1_ps (SCALE_16);
+    const __m128 hi = _mm_set1_ps (32767.0f);
+    const __m128 lo = _mm_set1_ps (-32768.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 a = _mm_mul_ps (_mm_loadu_ps (src + i), scale);
+        __m128 b = _mm_mul_ps (_mm_loadu_ps (src + i + 4), scale);
+        a = _mm_max_ps (_mm_min_ps (a, hi), lo);
+        b = _mm_max_ps (_mm_min_ps (b, hi), lo);
+        __m128i packed = _mm_packs_epi32 (_mm_cvtps_epi32 (a),
+                                          _mm_cvtps_epi32 (b));
+        _mm_storeu_si128 ((__m128i *)(d + i), packed);
+    }
+
+    f32_to_s16 (d + i, src + i, n - i);
+}
+
+/* int32 containers: S32 (shift 0) and S24_U4 (shift 8, sign-extended) */
+__attribute__ ((target ("sse2"))) static void
+i32_to_f32_sse2 (float *dst, const int32_t *s, size_t n, int shift,
+                 float scale_f)
+{
+    const __m128 scale = _mm_set1_ps (1.0f / scale_f);
+    const __m128i count = _mm_cvtsi32_si128 (shift);
+
+    for (size_t i = 0; i < n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128 ((const __m128i *)(s + i));
+        x = _mm_sra_epi32 (_mm_sll_epi32 (x, count), count);
+        _mm_storeu_ps (dst + i, _mm_mul_ps (_mm_cvtepi32_ps (x), scale));
+    }
+}
+
+__attribute__ ((target ("sse2"))) static void
+f32_to_i32_sse2 (int32_t *d, const float *src, size_t n, float scale_f,
+                 float lo_f, float hi_f)
+{
+    const __m128 scale = _mm_set1_ps (scale_f);
+    const __m128 hi = _mm_set1_ps (hi_f);
+    const __m128 lo = _mm_set1_ps (lo_f);
+
+    for (size_t i = 0; i < n; i += 4)
+    {
+        __m128 a = _mm_mul_ps (_mm_loadu_ps (src + i), scale);
+        a = _mm_max_ps (_mm_min_ps (a, hi), lo);
+        _mm_storeu_si128 ((__m128i *)(d + i), _mm_cvtps_epi32 (a));
+    }
+}
+
+static void
+s32_to_f32_sse2 (float *dst, const void *src, size_t n)
+{
+    size_t body = n & ~(size_t)3;
+    i32_to_f32_sse2 (dst, src, body, 0, SCALE_32);
+    s32_to_f32 (dst + body, (const int32_t *)src + body, n - body);
+}
+
+static void
+f32_to_s32_sse2 (void *dst, const float *src, size_t n)
+{
+    size_t body = n & ~(size_t)3;
+    f32_to_i32_sse2 (dst, src, body, SCALE_32, -SCALE_32, S32_MAX_F);
+    f32_to_s32 ((int32_t *)dst + body, src + body, n - body);
+}
+
+static void
+s24_u4_to_f32_sse2 (float *dst, const void *src, size_t n)
+{
+    size_t body = n & ~(size_t)3;
+    i32_to_f32_sse2 (dst, src, body, 8, SCALE_24);
+    s24_u4_to_f32 (dst + body, (const int32_t *)src + body, n - body);
+}
+
+static void
+f32_to_s24_u4_sse2 (void *dst, const float *src, size_t n)
+{
+    size_t body = n & ~(size_t)3;
+    f32_to_i32_sse2 (dst, src, body, SCALE_24, -SCALE_24, SCALE_24 - 1.0f);
+    f32_to_s24_u4 ((int32_t *)dst + body, src + body, n - body);
+}
+
+/* U10_P5: two groups from 8 values in 0 - 1023 at a time. The upper bytes
+ * pack down in order, a multiply-add shifts the low bits into place. */
+__attribute__ ((target ("sse2"))) static inline void
+u10_p5_pack8_sse2 (uint8_t *d, __m128i a, __m128i b)
+{
+    const __m128i three = _mm_set1_epi32 (3);
+    const __m128i weights = _mm_setr_epi16 (1, 4, 16, 64, 1, 4, 16, 64);
+
+    __m128i hi = _mm_packs_epi32 (_mm_srli_epi32 (a, 2), _mm_srli_epi32 (b, 2));
+    hi = _mm_packus_epi16 (hi, hi);
+
+    __m128i lo = _mm_packs_epi32 (_mm_and_si128 (a, three),
+                                  _mm_and_si128 (b, three));
+    lo = _mm_madd_epi16 (lo, weights);
+    lo = _mm_add_epi32 (lo, _mm_srli_epi64 (lo, 32)); // groups in 0 and 2
+
+    int32_t h0 = _mm_cvtsi128_si32 (hi);
+    int32_t h1 = _mm_cvtsi128_si32 (_mm_srli_si128 (hi, 4));
+    memcpy (d, &h0, 4);
+    d[4] = (uint8_t)_mm_cvtsi128_si32 (lo);
+    memcpy (d + 5, &h1, 4);
+    d[9] = (uint8_t)_mm_cvtsi128_si32 (_mm_srli_si128 (lo, 8));
+}
+
+__attribute__ ((target ("sse2"))) static void
+f32_to_u10_p5_sse2 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    const __m128 scale = _mm_set1_ps (SCALE_10);
+    const __m128 hi = _mm_set1_ps (511.0f);
+    const __m128 lo = _mm_set1_ps (-512.0f);
+    const __m128i mid = _mm_set1_epi32 (0x200);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, d += 10)
+    {
+        __m128 a = _mm_mul_ps (_mm_loadu_ps (src + i), scale);
+        __m128 b = _mm_mul_ps (_mm_loadu_ps (src + i + 4), scale);
+        a = _mm_max_ps (_mm_min_ps (a, hi), lo);
+        b = _mm_max_ps (_mm_min_ps (b, hi), lo);
+        u10_p5_pack8_sse2 (d, _mm_add_epi32 (_mm_cvtps_epi32 (a), mid),
+                           _mm_add_epi32 (_mm_cvtps_epi32 (b), mid));
+    }
+
+    f32_to_u10_p5 (d, src + i, n - i);
+}
+
+/* x / 64 is exact in float, so cvtps2dq rounds it like clamp_round */
+__attribute__ ((target ("sse2"))) static void
+s16_to_u10_p5_sse2 (void *dst, const int16_t *src, size_t n)
+{
+    uint8_t *d = dst;
+    const __m128 scale = _mm_set1_ps (1.0f / 64.0f);
+    const __m128 hi = _mm_set1_ps (511.0f);
+    const __m128i mid = _mm_set1_epi32 (0x200);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, d += 10)
+    {
+        __m128i x = _mm_loadu_si128 ((const __m128i *)(src + i));
+        __m128 a = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (x, x),
+                                                    16));
+        __m128 b = _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (x, x),
+                                                    16));
+        a = _mm_min_ps (_mm_mul_ps (a, scale), hi);
+        b = _mm_min_ps (_mm_mul_ps (b, scale), hi);
+        u10_p5_pack8_sse2 (d, _mm_add_epi32 (_mm_cvtps_epi32 (a), mid),
+                           _mm_add_epi32 (_mm_cvtps_epi32 (b), mid));
+    }
+
+    s16_to_u10_p5 (d, src + i, n - i);
+}
+
+/* Packed 24 bit: 4 samples per 12 bytes, but loads/stores move 16 bytes, so
+ * stay 6 samples away from the end of the buffers. */
+__attribute__ ((target ("ssse3"))) static void
+s24_p3_to_f32_ssse3 (float *dst, const void *src, size_t n)
+{
+    const uint8_t *s = src;
+    const __m128i shuf = _mm_setr_epi8 (-1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8,
+                                        -1, 9, 10, 11);
+    const __m128 scale = _mm_set1_ps (1.0f / SCALE_24);
+    size_t i = 0;
+
+    for (; i + 6 <= n; i += 4)
+    {
+        __m128i x = _mm_loadu_si128 ((const __m128i *)(s + i * 3));
+        x = _mm_srai_epi32 (_mm_shuffle_epi8 (x, shuf), 8);
+        _mm_storeu_ps (dst + i, _mm_mul_ps (_mm_cvtepi32_ps (x), scale));
+    }
+
+    s24_p3_to_f32 (dst + i, s + i * 3, n - i);
+}
+
+__attribute__ ((target ("ssse3"))) static void
+f32_to_s24_p3_ssse3 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    const __m128i shuf = _mm_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14,
+                                        -1, -1, -1, -1);
+    const __m128 scale = _mm_set1_ps (SCALE_24);
+    const __m128 hi = _mm_set1_ps (SCALE_24 - 1.0f);
+    const __m128 lo = _mm_set1_ps (-SCALE_24);
+    size_t i = 0;
+
+    for (; i + 6 <= n; i += 4)
+    {
+        __m128 a = _mm_mul_ps (_mm_loadu_ps (src + i), scale);
+        a = _mm_max_ps (_mm_min_ps (a, hi), lo);
+        __m128i x = _mm_shuffle_epi8 (_mm_cvtps_epi32 (a), shuf);
+        _mm_storeu_si128 ((__m128i *)(d + i * 3), x);
+    }
+
+    f32_to_s24_p3 (d + i * 3, src + i, n - i);
+}
+
+__attribute__ ((target ("avx2"))) static void
+s16_to_f32_avx2 (float *dst, const void *src, size_t n)
+{
+    const int16_t *s = src;
+    const __m256 scale = _mm256_set1_ps (1.0f / SCALE_16);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i x = _mm_loadu_si128 ((const __m128i *)(s + i));
+        __m256i w = _mm256_cvtepi16_epi32 (x);
+        _mm256_storeu_ps (dst + i,
+                          _mm256_mul_ps (_mm256_cvtepi32_ps (w), scale));
+    }
+
+    s16_to_f32 (dst + i, s + i, n - i);
+}
+
+__attribute__ ((target ("avx2"))) static void
+f32_to_s16_avx2 (void *dst, const float *src, size_t n)
+{
+    int16_t *d = dst;
+    const __m256 scale = _mm256_set1_ps (SCALE_16);
+    const __m256 hi = _mm256_set1_ps (32767.0f);
+    const __m256 lo = _mm256_set1_ps (-32768.0f);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256 a = _mm256_mul_ps (_mm256_loadu_ps (src + i), scale);
+        __m256 b = _mm256_mul_ps (_mm256_loadu_ps (src + i + 8), scale);
+        a = _mm256_max_ps (_mm256_min_ps (a, hi), lo);
+        b = _mm256_max_ps (_mm256_min_ps (b, hi), lo);
+        /* packs works per 128 bit lane, put the quadwords back in order */
+        __m256i packed = _mm256_packs_epi32 (_mm256_cvtps_epi32 (a),
+                                             _mm256_cvtps_epi32 (b));
+        packed = _mm256_permute4x64_epi64 (packed, 0xD8);
+        _mm256_storeu_si256 ((__m256i *)(d + i), packed);
+    }
+
+    f32_to_s16 (d + i, src + i, n - i);
+}
+
+__attribute__ ((target ("avx2"))) static void
+i32_to_f32_avx2 (float *dst, const int32_t *s, size_t n, int shift,
+                 float scale_f)
+{
+    const __m256 scale = _mm256_set1_ps (1.0f / scale_f);
+    const __m128i count = _mm_cvtsi32_si128 (shift);
+
+    for (size_t i = 0; i < n; i += 8)
+    {
+        __m256i x = _mm256_loadu_si256 ((const __m256i *)(s + i));
+        x = _mm256_sra_epi32 (_mm256_sll_epi32 (x, count), count);
+        _mm256_storeu_ps (dst + i,
+                          _mm256_mul_ps (_mm256_cvtepi32_ps (x), scale));
+    }
+}
+
+__attribute__ ((target ("avx2"))) static void
+f32_to_i32_avx2 (int32_t *d, const float *src, size_t n, float scale_f,
+                 float lo_f, float hi_f)
+{
+    const __m256 scale = _mm256_set1_ps (scale_f);
+    const __m256 hi = _mm256_set1_ps (hi_f);
+    const __m256 lo = _mm256_set1_ps (lo_f);
+
+    for (size_t i = 0; i < n; i += 8)
+    {
+        __m256 a = _mm256_mul_ps (_mm256_loadu_ps (src + i), scale);
+        a = _mm256_max_ps (_mm256_min_ps (a, hi), lo);
+        _mm256_storeu_si256 ((__m256i *)(d + i), _mm256_cvtps_epi32 (a));
+    }
+}
+
+static void
+s32_to_f32_avx2 (float *dst, const void *src, size_t n)
+{
+    size_t body = n & ~(size_t)7;
+    i32_to_f32_avx2 (dst, src, body, 0, SCALE_32);
+    s32_to_f32 (dst + body, (const int32_t *)src + body, n - body);
+}
+
+static void
+f32_to_s32_avx2 (void *dst, const float *src, size_t n)
+{
+    size_t body = n & ~(size_t)7;
+    f32_to_i32_avx2 (dst, src, body, SCALE_32, -SCALE_32, S32_MAX_F);
+    f32_to_s32 ((int32_t *)dst + body, src + body, n - body);
+}
+
+static void
+s24_u4_to_f32_avx2 (float *dst, const void *src, size_t n)
+{
+    size_t body = n & ~(size_t)7;
+    i32_to_f32_avx2 (dst, src, body, 8, SCALE_24);
+    s24_u4_to_f32 (dst + body, (const int32_t *)src + body, n - body);
+}
+
+static void
+f32_to_s24_u4_avx2 (void *dst, const float *src, size_t n)
+{
+    size_t body = n & ~(size_t)7;
+    f32_to_i32_avx2 (dst, src, body, SCALE_24, -SCALE_24, SCALE_24 - 1.0f);
+    f32_to_s24_u4 ((int32_t *)dst + body, src + body, n - body);
+}
+
+__attribute__ ((target ("avx2"))) static void
+f32_to_u10_p5_avx2 (void *dst, const float *src, size_t n)
+{
+    uint8_t *d = dst;
+    const __m256 scale = _mm256_set1_ps (SCALE_10);
+    const __m256 hi = _mm256_set1_ps (511.0f);
+    const __m256 lo = _mm256_set1_ps (-512.0f);
+    const __m256i mid = _mm256_set1_epi32 (0x200);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, d += 10)
+    {
+        __m256 a = _mm256_mul_ps (_mm256_loadu_ps (src + i), scale);
+        a = _mm256_max_ps (_mm256_min_ps (a, hi), lo);
+        __m256i x = _mm256_add_epi32 (_mm256_cvtps_epi32 (a), mid);
+        u10_p5_pack8_sse2 (d, _mm256_castsi256_si128 (x),
+                           _mm256_extracti128_si256 (x, 1));
+    }
+
+    f32_to_u10_p5 (d, src + i, n - i);
+}
+
+__attribute__ ((target ("avx2"))) static void
+s16_to_u10_p5_avx2 (void *dst, const int16_t *src, size_t n)
+{
+    uint8_t *d = dst;
+    const __m256 scale = _mm256_set1_ps (1.0f / 64.0f);
+    const __m256 hi = _mm256_set1_ps (511.0f);
+    const __m256i mid = _mm256_set1_epi32 (0x200);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8, d += 10)
+    {
+        __m128i w = _mm_loadu_si128 ((const __m128i *)(src + i));
+        __m256 a = _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (w));
+        a = _mm256_min_ps (_mm256_mul_ps (a, scale), hi);
+        __m256i x = _mm256_add_epi32 (_mm256_cvtps_epi32 (a), mid);
+        u10_p5_pack8_sse2 (d, _mm256_castsi256_si128 (x),
+                           _mm256_extracti128_si256 (x, 1));
+    }
+
+    s16_to_u10_p5 (d, src + i, n - i);
+}
+
+#endif
+
+/* --- dispatch --- */
+
+static ToFloatFn to_float_table[] = {
+    [SINUS_FORMAT_UNKNOWN] = NULL,
+    [SINUS_FORMAT_S8] = s8_to_f32,
+    [SINUS_FORMAT_U8] = u8_to_f32,
+    [SINUS_FORMAT_S16] = s16_to_f32,
+    [SINUS_FORMAT_U16] = u16_to_f32,
+    [SINUS_FORMAT_S24_U4] = s24_u4_to_f32,
+    [SINUS_FORMAT_U24_U4] = u24_u4_to_f32,
+    [SINUS_FORMAT_S24_P3] = s24_p3_to_f32,
+    [SINUS_FORMAT_U24_P3] = u24_p3_to_f32,
+    [SINUS_FORMAT_FLOAT] = f32_to_f32,
+    [SINUS_FORMAT_FLOAT64] = f64_to_f32,
+    [SINUS_FORMAT_S32] = s32_to_f32,
+    [SINUS_FORMAT_U10_P5] = u10_p5_to_f32,
+};
+
+static FromFloatFn from_float_table[] = {
+    [SINUS_FORMAT_UNKNOWN] = NULL,
+    [SINUS_FORMAT_S8] = f32_to_s8,
+    [SINUS_FORMAT_U8] = f32_to_u8,
+    [SINUS_FORMAT_S16] = f32_to_s16,
+    [SINUS_FORMAT_U16] = f32_to_u16,
+    [SINUS_FORMAT_S24_U4] = f32_to_s24_u4,
+    [SINUS_FORMAT_U24_U4] = f32_to_u24_u4,
+    [SINUS_FORMAT_S24_P3] = f32_to_s24_p3,
+    [SINUS_FORMAT_U24_P3] = f32_to_u24_p3,
+    [SINUS_FORMAT_FLOAT] = f32_from_f32,
+    [SINUS_FORMAT_FLOAT64] = f32_to_f64,
+    [SINUS_FORMAT_S32] = f32_to_s32,
+    [SINUS_FORMAT_U10_P5] = f32_to_u10_p5,
+};
+
+/* The one integer pair with a direct path: S16 feeding a 10 bit DAC */
+static void (*s16_to_u10_p5_fn) (void *dst, const int16_t *src, size_t n)
+    = s16_to_u10_p5;
+
+static const char *convert_isa = "scalar";
+static pthread_once_t convert_once = PTHREAD_ONCE_INIT;
+
+/* SINUS_CONVERT_ISA=scalar|sse2|avx2 caps the kernels, for benchmarking;
+ * sse2 is plain SSE2, the SSSE3 kernels come with avx2 or no cap */
+static void
+convert_pick_kernels (void)
+{
+#ifdef CONVERT_X86
+    const char *cap = getenv ("SINUS_CONVERT_ISA");
+    int level = 2;
+
+    if (cap && strcmp (cap, "scalar") == 0)
+        level = 0;
+    else if (cap && strcmp (cap, "sse2") == 0)
+        level = 1;
+
+    __builtin_cpu_init ();
+
+    if (level >= 1 && __builtin_cpu_supports ("sse2"))
+    {
+        convert_isa = "sse2";
+        to_float_table[SINUS_FORMAT_S16] = s16_to_f32_sse2;
+        from_float_table[SINUS_FORMAT_S16] = f32_to_s16_sse2;
+        to_float_table[SINUS_FORMAT_S32] = s32_to_f32_sse2;
+        from_float_table[SINUS_FORMAT_S32] = f32_to_s32_sse2;
+        to_float_table[SINUS_FORMAT_S24_U4] = s24_u4_to_f32_sse2;
+        from_float_table[SINUS_FORMAT_S24_U4] = f32_to_s24_u4_sse2;
+        from_float_table[SINUS_FORMAT_U10_P5] = f32_to_u10_p5_sse2;
+        s16_to_u10_p5_fn = s16_to_u10_p5_sse2;
+
+        if (level >= 2 && __builtin_cpu_supports ("ssse3"))
+        {
+            convert_isa = "ssse3";
+            to_float_table[SINUS_FORMAT_S24_P3] = s24_p3_to_f32_ssse3;
+            from_float_table[SINUS_FORMAT_S24_P3] = f32_to_s24_p3_ssse3;
+        }
+    }
+
+    if (level >= 2 && __builtin_cpu_supports ("avx2"))
+    {
+        convert_isa = "avx2";
+        to_float_table[SINUS_FORMAT_S16] = s16_to_f32_avx2;
+        from_float_table[SINUS_FORMAT_S16] = f32_to_s16_avx2;
+        to_float_table[SINUS_FORMAT_S32] = s32_to_f32_avx2;
+        from_float_table[SINUS_FORMAT_S32] = f32_to_s32_avx2;
+        to_float_table[SINUS_FORMAT_S24_U4] = s24_u4_to_f32_avx2;
+        from_float_table[SINUS_FORMAT_S24_U4] = f32_to_s24_u4_avx2;
+        from_float_table[SINUS_FORMAT_U10_P5] = f32_to_u10_p5_avx2;
+        s16_to_u10_p5_fn = s16_to_u10_p5_avx2;
+    }
+#endif
+}
+
+/* Once, through convert_once: converters on other threads read the tables
+ * unlocked */
+static void
+convert_init (void)
+{
+    pthread_once (&convert_once, convert_pick_kernels);
+}
+
+static bool
+format_valid (SinusFormat fmt)
+{
+    return fmt > SINUS_FORMAT_UNKNOWN && (size_t)fmt < arrlen (to_float_table);
+}
+
+void
+sinus_convert_to_float (float *dst, const void *src, SinusFormat src_fmt,
+                        size_t nsamples)
+{
+    convert_init ();
+
+    if (format_valid (src_fmt))
+        to_float_table[src_fmt](dst, src, nsamples);
+}
+
+void
+sinus_convert_from_float (void *dst, SinusFormat dst_fmt, const float *src,
+                          size_t nsamples)
+{
+    convert_init ();
+
+    if (format_valid (dst_fmt))
+        from_float_table[dst_fmt](dst, src, nsamples);
+}
+
+void
+sinus_convert (void *dst, SinusFormat dst_fmt, const void *src,
+               SinusFormat src_fmt, size_t nsamples)
+{
+    if (!format_valid (dst_fmt) || !format_valid (src_fmt))
+        return;
+
+    if (dst_fmt == src_fmt)
+    {
+        memmove (dst, src, sinus_format_bytes (src_fmt, nsamples));
+        return;
+    }
+
+    if (src_fmt == SINUS_FORMAT_S16 && dst_fmt == SINUS_FORMAT_U10_P5)
+    {
+        convert_init ();
+        s16_to_u10_p5_fn (dst, src, nsamples);
+        return;
+    }
+
+    if (src_fmt == SINUS_FORMAT_FLOAT)
+    {
+        sinus_convert_from_float (dst, dst_fmt, src, nsamples);
+        return;
+    }
+
+    if (dst_fmt == SINUS_FORMAT_FLOAT)
+    {
+        sinus_convert_to_float (dst, src, src_fmt, nsamples);
+        return;
+    }
+
+    /* Integer <-> integer goes through float, a cache-sized block at a time.
+     * 24 bits fit a float mantissa exactly, only S32 loses its low bits.
+     * Blocks are whole U10_P5 groups. */
+    float tmp[256];
+    const uint8_t *s = src;
+    uint8_t *d = dst;
+
+    while (nsamples > 0)
+    {
+        size_t n = nsamples < arrlen (tmp) ? nsamples : arrlen (tmp);
+
+        sinus_convert_to_float (tmp, s, src_fmt, n);
+        sinus_convert_from_float (d, dst_fmt, tmp, n);
+
+        s += sinus_format_bytes (src_fmt, n);
+        d += sinus_format_bytes (dst_fmt, n);
+        nsamples -= n;
+    }
+}
+
+void
+sinus_silence (void *dst, SinusFormat fmt, size_t nsamples)
+{
+    if (!format_valid (fmt))
+        return;
+
+    /* Zero everywhere except the unsigned formats, which sit at midscale */
+    switch (fmt)
+    {
+    case SINUS_FORMAT_U8:
+        memset (dst, 0x80, nsamples);
+        break;
+    case SINUS_FORMAT_U16:
+        for (size_t i = 0; i < nsamples; ++i)
+            ((uint16_t *)dst)[i] = 0x8000;
+        break;
+    case SINUS_FORMAT_U24_U4:
+        for (size_t i = 0; i < nsamples; ++i)
+            ((uint32_t *)dst)[i] = 0x800000;
+        break;
+    case SINUS_FORMAT_U24_P3:
+        for (size_t i = 0; i < nsamples; ++i)
+        {
+            uint8_t *d = (uint8_t *)dst + i * 3;
+            d[0] = 0;
+            d[1] = 0;
+            d[2] = 0x80;
+        }
+        break;
+    case SINUS_FORMAT_U10_P5:
+        for (size_t i = 0; i < nsamples; i += 4)
+        {
+            uint8_t *d = (uint8_t *)dst + i / 4 * 5;
+            memset (d, 0x80, 4);
+            d[4] = 0;
+        }
+        break;
+    default:
+        memset (dst, 0, nsamples * (size_t)sinus_format_to_size (fmt));
+        break;
+    }
+}
+
+const char *
+sinus_convert_isa (void)
+{
+    convert_init ();
+    return convert_isa;
+}
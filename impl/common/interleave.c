@@ -0,0 +1,591 @@
+#include <sinus_convert.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define INTERLEAVE_X86 1
+#include <immintrin.h>
+#endif
+
+#define MAX_SIMD_CHANNELS 8
+
+/* Kernels handle whole blocks and return how many frames they did, the
+ * scalar loop below finishes the rest. */
+typedef uint32_t (*InterleaveFn) (uint8_t *dst, const uint8_t *const *src,
+                                  uint32_t nframes);
+typedef uint32_t (*DeinterleaveFn) (uint8_t *const *dst, const uint8_t *src,
+                                    uint32_t nframes);
+
+// [0]: 16 bit samples, [1]: 32 bit samples; indexed by channel count
+static InterleaveFn interleave_table[2][MAX_SIMD_CHANNELS + 1];
+static DeinterleaveFn deinterleave_table[2][MAX_SIMD_CHANNELS + 1];
+
+static void
+interleave_scalar (uint8_t *dst, const uint8_t *const *src, size_t size,
+                   uint32_t channels, uint32_t from, uint32_t nframes)
+{
+    for (uint32_t i = from; i < nframes; ++i)
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+            memcpy (dst, src[c] + (size_t)i * size, size);
+            dst += size;
+        }
+}
+
+static void
+deinterleave_scalar (uint8_t *const *dst, const uint8_t *src, size_t size,
+                     uint32_t channels, uint32_t from, uint32_t nframes)
+{
+    for (uint32_t i = from; i < nframes; ++i)
+        for (uint32_t c = 0; c < channels; ++c)
+        {
+            memcpy (dst[c] + (size_t)i * size, src, size);
+            src += size;
+        }
+}
+
+#ifdef INTERLEAVE_X86
+
+#define LOAD(p) _mm_loadu_si128 ((const __m128i *)(const void *)(p))
+#define STORE(p, v) _mm_storeu_si128 ((__m128i *)(void *)(p), v)
+#define LOAD256(p) _mm256_loadu_si256 ((const __m256i *)(const void *)(p))
+#define STORE256(p, v) _mm256_storeu_si256 ((__m256i *)(void *)(p), v)
+
+/* Rows become columns. Interleaving and deinterleaving 4 channels of 32 bit
+ * (or 8 of 16 bit) samples are both this. */
+__attribute__ ((target ("sse2"))) static inline void
+transpose_4x4_epi32 (__m128i r[4])
+{
+    __m128i t0 = _mm_unpacklo_epi32 (r[0], r[1]);
+    __m128i t1 = _mm_unpacklo_epi32 (r[2], r[3]);
+    __m128i t2 = _mm_unpackhi_epi32 (r[0], r[1]);
+    __m128i t3 = _mm_unpackhi_epi32 (r[2], r[3]);
+
+    r[0] = _mm_unpacklo_epi64 (t0, t1);
+    r[1] = _mm_unpackhi_epi64 (t0, t1);
+    r[2] = _mm_unpacklo_epi64 (t2, t3);
+    r[3] = _mm_unpackhi_epi64 (t2, t3);
+}
+
+__attribute__ ((target ("sse2"))) static inline void
+transpose_8x8_epi16 (__m128i r[8])
+{
+    __m128i a0 = _mm_unpacklo_epi16 (r[0], r[1]);
+    __m128i a1 = _mm_unpacklo_epi16 (r[2], r[3]);
+    __m128i a2 = _mm_unpacklo_epi16 (r[4], r[5]);
+    __m128i a3 = _mm_unpacklo_epi16 (r[6], r[7]);
+    __m128i a4 = _mm_unpackhi_epi16 (r[0], r[1]);
+    __m128i a5 = _mm_unpackhi_epi16 (r[2], r[3]);
+    __m128i a6 = _mm_unpackhi_epi16 (r[4], r[5]);
+    __m128i a7 = _mm_unpackhi_epi16 (r[6], r[7]);
+
+    __m128i b0 = _mm_unpacklo_epi32 (a0, a1);
+    __m128i b1 = _mm_unpacklo_epi32 (a2, a3);
+    __m128i b2 = _mm_unpackhi_epi32 (a0, a1);
+    __m128i b3 = _mm_unpackhi_epi32 (a2, a3);
+    __m128i b4 = _mm_unpacklo_epi32 (a4, a5);
+    __m128i b5 = _mm_unpacklo_epi32 (a6, a7);
+    __m128i b6 = _mm_unpackhi_epi32 (a4, a5);
+    __m128i b7 = _mm_unpackhi_epi32 (a6, a7);
+
+    r[0] = _mm_unpacklo_epi64 (b0, b1);
+    r[1] = _mm_unpackhi_epi64 (b0, b1);
+    r[2] = _mm_unpacklo_epi64 (b2, b3);
+    r[3] = _mm_unpackhi_epi64 (b2, b3);
+    r[4] = _mm_unpacklo_epi64 (b4, b5);
+    r[5] = _mm_unpackhi_epi64 (b4, b5);
+    r[6] = _mm_unpacklo_epi64 (b6, b7);
+    r[7] = _mm_unpackhi_epi64 (b6, b7);
+}
+
+/* 32 bit samples, 4 frames per block */
+
+__attribute__ ((target ("sse2"))) static uint32_t
+il32_2_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i a = LOAD (src[0] + i * 4);
+        __m128i b = LOAD (src[1] + i * 4);
+        STORE (dst + i * 8, _mm_unpacklo_epi32 (a, b));
+        STORE (dst + i * 8 + 16, _mm_unpackhi_epi32 (a, b));
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+il32_4_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i r[4];
+        for (int c = 0; c < 4; ++c)
+            r[c] = LOAD (src[c] + i * 4);
+        transpose_4x4_epi32 (r);
+        for (int k = 0; k < 4; ++k)
+            STORE (dst + (i + k) * 16, r[k]);
+    }
+    return i;
+}
+
+/* Channels 6 and 7 are zero, each frame keeps the first 24 bytes */
+__attribute__ ((target ("sse2"))) static uint32_t
+il32_6_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i lo[4];
+        __m128i hi[4];
+        for (int c = 0; c < 4; ++c)
+            lo[c] = LOAD (src[c] + i * 4);
+        hi[0] = LOAD (src[4] + i * 4);
+        hi[1] = LOAD (src[5] + i * 4);
+        hi[2] = hi[3] = _mm_setzero_si128 ();
+        transpose_4x4_epi32 (lo);
+        transpose_4x4_epi32 (hi);
+        for (int k = 0; k < 4; ++k)
+        {
+            STORE (dst + (i + k) * 24, lo[k]);
+            _mm_storel_epi64 ((__m128i *)(void *)(dst + (i + k) * 24 + 16),
+                              hi[k]);
+        }
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+il32_8_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i lo[4];
+        __m128i hi[4];
+        for (int c = 0; c < 4; ++c)
+        {
+            lo[c] = LOAD (src[c] + i * 4);
+            hi[c] = LOAD (src[c + 4] + i * 4);
+        }
+        transpose_4x4_epi32 (lo);
+        transpose_4x4_epi32 (hi);
+        for (int k = 0; k < 4; ++k)
+        {
+            STORE (dst + (i + k) * 32, lo[k]);
+            STORE (dst + (i + k) * 32 + 16, hi[k]);
+        }
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+de32_2_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 x = _mm_castsi128_ps (LOAD (src + i * 8));
+        __m128 y = _mm_castsi128_ps (LOAD (src + i * 8 + 16));
+        __m128 a = _mm_shuffle_ps (x, y, _MM_SHUFFLE (2, 0, 2, 0));
+        __m128 b = _mm_shuffle_ps (x, y, _MM_SHUFFLE (3, 1, 3, 1));
+        STORE (dst[0] + i * 4, _mm_castps_si128 (a));
+        STORE (dst[1] + i * 4, _mm_castps_si128 (b));
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+de32_4_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i r[4];
+        for (int k = 0; k < 4; ++k)
+            r[k] = LOAD (src + (i + k) * 16);
+        transpose_4x4_epi32 (r);
+        for (int c = 0; c < 4; ++c)
+            STORE (dst[c] + i * 4, r[c]);
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+de32_6_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i lo[4];
+        __m128i pair[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            lo[k] = LOAD (src + (i + k) * 24);
+            pair[k] = _mm_loadl_epi64 (
+                (const __m128i *)(const void *)(src + (i + k) * 24 + 16));
+        }
+        transpose_4x4_epi32 (lo);
+
+        __m128 p01 = _mm_castsi128_ps (_mm_unpacklo_epi64 (pair[0], pair[1]));
+        __m128 p23 = _mm_castsi128_ps (_mm_unpacklo_epi64 (pair[2], pair[3]));
+
+        for (int c = 0; c < 4; ++c)
+            STORE (dst[c] + i * 4, lo[c]);
+        STORE (dst[4] + i * 4, _mm_castps_si128 (_mm_shuffle_ps (
+                                   p01, p23, _MM_SHUFFLE (2, 0, 2, 0))));
+        STORE (dst[5] + i * 4, _mm_castps_si128 (_mm_shuffle_ps (
+                                   p01, p23, _MM_SHUFFLE (3, 1, 3, 1))));
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+de32_8_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i lo[4];
+        __m128i hi[4];
+        for (int k = 0; k < 4; ++k)
+        {
+            lo[k] = LOAD (src + (i + k) * 32);
+            hi[k] = LOAD (src + (i + k) * 32 + 16);
+        }
+        transpose_4x4_epi32 (lo);
+        transpose_4x4_epi32 (hi);
+        for (int c = 0; c < 4; ++c)
+        {
+            STORE (dst[c] + i * 4, lo[c]);
+            STORE (dst[c + 4] + i * 4, hi[c]);
+        }
+    }
+    return i;
+}
+
+/* 16 bit samples, 8 frames per block */
+
+__attribute__ ((target ("sse2"))) static uint32_t
+il16_2_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = LOAD (src[0] + i * 2);
+        __m128i b = LOAD (src[1] + i * 2);
+        STORE (dst + i * 4, _mm_unpacklo_epi16 (a, b));
+        STORE (dst + i * 4 + 16, _mm_unpackhi_epi16 (a, b));
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+il16_4_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i a = LOAD (src[0] + i * 2);
+        __m128i b = LOAD (src[1] + i * 2);
+        __m128i c = LOAD (src[2] + i * 2);
+        __m128i d = LOAD (src[3] + i * 2);
+        __m128i ab_lo = _mm_unpacklo_epi16 (a, b);
+        __m128i cd_lo = _mm_unpacklo_epi16 (c, d);
+        __m128i ab_hi = _mm_unpackhi_epi16 (a, b);
+        __m128i cd_hi = _mm_unpackhi_epi16 (c, d);
+        STORE (dst + i * 8, _mm_unpacklo_epi32 (ab_lo, cd_lo));
+        STORE (dst + i * 8 + 16, _mm_unpackhi_epi32 (ab_lo, cd_lo));
+        STORE (dst + i * 8 + 32, _mm_unpacklo_epi32 (ab_hi, cd_hi));
+        STORE (dst + i * 8 + 48, _mm_unpackhi_epi32 (ab_hi, cd_hi));
+    }
+    return i;
+}
+
+/* Channels 6 and 7 are zero, each frame keeps the first 12 bytes */
+__attribute__ ((target ("sse2"))) static uint32_t
+il16_6_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i r[8];
+        for (int c = 0; c < 6; ++c)
+            r[c] = LOAD (src[c] + i * 2);
+        r[6] = r[7] = _mm_setzero_si128 ();
+        transpose_8x8_epi16 (r);
+        for (int k = 0; k < 8; ++k)
+        {
+            uint8_t *frame = dst + (i + k) * 12;
+            int32_t tail = _mm_cvtsi128_si32 (_mm_srli_si128 (r[k], 8));
+            _mm_storel_epi64 ((__m128i *)(void *)frame, r[k]);
+            memcpy (frame + 8, &tail, 4);
+        }
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+il16_8_sse2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i r[8];
+        for (int c = 0; c < 8; ++c)
+            r[c] = LOAD (src[c] + i * 2);
+        transpose_8x8_epi16 (r);
+        for (int k = 0; k < 8; ++k)
+            STORE (dst + (i + k) * 16, r[k]);
+    }
+    return i;
+}
+
+/* Even samples sign extended and odd ones shifted down, packs_epi32 can't
+ * saturate on either */
+__attribute__ ((target ("sse2"))) static uint32_t
+de16_2_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i x = LOAD (src + i * 4);
+        __m128i y = LOAD (src + i * 4 + 16);
+        __m128i xa = _mm_srai_epi32 (_mm_slli_epi32 (x, 16), 16);
+        __m128i ya = _mm_srai_epi32 (_mm_slli_epi32 (y, 16), 16);
+        __m128i a = _mm_packs_epi32 (xa, ya);
+        __m128i b = _mm_packs_epi32 (_mm_srai_epi32 (x, 16),
+                                     _mm_srai_epi32 (y, 16));
+        STORE (dst[0] + i * 2, a);
+        STORE (dst[1] + i * 2, b);
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+de16_4_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i f01 = LOAD (src + i * 8);
+        __m128i f23 = LOAD (src + i * 8 + 16);
+        __m128i f45 = LOAD (src + i * 8 + 32);
+        __m128i f67 = LOAD (src + i * 8 + 48);
+
+        __m128i t0 = _mm_unpacklo_epi16 (f01, f23); // a0 a2 b0 b2 c0 c2 d0 d2
+        __m128i t1 = _mm_unpackhi_epi16 (f01, f23); // a1 a3 b1 b3 ...
+        __m128i t2 = _mm_unpacklo_epi16 (f45, f67);
+        __m128i t3 = _mm_unpackhi_epi16 (f45, f67);
+
+        __m128i ab03 = _mm_unpacklo_epi16 (t0, t1);
+        __m128i cd03 = _mm_unpackhi_epi16 (t0, t1);
+        __m128i ab47 = _mm_unpacklo_epi16 (t2, t3);
+        __m128i cd47 = _mm_unpackhi_epi16 (t2, t3);
+
+        STORE (dst[0] + i * 2, _mm_unpacklo_epi64 (ab03, ab47));
+        STORE (dst[1] + i * 2, _mm_unpackhi_epi64 (ab03, ab47));
+        STORE (dst[2] + i * 2, _mm_unpacklo_epi64 (cd03, cd47));
+        STORE (dst[3] + i * 2, _mm_unpackhi_epi64 (cd03, cd47));
+    }
+    return i;
+}
+
+__attribute__ ((target ("sse2"))) static uint32_t
+de16_8_sse2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128i r[8];
+        for (int k = 0; k < 8; ++k)
+            r[k] = LOAD (src + (i + k) * 16);
+        transpose_8x8_epi16 (r);
+        for (int c = 0; c < 8; ++c)
+            STORE (dst[c] + i * 2, r[c]);
+    }
+    return i;
+}
+
+/* AVX2 only for stereo, the rest is shuffle bound either way. Unpacks work
+ * per 128 bit lane, permutes put the lanes back in order. */
+
+__attribute__ ((target ("avx2"))) static uint32_t
+il32_2_avx2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i a = LOAD256 (src[0] + i * 4);
+        __m256i b = LOAD256 (src[1] + i * 4);
+        __m256i lo = _mm256_unpacklo_epi32 (a, b);
+        __m256i hi = _mm256_unpackhi_epi32 (a, b);
+        STORE256 (dst + i * 8, _mm256_permute2x128_si256 (lo, hi, 0x20));
+        STORE256 (dst + i * 8 + 32, _mm256_permute2x128_si256 (lo, hi, 0x31));
+    }
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static uint32_t
+de32_2_avx2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 x = _mm256_castsi256_ps (LOAD256 (src + i * 8));
+        __m256 y = _mm256_castsi256_ps (LOAD256 (src + i * 8 + 32));
+        __m256i a = _mm256_castps_si256 (
+            _mm256_shuffle_ps (x, y, _MM_SHUFFLE (2, 0, 2, 0)));
+        __m256i b = _mm256_castps_si256 (
+            _mm256_shuffle_ps (x, y, _MM_SHUFFLE (3, 1, 3, 1)));
+        STORE256 (dst[0] + i * 4,
+                  _mm256_permute4x64_epi64 (a, _MM_SHUFFLE (3, 1, 2, 0)));
+        STORE256 (dst[1] + i * 4,
+                  _mm256_permute4x64_epi64 (b, _MM_SHUFFLE (3, 1, 2, 0)));
+    }
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static uint32_t
+il16_2_avx2 (uint8_t *dst, const uint8_t *const *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i a = LOAD256 (src[0] + i * 2);
+        __m256i b = LOAD256 (src[1] + i * 2);
+        __m256i lo = _mm256_unpacklo_epi16 (a, b);
+        __m256i hi = _mm256_unpackhi_epi16 (a, b);
+        STORE256 (dst + i * 4, _mm256_permute2x128_si256 (lo, hi, 0x20));
+        STORE256 (dst + i * 4 + 32, _mm256_permute2x128_si256 (lo, hi, 0x31));
+    }
+    return i;
+}
+
+__attribute__ ((target ("avx2"))) static uint32_t
+de16_2_avx2 (uint8_t *const *dst, const uint8_t *src, uint32_t n)
+{
+    uint32_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256i x = LOAD256 (src + i * 4);
+        __m256i y = LOAD256 (src + i * 4 + 32);
+        __m256i a = _mm256_packs_epi32 (
+            _mm256_srai_epi32 (_mm256_slli_epi32 (x, 16), 16),
+            _mm256_srai_epi32 (_mm256_slli_epi32 (y, 16), 16));
+        __m256i b = _mm256_packs_epi32 (_mm256_srai_epi32 (x, 16),
+                                        _mm256_srai_epi32 (y, 16));
+        STORE256 (dst[0] + i * 2,
+                  _mm256_permute4x64_epi64 (a, _MM_SHUFFLE (3, 1, 2, 0)));
+        STORE256 (dst[1] + i * 2,
+                  _mm256_permute4x64_epi64 (b, _MM_SHUFFLE (3, 1, 2, 0)));
+    }
+    return i;
+}
+
+#endif
+
+static pthread_once_t interleave_once = PTHREAD_ONCE_INIT;
+
+/* Same SINUS_CONVERT_ISA cap as the format kernels */
+static void
+interleave_pick_kernels (void)
+{
+#ifdef INTERLEAVE_X86
+    const char *cap = getenv ("SINUS_CONVERT_ISA");
+    int level = 2;
+
+    if (cap && strcmp (cap, "scalar") == 0)
+        level = 0;
+    else if (cap && strcmp (cap, "sse2") == 0)
+        level = 1;
+
+    __builtin_cpu_init ();
+
+    if (level >= 1 && __builtin_cpu_supports ("sse2"))
+    {
+        interleave_table[0][2] = il16_2_sse2;
+        interleave_table[0][4] = il16_4_sse2;
+        interleave_table[0][6] = il16_6_sse2;
+        interleave_table[0][8] = il16_8_sse2;
+        interleave_table[1][2] = il32_2_sse2;
+        interleave_table[1][4] = il32_4_sse2;
+        interleave_table[1][6] = il32_6_sse2;
+        interleave_table[1][8] = il32_8_sse2;
+
+        deinterleave_table[0][2] = de16_2_sse2;
+        deinterleave_table[0][4] = de16_4_sse2;
+        deinterleave_table[0][8] = de16_8_sse2;
+        deinterleave_table[1][2] = de32_2_sse2;
+        deinterleave_table[1][4] = de32_4_sse2;
+        deinterleave_table[1][6] = de32_6_sse2;
+        deinterleave_table[1][8] = de32_8_sse2;
+    }
+
+    if (level >= 2 && __builtin_cpu_supports ("avx2"))
+    {
+        interleave_table[0][2] = il16_2_avx2;
+        interleave_table[1][2] = il32_2_avx2;
+        deinterleave_table[0][2] = de16_2_avx2;
+        deinterleave_table[1][2] = de32_2_avx2;
+    }
+#endif
+}
+
+/* Once, through interleave_once: other threads read the tables unlocked */
+static void
+interleave_init (void)
+{
+    pthread_once (&interleave_once, interleave_pick_kernels);
+}
+
+/* Kernel row for a sample size, -1 if it has none */
+static int
+interleave_row (size_t size)
+{
+    return size == 2 ? 0 : size == 4 ? 1 : -1;
+}
+
+void
+sinus_interleave (void *dst, const void *const *src, SinusFormat fmt,
+                  uint32_t channels, uint32_t nframes)
+{
+    size_t size = (size_t)sinus_format_to_size (fmt);
+    const uint8_t *const *planes = (const uint8_t *const *)src;
+    uint32_t done = 0;
+    int row = interleave_row (size);
+
+    interleave_init ();
+
+    if (row >= 0 && channels <= MAX_SIMD_CHANNELS
+        && interleave_table[row][channels])
+        done = interleave_table[row][channels](dst, planes, nframes);
+
+    interleave_scalar ((uint8_t *)dst + (size_t)done * size * channels, planes,
+                       size, channels, done, nframes);
+}
+
+void
+sinus_deinterleave (void *const *dst, const void *src, SinusFormat fmt,
+                    uint32_t channels, uint32_t nframes)
+{
+    size_t size = (size_t)sinus_format_to_size (fmt);
+    uint8_t *const *planes = (uint8_t *const *)dst;
+    uint32_t done = 0;
+    int row = interleave_row (size);
+
+    interleave_init ();
+
+    if (row >= 0 && channels <= MAX_SIMD_CHANNELS
+        && deinterleave_table[row][channels])
+        done = deinterleave_table[row][channels](planes, src, nframes);
+
+    deinterleave_scalar (planes,
+                         (const uint8_t *)src + (size_t)done * size * channels,
+                         size, channels, done, nframes);
+}
@@ -0,0 +1,122 @@
+#ifndef _SINUS_LATENCY_H
+#define _SINUS_LATENCY_H
+
+/*
+ * Fill target for SINUS_FLAG_ADAPTIVE, shared by the backends.
+ *
+ * Backends report every write: the underrun counter and how much was still
+ * queued when the write came in. An underrun grows the target by half, a
+ * write that found less than half a step queued (the producer nearly
+ * missed) by one step. A settle period with neither gives back half of
+ * what was never used, the queue's low point less a step of margin. So the
+ * target jumps up quickly and comes back down to the lowest level that
+ * holds.
+ *
+ * Only the target is shared; updates take a try-lock and a writer that
+ * finds it taken skips its sample instead of waiting.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SINUS_LATENCY_SETTLE_NS 1000000000ULL
+
+typedef struct sinus_latency_s
+{
+    uint32_t min_frames;
+    uint32_t max_frames;
+    uint32_t step;   // usually a period
+    uint32_t target; // accessed atomically
+
+    uint32_t busy;       // try-lock around the fields below
+    uint64_t underruns;  // last seen
+    uint64_t window_ns;  // start of the current settle period
+    uint64_t window_low; // least queued in it
+} SinusLatency;
+
+/* Starts at max_frames, which is safe, and works its way down */
+static inline void
+sinus_latency_init (SinusLatency *lat, uint32_t min_frames,
+                    uint32_t max_frames, uint32_t step, uint64_t now_ns)
+{
+    if (step == 0)
+        step = 1;
+    if (min_frames == 0)
+        min_frames = 2 * step;
+    if (min_frames > max_frames)
+        min_frames = max_frames;
+
+    lat->min_frames = min_frames;
+    lat->max_frames = max_frames;
+    lat->step = step;
+    lat->target = max_frames;
+    lat->busy = 0;
+    lat->underruns = 0;
+    lat->window_ns = now_ns;
+    lat->window_low = UINT64_MAX;
+}
+
+static inline uint32_t
+sinus_latency_target (SinusLatency *lat)
+{
+    return __atomic_load_n (&lat->target, __ATOMIC_RELAXED);
+}
+
+/* One write's worth of observations: the total underruns so far and the
+ * frames that were queued before the write. Returns true when the target
+ * moved. */
+static inline bool
+sinus_latency_update (SinusLatency *lat, uint64_t underruns, uint64_t queued,
+                      uint64_t now_ns)
+{
+    if (__atomic_exchange_n (&lat->busy, 1, __ATOMIC_ACQUIRE))
+        return false;
+
+    uint32_t target = lat->target;
+    uint64_t grow = 0;
+
+    if (underruns != lat->underruns)
+    {
+        lat->underruns = underruns;
+        grow = target / 2 > lat->step ? target / 2 : lat->step;
+    }
+    /* Nothing queued at all is a fresh start, not a late producer */
+    else if (queued > 0 && queued < lat->step / 2)
+        grow = lat->step;
+
+    if (grow > 0)
+    {
+        uint64_t t = (uint64_t)target + grow;
+        target = t < lat->max_frames ? (uint32_t)t : lat->max_frames;
+        lat->window_ns = now_ns;
+        lat->window_low = UINT64_MAX;
+    }
+    else
+    {
+        if (queued < lat->window_low)
+            lat->window_low = queued;
+
+        if (now_ns - lat->window_ns >= SINUS_LATENCY_SETTLE_NS)
+        {
+            if (lat->window_low >= 2 * (uint64_t)lat->step)
+            {
+                uint64_t unused = (lat->window_low - lat->step) / 2;
+                if (unused < lat->step)
+                    unused = lat->step;
+                target = target - lat->min_frames > unused
+                             ? target - (uint32_t)unused
+                             : lat->min_frames;
+            }
+
+            lat->window_ns = now_ns;
+            lat->window_low = UINT64_MAX;
+        }
+    }
+
+    bool moved = target != lat->target;
+    __atomic_store_n (&lat->target, target, __ATOMIC_RELAXED);
+    __atomic_store_n (&lat->busy, 0, __ATOMIC_RELEASE);
+    return moved;
+}
+
+#endif
@@ -0,0 +1,536 @@
+#define _GNU_SOURCE
+
+#include <sinus_convert.h>
+#include <sinus_mix.h>
+
+#include "mix.h"
+#include "ring.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define MIX_X86 1
+#include <immintrin.h>
+#endif
+
+#define MIX_CHUNK 1024U // frames mixed per pass
+#define MIX_MAX_FDS 16
+#define MIX_IDLE_MS 2   // nothing queued, look again after this long
+#define MIX_POLL_MS 100 // bounds every wait, so quit gets noticed
+
+struct SinusStream
+{
+    SinusRing ring; // only written by sinus_stream_write, only read by mixer
+    SinusMixer *mixer;
+    SinusFormat fmt;
+    uint32_t channels;
+    float gain; // accessed atomically
+};
+
+struct SinusMixer
+{
+    SinusContext *sc;
+    SinusFormat fmt;
+    uint32_t channels;
+
+    SinusStream *streams[SINUS_MIX_MAX_STREAMS]; // accessed atomically
+    uint32_t pass; // odd while a pass looks at streams, accessed atomically
+
+    float *acc;     // MIX_CHUNK frames of the mix
+    float *scratch; // MIX_CHUNK frames of one stream, converted to float
+
+    pthread_t thread;
+    bool quit; // accessed atomically
+};
+
+/* Serializes open/close/destroy, never taken by the mixer thread */
+static pthread_mutex_t mix_lock = PTHREAD_MUTEX_INITIALIZER;
+
+typedef void (*AccumulateFn) (float *acc, const float *src, float gain,
+                              size_t n);
+typedef void (*ClampFn) (float *buf, size_t n);
+
+static void
+accumulate_scalar (float *acc, const float *src, float gain, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+        acc[i] += gain * src[i];
+}
+
+static void
+clamp_scalar (float *buf, size_t n)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (buf[i] > 1.0f)
+            buf[i] = 1.0f;
+        else if (buf[i] < -1.0f)
+            buf[i] = -1.0f;
+    }
+}
+
+#ifdef MIX_X86
+
+__attribute__ ((target ("sse2"))) static void
+accumulate_sse2 (float *acc, const float *src, float gain, size_t n)
+{
+    __m128 g = _mm_set1_ps (gain);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m128 a0 = _mm_loadu_ps (acc + i);
+        __m128 a1 = _mm_loadu_ps (acc + i + 4);
+        a0 = _mm_add_ps (a0, _mm_mul_ps (g, _mm_loadu_ps (src + i)));
+        a1 = _mm_add_ps (a1, _mm_mul_ps (g, _mm_loadu_ps (src + i + 4)));
+        _mm_storeu_ps (acc + i, a0);
+        _mm_storeu_ps (acc + i + 4, a1);
+    }
+
+    accumulate_scalar (acc + i, src + i, gain, n - i);
+}
+
+__attribute__ ((target ("sse2"))) static void
+clamp_sse2 (float *buf, size_t n)
+{
+    __m128 hi = _mm_set1_ps (1.0f);
+    __m128 lo = _mm_set1_ps (-1.0f);
+    size_t i = 0;
+
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128 v = _mm_min_ps (_mm_loadu_ps (buf + i), hi);
+        _mm_storeu_ps (buf + i, _mm_max_ps (v, lo));
+    }
+
+    clamp_scalar (buf + i, n - i);
+}
+
+__attribute__ ((target ("avx2,fma"))) static void
+accumulate_avx2 (float *acc, const float *src, float gain, size_t n)
+{
+    __m256 g = _mm256_set1_ps (gain);
+    size_t i = 0;
+
+    for (; i + 16 <= n; i += 16)
+    {
+        __m256 a0 = _mm256_loadu_ps (acc + i);
+        __m256 a1 = _mm256_loadu_ps (acc + i + 8);
+        a0 = _mm256_fmadd_ps (g, _mm256_loadu_ps (src + i), a0);
+        a1 = _mm256_fmadd_ps (g, _mm256_loadu_ps (src + i + 8), a1);
+        _mm256_storeu_ps (acc + i, a0);
+        _mm256_storeu_ps (acc + i + 8, a1);
+    }
+
+    accumulate_scalar (acc + i, src + i, gain, n - i);
+}
+
+__attribute__ ((target ("avx2"))) static void
+clamp_avx2 (float *buf, size_t n)
+{
+    __m256 hi = _mm256_set1_ps (1.0f);
+    __m256 lo = _mm256_set1_ps (-1.0f);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256 v = _mm256_min_ps (_mm256_loadu_ps (buf + i), hi);
+        _mm256_storeu_ps (buf + i, _mm256_max_ps (v, lo));
+    }
+
+    clamp_scalar (buf + i, n - i);
+}
+
+#endif
+
+static AccumulateFn accumulate = accumulate_scalar;
+static ClampFn clamp = clamp_scalar;
+static pthread_once_t mix_kernels_once = PTHREAD_ONCE_INIT;
+
+/* Once, through mix_kernels_once: mixer threads read the pointers unlocked */
+static void
+mix_pick_kernels (void)
+{
+#ifdef MIX_X86
+    const char *cap = getenv ("SINUS_CONVERT_ISA");
+
+    if (cap && strcmp (cap, "scalar") == 0)
+        return;
+
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("sse2"))
+    {
+        accumulate = accumulate_sse2;
+        clamp = clamp_sse2;
+    }
+
+    if ((!cap || strcmp (cap, "sse2") != 0)
+        && __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+    {
+        accumulate = accumulate_avx2;
+        clamp = clamp_avx2;
+    }
+#endif
+}
+
+/* Most frames any stream has queued */
+static uint32_t
+mix_queued (SinusMixer *m)
+{
+    uint32_t queued = 0;
+
+    for (uint32_t i = 0; i < SINUS_MIX_MAX_STREAMS; ++i)
+    {
+        SinusStream *st = __atomic_load_n (&m->streams[i], __ATOMIC_SEQ_CST);
+        if (!st)
+            continue;
+
+        uint32_t n = sinus_ring_buffered (&st->ring);
+        if (n > queued)
+            queued = n;
+    }
+
+    return queued;
+}
+
+/* Add up to nframes of st into the mix. A stream with less queued just
+ * leaves the rest of its share silent. */
+static void
+mix_stream (SinusMixer *m, SinusStream *st, uint32_t nframes)
+{
+    float gain;
+    __atomic_load (&st->gain, &gain, __ATOMIC_RELAXED);
+
+    uint32_t done = 0;
+    while (done < nframes)
+    {
+        const void *frames;
+        uint32_t n = sinus_ring_read_region (&st->ring, &frames);
+        if (n == 0)
+            break;
+        if (n > nframes - done)
+            n = nframes - done;
+
+        size_t samples = (size_t)n * st->channels;
+        const float *src = frames;
+        if (st->fmt != SINUS_FORMAT_FLOAT)
+        {
+            sinus_convert_to_float (m->scratch, frames, st->fmt, samples);
+            src = m->scratch;
+        }
+
+        float *acc = m->acc + (size_t)done * m->channels;
+        if (st->channels == m->channels)
+        {
+            accumulate (acc, src, gain, samples);
+        }
+        else
+        {
+            /* Mono into every channel */
+            for (uint32_t i = 0; i < n; ++i)
+                for (uint32_t c = 0; c < m->channels; ++c)
+                    acc[(size_t)i * m->channels + c] += gain * src[i];
+        }
+
+        sinus_ring_consume (&st->ring, n);
+        done += n;
+    }
+}
+
+typedef enum
+{
+    MIX_WROTE,
+    MIX_IDLE, // no stream has anything queued
+    MIX_FULL, // the context can't take what's queued yet
+} MixResult;
+
+/* One pass: mix as much as both the streams and the context allow, straight
+ * into the context's buffer. Without writable only when everything queued
+ * fits, so a nearly full device isn't fed in crumbs. */
+static MixResult
+mix_once (SinusMixer *m, bool writable)
+{
+    uint32_t queued = mix_queued (m);
+    if (queued == 0)
+        return MIX_IDLE;
+    if (queued > MIX_CHUNK)
+        queued = MIX_CHUNK;
+
+    void *dst;
+    uint32_t room = queued;
+    if (sinus_frames_begin_write (m->sc, &dst, &room) < 0 || room == 0)
+        return MIX_FULL;
+    if (room < queued && !writable)
+        return MIX_FULL;
+
+    size_t samples = (size_t)room * m->channels;
+    memset (m->acc, 0, samples * sizeof (float));
+
+    for (uint32_t i = 0; i < SINUS_MIX_MAX_STREAMS; ++i)
+    {
+        SinusStream *st = __atomic_load_n (&m->streams[i], __ATOMIC_SEQ_CST);
+        if (st)
+            mix_stream (m, st, room);
+    }
+
+    /* The integer conversions saturate on their own */
+    if (m->fmt == SINUS_FORMAT_FLOAT || m->fmt == SINUS_FORMAT_FLOAT64)
+        clamp (m->acc, samples);
+
+    sinus_convert_from_float (dst, m->fmt, m->acc, samples);
+    sinus_frames_commit (m->sc, room);
+
+    return MIX_WROTE;
+}
+
+/* Returns true once the context has room (or an xrun to recover from) */
+static bool
+mix_wait (SinusMixer *m, struct pollfd *fds, int nfds)
+{
+    if (nfds <= 0)
+    {
+        poll (NULL, 0, MIX_IDLE_MS);
+        return true;
+    }
+
+    if (poll (fds, (nfds_t)nfds, MIX_POLL_MS) <= 0)
+        return false;
+
+    unsigned short revents = 0;
+    sinus_poll_revents (m->sc, fds, (uint32_t)nfds, &revents);
+    return (revents & (POLLOUT | POLLERR)) != 0;
+}
+
+static void *
+mix_thread (void *arg)
+{
+    SinusMixer *m = arg;
+
+    struct pollfd fds[MIX_MAX_FDS];
+    int nfds = sinus_poll_fds_get (m->sc, fds, MIX_MAX_FDS);
+    bool writable = false;
+
+    while (!__atomic_load_n (&m->quit, __ATOMIC_ACQUIRE))
+    {
+        /* Odd pass: streams may be in use, see mix_forget */
+        __atomic_add_fetch (&m->pass, 1, __ATOMIC_SEQ_CST);
+        MixResult res = mix_once (m, writable);
+        __atomic_add_fetch (&m->pass, 1, __ATOMIC_SEQ_CST);
+
+        switch (res)
+        {
+        case MIX_WROTE:
+            writable = false;
+            break;
+        case MIX_IDLE:
+            poll (NULL, 0, MIX_IDLE_MS);
+            break;
+        case MIX_FULL:
+            writable = mix_wait (m, fds, nfds);
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+/* Take st out of the mix and wait until no pass can still be using it.
+ * Called with mix_lock held. */
+static void
+mix_forget (SinusMixer *m, SinusStream *st)
+{
+    for (uint32_t i = 0; i < SINUS_MIX_MAX_STREAMS; ++i)
+        if (m->streams[i] == st)
+            __atomic_store_n (&m->streams[i], NULL, __ATOMIC_SEQ_CST);
+
+    uint32_t pass = __atomic_load_n (&m->pass, __ATOMIC_SEQ_CST);
+    if (pass & 1)
+        while (__atomic_load_n (&m->pass, __ATOMIC_SEQ_CST) == pass)
+            poll (NULL, 0, 1);
+}
+
+/* Called with mix_lock held */
+static SinusMixer *
+mix_create (SinusContext *sc)
+{
+    SinusMixer *m = calloc (1, sizeof (SinusMixer));
+    if (!m)
+        return NULL;
+
+    m->sc = sc;
+    m->fmt = sinus_info_get_format (sc);
+    m->channels = sinus_info_get_channels (sc);
+
+    size_t samples = (size_t)MIX_CHUNK * m->channels;
+    m->acc = malloc (samples * sizeof (float));
+    m->scratch = malloc (samples * sizeof (float));
+
+    pthread_once (&mix_kernels_once, mix_pick_kernels);
+
+    if (!m->acc || !m->scratch
+        || pthread_create (&m->thread, NULL, mix_thread, m) != 0)
+    {
+        free (m->acc);
+        free (m->scratch);
+        free (m);
+        return NULL;
+    }
+
+    return m;
+}
+
+static void
+mix_stream_free (SinusStream *st)
+{
+    sinus_ring_deinit (&st->ring);
+    free (st);
+}
+
+void
+sinus_mixer_destroy (SinusMixer *m)
+{
+    if (!m)
+        return;
+
+    __atomic_store_n (&m->quit, true, __ATOMIC_RELEASE);
+    pthread_join (m->thread, NULL);
+
+    pthread_mutex_lock (&mix_lock);
+    for (uint32_t i = 0; i < SINUS_MIX_MAX_STREAMS; ++i)
+        if (m->streams[i])
+            mix_stream_free (m->streams[i]);
+    pthread_mutex_unlock (&mix_lock);
+
+    free (m->acc);
+    free (m->scratch);
+    free (m);
+}
+
+bool
+sinus_mixer_idle (SinusMixer *m)
+{
+    bool idle = true;
+
+    if (!m)
+        return true;
+
+    pthread_mutex_lock (&mix_lock);
+    for (uint32_t i = 0; i < SINUS_MIX_MAX_STREAMS; ++i)
+        if (m->streams[i])
+            idle = false;
+    pthread_mutex_unlock (&mix_lock);
+
+    return idle;
+}
+
+void
+sinus_stream_settings_default (SinusStreamSettings *ss)
+{
+    if (!ss)
+        return;
+
+    ss->fmt = SINUS_FORMAT_FLOAT;
+    ss->channels = 2;
+    ss->buffer_frames = 4096;
+    ss->gain = 1.0f;
+}
+
+int
+sinus_stream_open (SinusContext *sc, SinusStream **_st,
+                   const SinusStreamSettings *ss)
+{
+    if (!sc || !_st || !ss)
+        return -1;
+
+    uint32_t channels = sinus_info_get_channels (sc);
+    uint32_t frame_bytes
+        = (uint32_t)sinus_format_to_size (ss->fmt) * ss->channels;
+
+    if (frame_bytes == 0 || ss->buffer_frames == 0
+        || (ss->channels != channels && ss->channels != 1))
+        return -1;
+
+    SinusStream *st = calloc (1, sizeof (SinusStream));
+    if (!st)
+        return -1;
+
+    if (sinus_ring_init (&st->ring, ss->buffer_frames, frame_bytes) < 0)
+    {
+        free (st);
+        return -1;
+    }
+
+    st->fmt = ss->fmt;
+    st->channels = ss->channels;
+    st->gain = ss->gain;
+
+    pthread_mutex_lock (&mix_lock);
+
+    SinusMixer **m = sinus_context_mixer (sc);
+    if (!*m)
+        *m = mix_create (sc);
+
+    uint32_t slot = SINUS_MIX_MAX_STREAMS;
+    if (*m)
+        for (slot = 0; slot < SINUS_MIX_MAX_STREAMS; ++slot)
+            if (!(*m)->streams[slot])
+                break;
+
+    if (slot == SINUS_MIX_MAX_STREAMS)
+    {
+        pthread_mutex_unlock (&mix_lock);
+        mix_stream_free (st);
+        return -1;
+    }
+
+    st->mixer = *m;
+    __atomic_store_n (&(*m)->streams[slot], st, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock (&mix_lock);
+
+    *_st = st;
+    return 0;
+}
+
+void
+sinus_stream_close (SinusStream *st)
+{
+    if (!st)
+        return;
+
+    pthread_mutex_lock (&mix_lock);
+    mix_forget (st->mixer, st);
+    pthread_mutex_unlock (&mix_lock);
+
+    mix_stream_free (st);
+}
+
+sinus_ssize_t
+sinus_stream_write (SinusStream *st, const void *frames, uint32_t nframes)
+{
+    if (!st || !frames)
+        return -1;
+
+    return sinus_ring_write (&st->ring, frames, nframes);
+}
+
+sinus_ssize_t
+sinus_stream_get_n_frames_free (SinusStream *st)
+{
+    if (!st)
+        return -1;
+
+    return sinus_ring_free (&st->ring);
+}
+
+void
+sinus_stream_set_gain (SinusStream *st, float gain)
+{
+    if (st)
+        __atomic_store (&st->gain, &gain, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,26 @@
+#ifndef _SINUS_MIX_INTERNAL_H
+#define _SINUS_MIX_INTERNAL_H
+
+/*
+ * Backend side of sinus_mix.h. Every backend linking mix.c keeps one
+ * SinusMixer pointer in its context and destroys it in
+ * sinus_context_deinit, before the device goes away.
+ */
+
+#include <sinus.h>
+
+#include <stdbool.h>
+
+typedef struct SinusMixer SinusMixer;
+
+/* Implemented by the backend: where the context keeps its mixer */
+SinusMixer **sinus_context_mixer (SinusContext *sc);
+
+/* Stops the mixer thread and closes any streams left open. NULL is fine. */
+void sinus_mixer_destroy (SinusMixer *m);
+
+/* No streams open, the mixer can go and come back with new settings on the
+ * next sinus_stream_open. NULL is idle. */
+bool sinus_mixer_idle (SinusMixer *m);
+
+#endif
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+
+#include <sinus_convert.h>
+#include <sinus_osc.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OSC_X86 1
+#include <immintrin.h>
+#endif
+
+#define OSC_SHAPES 4
+#define OSC_TABLE_BITS 11
+#define OSC_TABLE (1U << OSC_TABLE_BITS) // samples per cycle
+#define OSC_FRAC_BITS (32 - OSC_TABLE_BITS)
+#define OSC_LEVELS 10        // one per octave
+#define OSC_MAX_HARMONIC 512 // in level 0, halved every level after
+#define OSC_CHUNK 1024U      // floats rendered per sinus_osc_render pass
+
+struct SinusOsc
+{
+    SinusOscShape shape;
+    uint32_t sample_rate;
+    uint32_t phase; // 2^32 is one cycle, wraps freely
+    uint32_t inc;
+    float amplitude;
+    const float *table;
+};
+
+/* [shape][level]: one cycle plus a copy of the first sample, so the
+ * interpolation never has to wrap */
+static float osc_tables[OSC_SHAPES][OSC_LEVELS][OSC_TABLE + 1]
+    __attribute__ ((aligned (32)));
+static pthread_once_t osc_once = PTHREAD_ONCE_INIT;
+
+/* Amplitude of harmonic h before normalizing, 0 if the shape lacks it */
+static double
+osc_harmonic (SinusOscShape shape, uint32_t h)
+{
+    switch (shape)
+    {
+    case SINUS_OSC_SINE:
+        return h == 1 ? 1.0 : 0.0;
+    case SINUS_OSC_SQUARE:
+        return h % 2 ? 1.0 / h : 0.0;
+    case SINUS_OSC_SAW:
+        return (h % 2 ? 1.0 : -1.0) / h;
+    case SINUS_OSC_TRIANGLE:
+        return h % 2 ? (h % 4 == 1 ? 1.0 : -1.0) / ((double)h * h) : 0.0;
+    }
+
+    return 0.0;
+}
+
+/* Additive synthesis, sin (h * x) comes from one cycle of sine at
+ * (h * i) mod OSC_TABLE. Each table is normalized to a peak of 1. */
+static void
+osc_build_tables (void)
+{
+    double *sine = malloc (OSC_TABLE * sizeof (double));
+    double *sum = malloc (OSC_TABLE * sizeof (double));
+    if (!sine || !sum)
+        abort ();
+
+    for (uint32_t i = 0; i < OSC_TABLE; ++i)
+        sine[i] = sin (2.0 * M_PI * i / OSC_TABLE);
+
+    for (uint32_t s = 0; s < OSC_SHAPES; ++s)
+        for (uint32_t level = 0; level < OSC_LEVELS; ++level)
+        {
+            uint32_t harmonics = OSC_MAX_HARMONIC >> level;
+            float *table = osc_tables[s][level];
+            double peak = 0.0;
+
+            memset (sum, 0, OSC_TABLE * sizeof (double));
+            for (uint32_t h = 1; h <= harmonics; ++h)
+            {
+                double a = osc_harmonic ((SinusOscShape)s, h);
+                if (a == 0.0)
+                    continue;
+                for (uint32_t i = 0; i < OSC_TABLE; ++i)
+                    sum[i] += a * sine[(h * i) & (OSC_TABLE - 1)];
+            }
+
+            for (uint32_t i = 0; i < OSC_TABLE; ++i)
+                if (fabs (sum[i]) > peak)
+                    peak = fabs (sum[i]);
+
+            for (uint32_t i = 0; i < OSC_TABLE; ++i)
+                table[i] = (float)(sum[i] / peak);
+            table[OSC_TABLE] = table[0];
+        }
+
+    free (sum);
+    free (sine);
+}
+
+typedef void (*OscFn) (const float *table, uint32_t *phase, uint32_t inc,
+                       float amplitude, float *dst, size_t n, bool add);
+
+static void
+osc_run_scalar (const float *table, uint32_t *phase, uint32_t inc,
+                float amplitude, float *dst, size_t n, bool add)
+{
+    const float frac_scale = 1.0f / (float)(1U << OSC_FRAC_BITS);
+    uint32_t p = *phase;
+
+    for (size_t i = 0; i < n; ++i, p += inc)
+    {
+        uint32_t idx = p >> OSC_FRAC_BITS;
+        float frac = (float)(p & ((1U << OSC_FRAC_BITS) - 1)) * frac_scale;
+        float a = table[idx];
+        float v = (a + frac * (table[idx + 1] - a)) * amplitude;
+
+        dst[i] = add ? dst[i] + v : v;
+    }
+
+    *phase = p;
+}
+
+#ifdef OSC_X86
+
+/* Eight phases at once, both neighbours gathered */
+__attribute__ ((target ("avx2,fma"))) static void
+osc_run_avx2 (const float *table, uint32_t *phase, uint32_t inc,
+              float amplitude, float *dst, size_t n, bool add)
+{
+    uint32_t p = *phase;
+    __m256i ph = _mm256_add_epi32 (
+        _mm256_set1_epi32 ((int32_t)p),
+        _mm256_mullo_epi32 (_mm256_set1_epi32 ((int32_t)inc),
+                            _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7)));
+    __m256i step = _mm256_set1_epi32 ((int32_t)(inc * 8));
+    __m256i frac_mask = _mm256_set1_epi32 ((1 << OSC_FRAC_BITS) - 1);
+    __m256 frac_scale = _mm256_set1_ps (1.0f / (float)(1U << OSC_FRAC_BITS));
+    __m256 amp = _mm256_set1_ps (amplitude);
+    size_t i = 0;
+
+    for (; i + 8 <= n; i += 8)
+    {
+        __m256i idx = _mm256_srli_epi32 (ph, OSC_FRAC_BITS);
+        __m256 frac = _mm256_mul_ps (
+            _mm256_cvtepi32_ps (_mm256_and_si256 (ph, frac_mask)), frac_scale);
+        __m256 a = _mm256_i32gather_ps (table, idx, 4);
+        __m256 b = _mm256_i32gather_ps (table + 1, idx, 4);
+        __m256 v = _mm256_fmadd_ps (frac, _mm256_sub_ps (b, a), a);
+
+        if (add)
+            v = _mm256_fmadd_ps (v, amp, _mm256_loadu_ps (dst + i));
+        else
+            v = _mm256_mul_ps (v, amp);
+        _mm256_storeu_ps (dst + i, v);
+
+        ph = _mm256_add_epi32 (ph, step);
+    }
+
+    p += inc * (uint32_t)i;
+    osc_run_scalar (table, &p, inc, amplitude, dst + i, n - i, add);
+    *phase = p;
+}
+
+#endif
+
+static OscFn osc_run = osc_run_scalar;
+
+/* SINUS_CONVERT_ISA=scalar keeps the scalar kernel here too */
+static void
+osc_init_once (void)
+{
+    osc_build_tables ();
+
+#ifdef OSC_X86
+    const char *cap = getenv ("SINUS_CONVERT_ISA");
+
+    if (cap && (strcmp (cap, "scalar") == 0 || strcmp (cap, "sse2") == 0))
+        return;
+
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+        osc_run = osc_run_avx2;
+#endif
+}
+
+int
+sinus_osc_init (SinusOsc **osc, SinusOscShape shape, uint32_t sample_rate)
+{
+    if (!osc || (uint32_t)shape >= OSC_SHAPES || sample_rate == 0)
+        return -1;
+
+    pthread_once (&osc_once, osc_init_once);
+
+    SinusOsc *o = calloc (1, sizeof (SinusOsc));
+    if (!o)
+        return -1;
+
+    o->shape = shape;
+    o->sample_rate = sample_rate;
+    o->amplitude = 1.0f;
+    o->table = osc_tables[shape][0];
+
+    *osc = o;
+    return 0;
+}
+
+void
+sinus_osc_deinit (SinusOsc *osc)
+{
+    free (osc);
+}
+
+void
+sinus_osc_set_frequency (SinusOsc *osc, float hz)
+{
+    double nyquist = osc->sample_rate / 2.0;
+
+    if (!(hz > 0.0f))
+        hz = 0.0f;
+    if (hz >= nyquist)
+        hz = (float)nyquist;
+
+    /* 2^32 would wrap to 0, Nyquist itself ends up a hair below */
+    double inc = (double)hz / osc->sample_rate * 4294967296.0;
+    osc->inc = inc >= 4294967295.0 ? UINT32_MAX : (uint32_t)inc;
+
+    /* Fewest octaves down that keep the top harmonic under Nyquist */
+    uint32_t level = 0;
+    while (level < OSC_LEVELS - 1
+           && (double)(OSC_MAX_HARMONIC >> level) * hz > nyquist)
+        ++level;
+
+    osc->table = osc_tables[osc->shape][level];
+}
+
+void
+sinus_osc_set_amplitude (SinusOsc *osc, float amplitude)
+{
+    osc->amplitude = amplitude;
+}
+
+void
+sinus_osc_set_phase (SinusOsc *osc, float phase)
+{
+    double cycles = phase - floor (phase);
+    osc->phase = (uint32_t)(cycles * 4294967296.0);
+}
+
+void
+sinus_osc_render_float (SinusOsc *osc, float *dst, uint32_t nframes)
+{
+    osc_run (osc->table, &osc->phase, osc->inc, osc->amplitude, dst, nframes,
+             false);
+}
+
+void
+sinus_osc_mix_float (SinusOsc *osc, float *dst, uint32_t nframes)
+{
+    osc_run (osc->table, &osc->phase, osc->inc, osc->amplitude, dst, nframes,
+             true);
+}
+
+void
+sinus_osc_render (SinusOsc *osc, void *dst, SinusFormat fmt,
+                  uint32_t channels, uint32_t nframes)
+{
+    if (channels == 0 || channels > OSC_CHUNK)
+        return;
+
+    float mono[OSC_CHUNK];
+    float wide[OSC_CHUNK];
+    uint32_t per_pass = OSC_CHUNK / channels;
+    uint8_t *d = dst;
+
+    /* Passes after the first start on a whole U10_P5 group */
+    if (per_pass >= 4)
+        per_pass &= ~3U;
+
+    while (nframes > 0)
+    {
+        uint32_t n = nframes < per_pass ? nframes : per_pass;
+        float *src = mono;
+
+        sinus_osc_render_float (osc, mono, n);
+
+        if (channels > 1)
+        {
+            for (uint32_t i = 0; i < n; ++i)
+                for (uint32_t c = 0; c < channels; ++c)
+                    wide[i * channels + c] = mono[i];
+            src = wide;
+        }
+
+        sinus_convert_from_float (d, fmt, src, (size_t)n * channels);
+        d += sinus_format_bytes (fmt, (size_t)n * channels);
+        nframes -= n;
+    }
+}
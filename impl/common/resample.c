@@ -0,0 +1,327 @@
+#include <sinus_resample.h>
+
+#include <math.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define RESAMPLE_X86 1
+#include <immintrin.h>
+#endif
+
+#define RESAMPLE_PI 3.14159265358979323846
+
+#define RESAMPLE_MAX_PHASES 2048U
+#define RESAMPLE_CHUNK 512U // input frames taken in between compactions
+
+struct SinusResampler
+{
+    uint32_t channels;
+    uint32_t taps; // multiple of 8
+
+    // in_rate/out_rate reduced to in_step/out_step
+    uint32_t in_step;
+    uint32_t out_step;
+    uint32_t phases;
+
+    float *filter; // phases * taps, one row per phase
+
+    // planar input history, channels * hist_cap
+    float *hist;
+    uint32_t hist_cap;
+    uint32_t hist_frames;
+
+    // position of the next output: hist[ipos] + frac / out_step
+    uint32_t ipos;
+    uint32_t frac;
+};
+
+typedef float (*DotFn) (const float *a, const float *b, uint32_t n);
+
+static float
+dot_scalar (const float *a, const float *b, uint32_t n)
+{
+    float acc = 0.0f;
+    for (uint32_t i = 0; i < n; ++i)
+        acc += a[i] * b[i];
+    return acc;
+}
+
+#ifdef RESAMPLE_X86
+
+__attribute__ ((target ("sse2"))) static float
+dot_sse2 (const float *a, const float *b, uint32_t n)
+{
+    __m128 acc0 = _mm_setzero_ps ();
+    __m128 acc1 = _mm_setzero_ps ();
+
+    for (uint32_t i = 0; i < n; i += 8)
+    {
+        acc0 = _mm_add_ps (acc0, _mm_mul_ps (_mm_loadu_ps (a + i),
+                                             _mm_loadu_ps (b + i)));
+        acc1 = _mm_add_ps (acc1, _mm_mul_ps (_mm_loadu_ps (a + i + 4),
+                                             _mm_loadu_ps (b + i + 4)));
+    }
+
+    __m128 acc = _mm_add_ps (acc0, acc1);
+    acc = _mm_add_ps (acc, _mm_movehl_ps (acc, acc));
+    acc = _mm_add_ss (acc, _mm_shuffle_ps (acc, acc, 1));
+    return _mm_cvtss_f32 (acc);
+}
+
+__attribute__ ((target ("avx2,fma"))) static float
+dot_avx2 (const float *a, const float *b, uint32_t n)
+{
+    __m256 acc = _mm256_setzero_ps ();
+
+    for (uint32_t i = 0; i < n; i += 8)
+        acc = _mm256_fmadd_ps (_mm256_loadu_ps (a + i), _mm256_loadu_ps (b + i),
+                               acc);
+
+    __m128 sum = _mm_add_ps (_mm256_castps256_ps128 (acc),
+                             _mm256_extractf128_ps (acc, 1));
+    sum = _mm_add_ps (sum, _mm_movehl_ps (sum, sum));
+    sum = _mm_add_ss (sum, _mm_shuffle_ps (sum, sum, 1));
+    return _mm_cvtss_f32 (sum);
+}
+
+#endif
+
+static DotFn dot = dot_scalar;
+static pthread_once_t resample_kernels_once = PTHREAD_ONCE_INIT;
+
+/* Once, through resample_kernels_once: resamplers on other threads read dot
+ * unlocked */
+static void
+resample_pick_kernels (void)
+{
+#ifdef RESAMPLE_X86
+    const char *cap = getenv ("SINUS_CONVERT_ISA");
+
+    if (cap && strcmp (cap, "scalar") == 0)
+        return;
+
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("sse2"))
+        dot = dot_sse2;
+
+    if ((!cap || strcmp (cap, "sse2") != 0)
+        && __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma"))
+        dot = dot_avx2;
+#endif
+}
+
+static uint32_t
+gcd (uint32_t a, uint32_t b)
+{
+    while (b)
+    {
+        uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* Blackman-windowed sinc, one normalized row per phase */
+static void
+resample_design (SinusResampler *r, double rolloff)
+{
+    double half = r->taps / 2.0;
+    double cutoff = rolloff;
+
+    /* Downsampling: keep below the output Nyquist */
+    if (r->out_step < r->in_step)
+        cutoff *= (double)r->out_step / r->in_step;
+
+    for (uint32_t p = 0; p < r->phases; ++p)
+    {
+        float *row = r->filter + (size_t)p * r->taps;
+        double f = (double)p / r->phases;
+        double sum = 0.0;
+
+        for (uint32_t k = 0; k < r->taps; ++k)
+        {
+            double x = (double)k - (half - 1.0) - f;
+            double t = RESAMPLE_PI * cutoff * x;
+            double sinc = x == 0.0 ? 1.0 : sin (t) / t;
+            double w = 0.42 + 0.5 * cos (RESAMPLE_PI * x / half)
+                       + 0.08 * cos (2.0 * RESAMPLE_PI * x / half);
+
+            row[k] = (float)(cutoff * sinc * w);
+            sum += row[k];
+        }
+
+        for (uint32_t k = 0; k < r->taps; ++k)
+            row[k] = (float)(row[k] / sum);
+    }
+}
+
+int
+sinus_resampler_init (SinusResampler **_r, uint32_t channels,
+                      uint32_t in_rate, uint32_t out_rate,
+                      SinusResampleQuality quality)
+{
+    static const uint32_t taps[] = {
+        [SINUS_RESAMPLE_FAST] = 8,
+        [SINUS_RESAMPLE_MEDIUM] = 32,
+        [SINUS_RESAMPLE_BEST] = 64,
+    };
+    static const double rolloff[] = {
+        [SINUS_RESAMPLE_FAST] = 0.80,
+        [SINUS_RESAMPLE_MEDIUM] = 0.91,
+        [SINUS_RESAMPLE_BEST] = 0.95,
+    };
+
+    if (!_r || channels == 0 || in_rate == 0 || out_rate == 0
+        || (unsigned)quality > SINUS_RESAMPLE_BEST)
+        return -1;
+
+    SinusResampler *r = calloc (1, sizeof (SinusResampler));
+    if (!r)
+        return -1;
+
+    uint32_t g = gcd (in_rate, out_rate);
+
+    r->channels = channels;
+    r->taps = taps[quality];
+    r->in_step = in_rate / g;
+    r->out_step = out_rate / g;
+
+    /* Downsampling stretches the filter by the ratio, keep its shape */
+    if (r->in_step > r->out_step)
+    {
+        uint32_t stretch = (r->in_step + r->out_step - 1) / r->out_step;
+        r->taps *= stretch;
+    }
+    r->phases = r->out_step < RESAMPLE_MAX_PHASES ? r->out_step
+                                                  : RESAMPLE_MAX_PHASES;
+    r->hist_cap = r->taps + RESAMPLE_CHUNK;
+
+    r->filter = malloc ((size_t)r->phases * r->taps * sizeof (float));
+    r->hist = malloc ((size_t)r->hist_cap * channels * sizeof (float));
+    if (!r->filter || !r->hist)
+    {
+        sinus_resampler_deinit (r);
+        return -1;
+    }
+
+    pthread_once (&resample_kernels_once, resample_pick_kernels);
+    resample_design (r, rolloff[quality]);
+    sinus_resampler_reset (r);
+
+    *_r = r;
+    return 0;
+}
+
+void
+sinus_resampler_deinit (SinusResampler *r)
+{
+    if (!r)
+        return;
+
+    free (r->filter);
+    free (r->hist);
+    free (r);
+}
+
+void
+sinus_resampler_reset (SinusResampler *r)
+{
+    /* Start with half a filter of silence so output 0 lines up with
+     * input 0 */
+    r->hist_frames = r->taps / 2 - 1;
+    r->ipos = r->hist_frames;
+    r->frac = 0;
+
+    for (uint32_t c = 0; c < r->channels; ++c)
+        memset (r->hist + (size_t)c * r->hist_cap, 0,
+                r->hist_frames * sizeof (float));
+}
+
+uint32_t
+sinus_resampler_latency (const SinusResampler *r)
+{
+    return r->taps / 2;
+}
+
+/* Drop history no future output can reach */
+static void
+resample_compact (SinusResampler *r)
+{
+    uint32_t drop = r->ipos - (r->taps / 2 - 1);
+    if (drop == 0)
+        return;
+
+    /* Big downsampling steps can jump past everything we have */
+    if (drop > r->hist_frames)
+        drop = r->hist_frames;
+
+    uint32_t keep = r->hist_frames - drop;
+    for (uint32_t c = 0; c < r->channels; ++c)
+    {
+        float *h = r->hist + (size_t)c * r->hist_cap;
+        memmove (h, h + drop, keep * sizeof (float));
+    }
+
+    r->hist_frames = keep;
+    r->ipos -= drop;
+}
+
+void
+sinus_resampler_process (SinusResampler *r, const float *in,
+                         uint32_t *in_frames, float *out, uint32_t *out_frames)
+{
+    const uint32_t half = r->taps / 2;
+    uint32_t in_left = *in_frames;
+    uint32_t out_done = 0;
+
+    for (;;)
+    {
+        while (out_done < *out_frames && r->ipos + half < r->hist_frames)
+        {
+            uint32_t phase = (uint32_t)((uint64_t)r->frac * r->phases
+                                        / r->out_step);
+            const float *row = r->filter + (size_t)phase * r->taps;
+            uint32_t start = r->ipos - (half - 1);
+
+            for (uint32_t c = 0; c < r->channels; ++c)
+            {
+                const float *h = r->hist + (size_t)c * r->hist_cap + start;
+                out[(size_t)out_done * r->channels + c] = dot (h, row, r->taps);
+            }
+            ++out_done;
+
+            r->frac += r->in_step;
+            r->ipos += r->frac / r->out_step;
+            r->frac %= r->out_step;
+        }
+
+        resample_compact (r);
+
+        if (out_done == *out_frames || in_left == 0)
+            break;
+
+        uint32_t n = r->hist_cap - r->hist_frames;
+        if (n > in_left)
+            n = in_left;
+
+        for (uint32_t c = 0; c < r->channels; ++c)
+        {
+            float *h = r->hist + (size_t)c * r->hist_cap + r->hist_frames;
+            for (uint32_t i = 0; i < n; ++i)
+                h[i] = in[(size_t)i * r->channels + c];
+        }
+
+        r->hist_frames += n;
+        in += (size_t)n * r->channels;
+        in_left -= n;
+    }
+
+    *in_frames -= in_left;
+    *out_frames = out_done;
+}
@@ -0,0 +1,158 @@
+#ifndef _SINUS_RING_H
+#define _SINUS_RING_H
+
+/*
+ * Lock-free single-producer/single-consumer ring of fixed-size frames.
+ *
+ * head is only written by the producer, tail only by the consumer; they live
+ * on separate cache lines so the two sides don't bounce a line between cores
+ * on every frame. Capacity is a power of two, indices wrap freely and are
+ * masked on access.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SINUS_CACHE_LINE 64
+
+typedef struct sinus_ring_s
+{
+    uint32_t head __attribute__ ((aligned (SINUS_CACHE_LINE)));
+    uint32_t tail __attribute__ ((aligned (SINUS_CACHE_LINE)));
+
+    uint8_t *data __attribute__ ((aligned (SINUS_CACHE_LINE)));
+    uint32_t mask; // capacity - 1
+    uint32_t frame_bytes;
+} SinusRing;
+
+static inline int
+sinus_ring_init (SinusRing *ring, uint32_t min_frames, uint32_t frame_bytes)
+{
+    uint32_t capacity = 1;
+    while (capacity < min_frames)
+    {
+        if (capacity & 0x80000000U)
+            return -1;
+        capacity <<= 1;
+    }
+
+    ring->data = malloc ((size_t)capacity * frame_bytes);
+    if (!ring->data)
+        return -1;
+
+    ring->head = 0;
+    ring->tail = 0;
+    ring->mask = capacity - 1;
+    ring->frame_bytes = frame_bytes;
+    return 0;
+}
+
+static inline void
+sinus_ring_deinit (SinusRing *ring)
+{
+    free (ring->data);
+    ring->data = NULL;
+}
+
+/* Only when neither side is running */
+static inline void
+sinus_ring_reset (SinusRing *ring)
+{
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+static inline uint32_t
+sinus_ring_capacity (const SinusRing *ring)
+{
+    return ring->mask + 1;
+}
+
+static inline uint32_t
+sinus_ring_buffered (const SinusRing *ring)
+{
+    uint32_t head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+    return head - tail;
+}
+
+static inline uint32_t
+sinus_ring_free (const SinusRing *ring)
+{
+    return sinus_ring_capacity (ring) - sinus_ring_buffered (ring);
+}
+
+/* Producer: contiguous writable region, at most *nframes long. */
+static inline void *
+sinus_ring_write_region (SinusRing *ring, uint32_t *nframes)
+{
+    uint32_t head = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n (&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t offset = head & ring->mask;
+    uint32_t n = sinus_ring_capacity (ring) - (head - tail);
+
+    if (n > sinus_ring_capacity (ring) - offset)
+        n = sinus_ring_capacity (ring) - offset;
+    if (*nframes > n)
+        *nframes = n;
+
+    return ring->data + (size_t)offset * ring->frame_bytes;
+}
+
+/* Producer: publish nframes written into the region */
+static inline void
+sinus_ring_commit (SinusRing *ring, uint32_t nframes)
+{
+    uint32_t head = __atomic_load_n (&ring->head, __ATOMIC_RELAXED);
+    __atomic_store_n (&ring->head, head + nframes, __ATOMIC_RELEASE);
+}
+
+/* Producer: copy as many frames as fit, returns the number copied. */
+static inline uint32_t
+sinus_ring_write (SinusRing *ring, const void *frames, uint32_t nframes)
+{
+    const uint8_t *src = frames;
+    uint32_t written = 0;
+
+    while (written < nframes)
+    {
+        uint32_t n = nframes - written;
+        void *dst = sinus_ring_write_region (ring, &n);
+        if (n == 0)
+            break;
+
+        memcpy (dst, src, (size_t)n * ring->frame_bytes);
+        src += (size_t)n * ring->frame_bytes;
+        written += n;
+        sinus_ring_commit (ring, n);
+    }
+
+    return written;
+}
+
+/* Consumer: contiguous readable region, returns its length in frames. */
+static inline uint32_t
+sinus_ring_read_region (SinusRing *ring, const void **frames)
+{
+    uint32_t tail = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n (&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t offset = tail & ring->mask;
+    uint32_t n = head - tail;
+
+    if (n > sinus_ring_capacity (ring) - offset)
+        n = sinus_ring_capacity (ring) - offset;
+
+    *frames = ring->data + (size_t)offset * ring->frame_bytes;
+    return n;
+}
+
+/* Consumer: release nframes from the read region */
+static inline void
+sinus_ring_consume (SinusRing *ring, uint32_t nframes)
+{
+    uint32_t tail = __atomic_load_n (&ring->tail, __ATOMIC_RELAXED);
+    __atomic_store_n (&ring->tail, tail + nframes, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef _SINUS_STATS_H
+#define _SINUS_STATS_H
+
+/*
+ * SinusStats bookkeeping shared by the backends.
+ *
+ * Every update is a relaxed atomic add on its own counter: writers never
+ * wait on each other or on readers, and sinus_stats_get only does relaxed
+ * loads. A snapshot is not one consistent instant, each counter is.
+ */
+
+#include <sinus.h>
+
+#include <stdint.h>
+#include <time.h>
+
+static inline uint64_t
+sinus_stats_now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void
+sinus_stats_add (uint64_t *counter, uint64_t n)
+{
+    __atomic_fetch_add (counter, n, __ATOMIC_RELAXED);
+}
+
+static inline void
+sinus_stats_record (uint64_t *histogram, uint64_t value)
+{
+    uint32_t bucket = value ? 64 - (uint32_t)__builtin_clzll (value) : 0;
+    if (bucket >= SINUS_STATS_BUCKETS)
+        bucket = SINUS_STATS_BUCKETS - 1;
+
+    sinus_stats_add (&histogram[bucket], 1);
+}
+
+/* Outcome of one write call that was asked for requested frames */
+static inline void
+sinus_stats_write (SinusStats *stats, uint64_t requested, sinus_ssize_t written,
+                   uint64_t elapsed_ns, uint64_t fill_frames)
+{
+    if (written > 0)
+        sinus_stats_add (&stats->frames_written, (uint64_t)written);
+
+    if (written <= 0)
+        sinus_stats_add (&stats->zero_writes, 1);
+    else if ((uint64_t)written < requested)
+        sinus_stats_add (&stats->short_writes, 1);
+
+    sinus_stats_record (stats->write_ns, elapsed_ns);
+    sinus_stats_record (stats->fill_frames, fill_frames);
+}
+
+static inline void
+sinus_stats_copy (SinusStats *dst, SinusStats *src)
+{
+    dst->underruns = __atomic_load_n (&src->underruns, __ATOMIC_RELAXED);
+    dst->suspends = __atomic_load_n (&src->suspends, __ATOMIC_RELAXED);
+    dst->recoveries = __atomic_load_n (&src->recoveries, __ATOMIC_RELAXED);
+    dst->frames_written
+        = __atomic_load_n (&src->frames_written, __ATOMIC_RELAXED);
+    dst->short_writes = __atomic_load_n (&src->short_writes, __ATOMIC_RELAXED);
+    dst->zero_writes = __atomic_load_n (&src->zero_writes, __ATOMIC_RELAXED);
+    dst->overruns = __atomic_load_n (&src->overruns, __ATOMIC_RELAXED);
+    dst->frames_read = __atomic_load_n (&src->frames_read, __ATOMIC_RELAXED);
+
+    for (uint32_t i = 0; i < SINUS_STATS_BUCKETS; ++i)
+    {
+        dst->write_ns[i]
+            = __atomic_load_n (&src->write_ns[i], __ATOMIC_RELAXED);
+        dst->fill_frames[i]
+            = __atomic_load_n (&src->fill_frames[i], __ATOMIC_RELAXED);
+    }
+}
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef _SINUS_SUBMIT_H
+#define _SINUS_SUBMIT_H
+
+/*
+ * Submission queue for sinus_submit/sinus_reap, shared by the backends.
+ *
+ * One fixed array of SINUS_SUBMIT_MAX slots, indices wrap freely:
+ *   [reaped, head) done, waiting for sinus_reap,
+ *   [head, tail)   submitted, the backend thread works on head.
+ * A slot is only reused once reaped, so completions can never be lost and
+ * the caller's buffers are never referenced after their completion.
+ *
+ * The backend thread is the only one to advance head and only touches the
+ * head slot's progress, so it can copy from a slot without holding the
+ * lock; everything else goes through it. event is an eventfd that counts
+ * completions not yet reaped.
+ */
+
+#include <sinus.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct sinus_submit_slot_s
+{
+    const void *frames;
+    uint32_t nframes;
+    uint32_t done; // frames the device took so far
+    void *cookie;
+} SinusSubmitSlot;
+
+typedef struct sinus_submit_queue_s
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // signalled on submit, for the backend thread
+    int event;
+
+    uint32_t reaped;
+    uint32_t head;
+    uint32_t tail;
+    SinusSubmitSlot slots[SINUS_SUBMIT_MAX];
+} SinusSubmitQueue;
+
+static inline int
+sinus_submit_init (SinusSubmitQueue *q)
+{
+    q->event = eventfd (0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (q->event < 0)
+        return -1;
+
+    pthread_condattr_t attr;
+    pthread_condattr_init (&attr);
+    pthread_condattr_setclock (&attr, CLOCK_MONOTONIC);
+    pthread_cond_init (&q->cond, &attr);
+    pthread_condattr_destroy (&attr);
+    pthread_mutex_init (&q->lock, NULL);
+
+    q->reaped = 0;
+    q->head = 0;
+    q->tail = 0;
+    return 0;
+}
+
+static inline void
+sinus_submit_deinit (SinusSubmitQueue *q)
+{
+    pthread_cond_destroy (&q->cond);
+    pthread_mutex_destroy (&q->lock);
+    close (q->event);
+}
+
+/* Returns -1 when every slot is submitted or waiting to be reaped */
+static inline int
+sinus_submit_push (SinusSubmitQueue *q, const void *frames, uint32_t nframes,
+                   void *cookie)
+{
+    pthread_mutex_lock (&q->lock);
+
+    if (q->tail - q->reaped == SINUS_SUBMIT_MAX)
+    {
+        pthread_mutex_unlock (&q->lock);
+        return -1;
+    }
+
+    SinusSubmitSlot *slot = &q->slots[q->tail % SINUS_SUBMIT_MAX];
+    slot->frames = frames;
+    slot->nframes = nframes;
+    slot->done = 0;
+    slot->cookie = cookie;
+    ++q->tail;
+
+    pthread_cond_signal (&q->cond);
+    pthread_mutex_unlock (&q->lock);
+    return 0;
+}
+
+/* Backend thread: the rest of the head slot, waiting up to timeout_ns for
+ * one to be submitted. Returns false if there is none. */
+static inline bool
+sinus_submit_peek (SinusSubmitQueue *q, uint32_t frame_bytes,
+                   const void **frames, uint32_t *nframes, uint64_t timeout_ns)
+{
+    pthread_mutex_lock (&q->lock);
+
+    if (q->head == q->tail && timeout_ns > 0)
+    {
+        struct timespec ts;
+        clock_gettime (CLOCK_MONOTONIC, &ts);
+
+        uint64_t ns = (uint64_t)ts.tv_nsec + timeout_ns;
+        ts.tv_sec += (time_t)(ns / 1000000000ULL);
+        ts.tv_nsec = (long)(ns % 1000000000ULL);
+        pthread_cond_timedwait (&q->cond, &q->lock, &ts);
+    }
+
+    bool any = q->head != q->tail;
+    if (any)
+    {
+        SinusSubmitSlot *slot = &q->slots[q->head % SINUS_SUBMIT_MAX];
+        *frames = (const uint8_t *)slot->frames
+                  + (size_t)slot->done * frame_bytes;
+        *nframes = slot->nframes - slot->done;
+    }
+
+    pthread_mutex_unlock (&q->lock);
+    return any;
+}
+
+/* Called with q->lock held */
+static inline void
+sinus_submit_complete_head (SinusSubmitQueue *q)
+{
+    ++q->head;
+    eventfd_write (q->event, 1);
+}
+
+/* Backend thread: nframes of the head slot reached the device */
+static inline void
+sinus_submit_advance (SinusSubmitQueue *q, uint32_t nframes)
+{
+    pthread_mutex_lock (&q->lock);
+
+    SinusSubmitSlot *slot = &q->slots[q->head % SINUS_SUBMIT_MAX];
+    slot->done += nframes;
+    if (slot->done >= slot->nframes)
+        sinus_submit_complete_head (q);
+
+    pthread_mutex_unlock (&q->lock);
+}
+
+/* Completes everything submitted with what was taken of it so far. Only
+ * while the backend thread is stopped. */
+static inline void
+sinus_submit_flush (SinusSubmitQueue *q)
+{
+    pthread_mutex_lock (&q->lock);
+    while (q->head != q->tail)
+        sinus_submit_complete_head (q);
+    pthread_mutex_unlock (&q->lock);
+}
+
+/* Submitted and not completed yet, in frames */
+static inline uint64_t
+sinus_submit_pending (SinusSubmitQueue *q)
+{
+    uint64_t frames = 0;
+
+    pthread_mutex_lock (&q->lock);
+    for (uint32_t i = q->head; i != q->tail; ++i)
+    {
+        const SinusSubmitSlot *slot = &q->slots[i % SINUS_SUBMIT_MAX];
+        frames += slot->nframes - slot->done;
+    }
+    pthread_mutex_unlock (&q->lock);
+
+    return frames;
+}
+
+static inline int
+sinus_submit_reap (SinusSubmitQueue *q, SinusCompletion *completions,
+                   uint32_t max)
+{
+    uint32_t n = 0;
+
+    pthread_mutex_lock (&q->lock);
+    for (; n < max && q->reaped != q->head; ++n, ++q->reaped)
+    {
+        const SinusSubmitSlot *slot = &q->slots[q->reaped % SINUS_SUBMIT_MAX];
+        completions[n].cookie = slot->cookie;
+        completions[n].nframes = slot->done;
+    }
+
+    /* Readable exactly while completions wait */
+    eventfd_t ignored;
+    eventfd_read (q->event, &ignored);
+    if (q->reaped != q->head)
+        eventfd_write (q->event, q->head - q->reaped);
+    pthread_mutex_unlock (&q->lock);
+
+    return (int)n;
+}
+
+#endif
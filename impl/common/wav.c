@@ -0,0 +1,473 @@
+#define _GNU_SOURCE
+
+#include <sinus_convert.h>
+#include <sinus_wav.h>
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define WAV_FORMAT_PCM 0x0001
+#define WAV_FORMAT_FLOAT 0x0003
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+#define WAV_RF64_SIZE 0xFFFFFFFFU // 32 bit size that defers to ds64
+#define WAV_CHUNK 256U // frames remapped at a time by sinus_source_wav_read
+
+struct SinusSourceWav
+{
+    void *map;
+    size_t map_bytes;
+
+    const uint8_t *data; // first frame, inside map
+    uint64_t frames;
+    uint64_t pos; // read position, in frames
+
+    SinusFormat fmt;
+    uint32_t channels;
+    uint32_t sample_rate;
+    uint32_t frame_bytes;
+
+    // channel remapping: WAV_CHUNK frames of the file's channels, then
+    // WAV_CHUNK frames of scratch_channels
+    float *scratch;
+    uint32_t scratch_channels;
+};
+
+/* Where a container keeps its fmt and data chunk bodies */
+typedef struct
+{
+    const uint8_t *fmt;
+    uint64_t fmt_bytes;
+    const uint8_t *data;
+    uint64_t data_bytes;
+} WavChunks;
+
+/* Wave64 chunk GUIDs are the FOURCC followed by this, except for riff */
+static const uint8_t w64_suffix[12] = {
+    0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A,
+};
+static const uint8_t w64_riff[16] = {
+    'r',  'i',  'f',  'f',  0x2E, 0x91, 0xCF, 0x11,
+    0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00,
+};
+
+static uint16_t
+rd16 (const uint8_t *p)
+{
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t
+rd32 (const uint8_t *p)
+{
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16)
+           | ((uint32_t)p[3] << 24);
+}
+
+static uint64_t
+rd64 (const uint8_t *p)
+{
+    return (uint64_t)rd32 (p) | ((uint64_t)rd32 (p + 4) << 32);
+}
+
+static bool
+w64_is (const uint8_t *guid, const char fourcc[4])
+{
+    return memcmp (guid, fourcc, 4) == 0
+           && memcmp (guid + 4, w64_suffix, sizeof (w64_suffix)) == 0;
+}
+
+/* RIFF, RF64 and BW64: 8 byte chunk headers, bodies padded to even sizes.
+ * The 64 bit variants put the real data size in a leading ds64 chunk. */
+static bool
+wav_parse_riff (const uint8_t *p, size_t n, bool rf64, WavChunks *c)
+{
+    uint64_t ds64_data_bytes = 0;
+    size_t off = 12;
+
+    while (n - off >= 8)
+    {
+        const uint8_t *id = p + off;
+        uint64_t size = rd32 (p + off + 4);
+        off += 8;
+
+        if (rf64 && memcmp (id, "ds64", 4) == 0 && size >= 16
+            && n - off >= 16)
+        {
+            ds64_data_bytes = rd64 (p + off + 8);
+        }
+        else if (memcmp (id, "fmt ", 4) == 0)
+        {
+            c->fmt = p + off;
+            c->fmt_bytes = size;
+        }
+        else if (memcmp (id, "data", 4) == 0)
+        {
+            if (rf64 && size == WAV_RF64_SIZE)
+                size = ds64_data_bytes;
+
+            c->data = p + off;
+            c->data_bytes = size;
+            return c->fmt != NULL;
+        }
+
+        if (size + (size & 1) > n - off)
+            break;
+        off += (size_t)(size + (size & 1));
+    }
+
+    return false;
+}
+
+/* Wave64: 16 byte GUID and 64 bit size (header included) per chunk,
+ * chunks aligned to 8 bytes */
+static bool
+wav_parse_w64 (const uint8_t *p, size_t n, WavChunks *c)
+{
+    size_t off = 40; // riff GUID, file size, wave GUID
+
+    while (n - off >= 24)
+    {
+        const uint8_t *guid = p + off;
+        uint64_t size = rd64 (p + off + 16);
+        if (size < 24)
+            break;
+
+        if (w64_is (guid, "fmt "))
+        {
+            c->fmt = p + off + 24;
+            c->fmt_bytes = size - 24;
+        }
+        else if (w64_is (guid, "data"))
+        {
+            c->data = p + off + 24;
+            c->data_bytes = size - 24;
+            return c->fmt != NULL;
+        }
+
+        uint64_t next = (size + 7) & ~(uint64_t)7;
+        if (next > n - off)
+            break;
+        off += (size_t)next;
+    }
+
+    return false;
+}
+
+static SinusFormat
+wav_parse_fmt (SinusSourceWav *wav, const uint8_t *fmt, uint64_t bytes)
+{
+    if (bytes < 16)
+        return SINUS_FORMAT_UNKNOWN;
+
+    uint16_t tag = rd16 (fmt);
+    wav->channels = rd16 (fmt + 2);
+    wav->sample_rate = rd32 (fmt + 4);
+    wav->frame_bytes = rd16 (fmt + 12);
+    uint16_t bits = rd16 (fmt + 14);
+
+    /* The SubFormat GUID starts with the actual format tag */
+    if (tag == WAV_FORMAT_EXTENSIBLE && bytes >= 26)
+        tag = rd16 (fmt + 24);
+
+    SinusFormat f = SINUS_FORMAT_UNKNOWN;
+
+    if (tag == WAV_FORMAT_PCM)
+    {
+        switch (bits)
+        {
+        case 8:
+            f = SINUS_FORMAT_U8;
+            break;
+        case 16:
+            f = SINUS_FORMAT_S16;
+            break;
+        case 24:
+            f = SINUS_FORMAT_S24_P3;
+            break;
+        case 32:
+            f = SINUS_FORMAT_S32;
+            break;
+        }
+    }
+    else if (tag == WAV_FORMAT_FLOAT)
+    {
+        if (bits == 32)
+            f = SINUS_FORMAT_FLOAT;
+        else if (bits == 64)
+            f = SINUS_FORMAT_FLOAT64;
+    }
+
+    if (wav->channels == 0 || wav->sample_rate == 0
+        || wav->frame_bytes
+               != (uint32_t)sinus_format_to_size (f) * wav->channels)
+        return SINUS_FORMAT_UNKNOWN;
+
+    return f;
+}
+
+static int
+wav_parse (SinusSourceWav *wav)
+{
+    const uint8_t *p = wav->map;
+    size_t n = wav->map_bytes;
+    WavChunks c = { 0 };
+    bool found = false;
+
+    if (n >= 12 && memcmp (p + 8, "WAVE", 4) == 0)
+    {
+        if (memcmp (p, "RIFF", 4) == 0)
+            found = wav_parse_riff (p, n, false, &c);
+        else if (memcmp (p, "RF64", 4) == 0 || memcmp (p, "BW64", 4) == 0)
+            found = wav_parse_riff (p, n, true, &c);
+    }
+    else if (n >= 40 && memcmp (p, w64_riff, sizeof (w64_riff)) == 0
+             && w64_is (p + 24, "wave"))
+    {
+        found = wav_parse_w64 (p, n, &c);
+    }
+
+    if (!found || c.fmt_bytes > (uint64_t)(p + n - c.fmt))
+        return -1;
+
+    wav->fmt = wav_parse_fmt (wav, c.fmt, c.fmt_bytes);
+    if (wav->fmt == SINUS_FORMAT_UNKNOWN)
+        return -1;
+
+    /* Recordings that were cut short, or are still being written, claim
+     * more data than the file has */
+    uint64_t available = (uint64_t)(p + n - c.data);
+    if (c.data_bytes > available)
+        c.data_bytes = available;
+
+    wav->data = c.data;
+    wav->frames = c.data_bytes / wav->frame_bytes;
+    return 0;
+}
+
+int
+sinus_source_wav_open (SinusSourceWav **_wav, const char *path)
+{
+    if (!_wav || !path)
+        return -1;
+
+    int fd = open (path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+
+    struct stat st;
+    if (fstat (fd, &st) < 0 || st.st_size < 12
+        || (uint64_t)st.st_size > SIZE_MAX)
+    {
+        close (fd);
+        return -1;
+    }
+
+    size_t bytes = (size_t)st.st_size;
+    void *map = mmap (NULL, bytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    close (fd); // the mapping keeps the file
+    if (map == MAP_FAILED)
+        return -1;
+
+    /* Read-ahead, and pages behind the read position can go early */
+    madvise (map, bytes, MADV_SEQUENTIAL);
+
+    SinusSourceWav *wav = calloc (1, sizeof (SinusSourceWav));
+    if (!wav)
+    {
+        munmap (map, bytes);
+        return -1;
+    }
+
+    wav->map = map;
+    wav->map_bytes = bytes;
+
+    if (wav_parse (wav) < 0)
+    {
+        sinus_source_wav_close (wav);
+        return -1;
+    }
+
+    *_wav = wav;
+    return 0;
+}
+
+void
+sinus_source_wav_close (SinusSourceWav *wav)
+{
+    if (!wav)
+        return;
+
+    munmap (wav->map, wav->map_bytes);
+    free (wav->scratch);
+    free (wav);
+}
+
+SinusFormat
+sinus_source_wav_get_format (SinusSourceWav *wav)
+{
+    return wav->fmt;
+}
+
+uint32_t
+sinus_source_wav_get_channels (SinusSourceWav *wav)
+{
+    return wav->channels;
+}
+
+uint32_t
+sinus_source_wav_get_sample_rate (SinusSourceWav *wav)
+{
+    return wav->sample_rate;
+}
+
+uint64_t
+sinus_source_wav_get_n_frames (SinusSourceWav *wav)
+{
+    return wav->frames;
+}
+
+uint64_t
+sinus_source_wav_get_n_frames_left (SinusSourceWav *wav)
+{
+    return wav->frames - wav->pos;
+}
+
+int
+sinus_source_wav_seek (SinusSourceWav *wav, uint64_t frame)
+{
+    if (!wav || frame > wav->frames)
+        return -1;
+
+    wav->pos = frame;
+    return 0;
+}
+
+uint32_t
+sinus_source_wav_frames (SinusSourceWav *wav, const void **frames,
+                         uint32_t nframes)
+{
+    if (!wav || !frames)
+        return 0;
+
+    uint64_t left = wav->frames - wav->pos;
+    if (nframes > left)
+        nframes = (uint32_t)left;
+
+    *frames = wav->data + wav->pos * wav->frame_bytes;
+    wav->pos += nframes;
+    return nframes;
+}
+
+static bool
+wav_scratch (SinusSourceWav *wav, uint32_t channels)
+{
+    if (wav->scratch && wav->scratch_channels >= channels)
+        return true;
+
+    size_t floats = (size_t)WAV_CHUNK * (wav->channels + channels);
+    float *scratch = realloc (wav->scratch, floats * sizeof (float));
+    if (!scratch)
+        return false;
+
+    wav->scratch = scratch;
+    wav->scratch_channels = channels;
+    return true;
+}
+
+sinus_ssize_t
+sinus_source_wav_read (SinusSourceWav *wav, void *dst, SinusFormat fmt,
+                       uint32_t channels, uint32_t nframes)
+{
+    if (!wav || !dst || channels == 0 || sinus_format_to_size (fmt) == 0)
+        return -1;
+
+    const void *src;
+
+    if (channels == wav->channels)
+    {
+        uint32_t n = sinus_source_wav_frames (wav, &src, nframes);
+        sinus_convert (dst, fmt, src, wav->fmt, (size_t)n * channels);
+        return n;
+    }
+
+    if (!wav_scratch (wav, channels))
+        return -1;
+
+    float *in = wav->scratch;
+    float *out = wav->scratch + (size_t)WAV_CHUNK * wav->channels;
+    size_t out_frame_bytes = (size_t)sinus_format_to_size (fmt) * channels;
+    uint8_t *d = dst;
+    uint32_t done = 0;
+
+    while (done < nframes)
+    {
+        uint32_t n = nframes - done;
+        if (n > WAV_CHUNK)
+            n = WAV_CHUNK;
+
+        n = sinus_source_wav_frames (wav, &src, n);
+        if (n == 0)
+            break;
+
+        sinus_convert_to_float (in, src, wav->fmt, (size_t)n * wav->channels);
+
+        for (uint32_t i = 0; i < n; ++i)
+            for (uint32_t c = 0; c < channels; ++c)
+            {
+                uint32_t from = c < wav->channels ? c : wav->channels - 1;
+                out[(size_t)i * channels + c]
+                    = in[(size_t)i * wav->channels + from];
+            }
+
+        sinus_convert_from_float (d, fmt, out, (size_t)n * channels);
+        d += (size_t)n * out_frame_bytes;
+        done += n;
+    }
+
+    return done;
+}
+
+sinus_ssize_t
+sinus_source_wav_write (SinusSourceWav *wav, SinusContext *sc)
+{
+    if (!wav || !sc)
+        return -1;
+
+    sinus_ssize_t free_frames = sinus_frames_get_n_frames_free (sc);
+    if (free_frames <= 0)
+        return free_frames;
+
+    uint32_t want = free_frames > UINT32_MAX ? UINT32_MAX
+                                             : (uint32_t)free_frames;
+    SinusFormat fmt = sinus_info_get_format (sc);
+    uint32_t channels = sinus_info_get_channels (sc);
+
+    if (fmt == wav->fmt && channels == wav->channels)
+    {
+        const void *frames;
+        uint64_t start = wav->pos;
+        uint32_t n = sinus_source_wav_frames (wav, &frames, want);
+        sinus_ssize_t written = n ? sinus_frames_write (sc, frames, n) : 0;
+
+        /* Whatever it didn't take is handed out again next time */
+        wav->pos = start + (written > 0 ? (uint64_t)written : 0);
+        return written;
+    }
+
+    void *dst;
+    if (sinus_frames_begin_write (sc, &dst, &want) < 0)
+        return -1;
+
+    sinus_ssize_t n = sinus_source_wav_read (wav, dst, fmt, channels, want);
+    if (n <= 0)
+        return n;
+
+    return sinus_frames_commit (sc, (uint32_t)n);
+}
@@ -0,0 +1,1691 @@
+/*
+ * Null backend: no sound card, just a ring buffer drained by a virtual clock.
+ *
+ * The "device" consumes frames at the configured sample_rate. Two clocks are
+ * available:
+ *   - realtime: the virtual clock follows CLOCK_MONOTONIC, so writes block
+ *     and underrun exactly like a real device would,
+ *   - free-running: time only passes when the writer needs room, so the
+ *     buffer never underruns and throughput is limited only by the caller.
+ *
+ * The clock is picked with user_data: NULL, or a pointer to a bool (true
+ * selects free-running). When user_data is NULL, the SINUS_NULL_CLOCK
+ * environment variable ("realtime" or "freerun") decides.
+ */
+
+#define _GNU_SOURCE
+
+#include <sinus.h>
+#include <sinus_convert.h>
+
+#include "../common/latency.h"
+#include "../common/mix.h"
+#include "../common/stats.h"
+#include "../common/submit.h"
+
+#include <alloca.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define runtime_assert(condition)                                              \
+    if (!(condition))                                                          \
+    {                                                                          \
+        fprintf (stderr, "%s:%d Runtime assertion failed: " #condition "\n",   \
+                 __FILE__, __LINE__);                                          \
+        abort ();                                                              \
+    }
+
+#define NS_PER_SEC 1000000000ULL
+
+static uint64_t
+now_ns (void)
+{
+    struct timespec ts;
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * NS_PER_SEC + (uint64_t)ts.tv_nsec;
+}
+
+static void
+sleep_ns (uint64_t ns)
+{
+    struct timespec ts = { .tv_sec = (time_t)(ns / NS_PER_SEC),
+                           .tv_nsec = (long)(ns % NS_PER_SEC) };
+    while (nanosleep (&ts, &ts) != 0)
+        ;
+}
+
+struct SinusContext
+{
+    SinusSettings settings;
+    bool running;
+    bool freerun;
+
+    pthread_mutex_t lock; // guards everything below
+
+    // device ring buffer, settings.buffer_frames frames
+    uint8_t *buffer;
+    uint32_t frame_bytes;
+    uint64_t write_pos; // total frames written
+    uint64_t read_pos;  // total frames consumed by the virtual clock
+
+    // realtime clock: read_pos == clock_frames at clock_ns
+    uint64_t clock_ns;
+    uint64_t clock_frames;
+
+    SinusFillCallback fill_cb;
+    pthread_t fill_thread;
+    bool fill_thread_started; // joinable
+    bool fill_thread_running;
+
+    // sinus_poll_fds_get: expires when a period of space will be free,
+    // see null_poll_arm
+    int timer_fd;
+    bool polling; // fds were handed out, keep timer_fd current on writes
+
+    // SINUS_FLAG_ADAPTIVE: null_frames_free stops at the target instead of
+    // buffer_frames, see null_adapt
+    bool adaptive;
+    SinusLatency latency;
+
+    SinusMixer *mixer; // sinus_stream_open, see ../common/mix.c
+
+    SinusStats stats; // accessed atomically, see ../common/stats.h
+
+    // SINUS_FLAG_CAPTURE and SINUS_FLAG_DUPLEX loop back whatever the clock
+    // plays, silence when nothing was written, into capture:
+    // settings.buffer_frames frames, see null_capture_put
+    bool playback;
+    uint8_t *capture;
+    uint64_t capture_write_pos; // total frames captured
+    uint64_t capture_read_pos;  // total frames read
+
+    SinusCaptureCallback capture_cb;
+    pthread_t capture_thread;
+    bool capture_thread_started; // joinable
+    bool capture_thread_running;
+
+    // sinus_submit, allocated on first use, see null_submit_thread
+    SinusSubmitQueue *submit;
+    pthread_t submit_thread;
+    bool submit_thread_started; // joinable
+    bool submit_thread_running;
+};
+
+void
+sinus_settings_default (SinusSettings *ss)
+{
+    runtime_assert (ss != NULL);
+
+    ss->buffer_frames = 4096;
+    ss->channels = 2;
+    ss->fmt = SINUS_FORMAT_U24_U4;
+    ss->interleaved = true;
+    ss->sample_rate = 44100;
+    ss->hint_min_write_frames = 1024;
+    ss->hint_update_us = 24000;
+    ss->flags = 0;
+    ss->resample_quality = SINUS_RESAMPLE_MEDIUM;
+    ss->min_buffer_frames = 0;
+}
+
+static uint64_t
+frames_to_ns (const SinusContext *sc, uint64_t frames)
+{
+    return frames * NS_PER_SEC / sc->settings.sample_rate;
+}
+
+/* Loopback: nframes the clock played, from device buffer position pos or
+ * silence, go to the capture buffer. Frames the reader hadn't taken yet
+ * when they get overwritten are lost, an overrun. Called with sc->lock
+ * held. */
+static void
+null_capture_put (SinusContext *sc, bool silence, uint64_t pos,
+                  uint64_t nframes)
+{
+    uint32_t size = sc->settings.buffer_frames;
+
+    if (!sc->capture)
+        return;
+
+    /* Only the last buffer's worth would survive anyway */
+    if (nframes > size)
+    {
+        pos += nframes - size;
+        sc->capture_write_pos += nframes - size;
+        nframes = size;
+    }
+
+    while (nframes > 0)
+    {
+        uint32_t dst = (uint32_t)(sc->capture_write_pos % size);
+        uint32_t src = (uint32_t)(pos % size);
+        uint64_t n = nframes < size - dst ? nframes : size - dst;
+        uint8_t *out = sc->capture + (size_t)dst * sc->frame_bytes;
+
+        if (silence)
+            sinus_silence (out, sc->settings.fmt,
+                           (size_t)n * sc->settings.channels);
+        else
+        {
+            if (n > size - src)
+                n = size - src;
+            memcpy (out, sc->buffer + (size_t)src * sc->frame_bytes,
+                    (size_t)n * sc->frame_bytes);
+        }
+
+        pos += n;
+        sc->capture_write_pos += n;
+        nframes -= n;
+    }
+
+    if (sc->capture_write_pos - sc->capture_read_pos > size)
+    {
+        sinus_stats_add (&sc->stats.overruns, 1);
+        sc->capture_read_pos = sc->capture_write_pos - size;
+    }
+}
+
+/* Move read_pos to where the virtual clock says it should be. Called with
+ * sc->lock held. */
+static void
+null_clock_advance (SinusContext *sc)
+{
+    if (!sc->running || sc->freerun)
+        return;
+
+    uint64_t now = now_ns ();
+    uint64_t target = sc->clock_frames
+                      + (now - sc->clock_ns) * sc->settings.sample_rate
+                            / NS_PER_SEC;
+
+    if (target > sc->write_pos)
+    {
+        /* Underrun: the device played silence. Restart the clock from the
+         * last written frame, as a real device would after recovery. An
+         * already empty buffer isn't a new underrun. */
+        if (sc->read_pos < sc->write_pos)
+        {
+            sinus_stats_add (&sc->stats.underruns, 1);
+            sinus_stats_add (&sc->stats.recoveries, 1);
+        }
+        null_capture_put (sc, false, sc->read_pos,
+                          sc->write_pos - sc->read_pos);
+        null_capture_put (sc, true, 0, target - sc->write_pos);
+        sc->read_pos = sc->write_pos;
+        sc->clock_frames = sc->write_pos;
+        sc->clock_ns = now;
+        return;
+    }
+
+    null_capture_put (sc, false, sc->read_pos, target - sc->read_pos);
+    sc->read_pos = target;
+}
+
+static void
+null_clock_reset (SinusContext *sc)
+{
+    sc->clock_ns = now_ns ();
+    sc->clock_frames = sc->read_pos;
+}
+
+static uint32_t
+null_frames_buffered (const SinusContext *sc)
+{
+    return (uint32_t)(sc->write_pos - sc->read_pos);
+}
+
+static uint32_t
+null_frames_target (SinusContext *sc)
+{
+    return sc->adaptive ? sinus_latency_target (&sc->latency)
+                        : sc->settings.buffer_frames;
+}
+
+static uint32_t
+null_frames_free (SinusContext *sc)
+{
+    uint32_t target = null_frames_target (sc);
+    uint32_t buffered = null_frames_buffered (sc);
+
+    return buffered < target ? target - buffered : 0;
+}
+
+/* Free-running clock: let exactly enough time pass for nframes to fit. */
+static void
+null_clock_make_room (SinusContext *sc, uint32_t nframes)
+{
+    uint32_t free_frames = null_frames_free (sc);
+
+    if (!sc->freerun || !sc->running || free_frames >= nframes)
+        return;
+
+    uint32_t needed = nframes - free_frames;
+    uint32_t buffered = null_frames_buffered (sc);
+    uint32_t played = needed < buffered ? needed : buffered;
+
+    null_capture_put (sc, false, sc->read_pos, played);
+    sc->read_pos += played;
+}
+
+/* Free-running clock: let exactly enough time pass for nframes to be
+ * captured, whatever is queued playing first. */
+static void
+null_clock_make_frames (SinusContext *sc, uint32_t nframes)
+{
+    uint64_t captured = sc->capture_write_pos - sc->capture_read_pos;
+
+    if (!sc->freerun || !sc->running || captured >= nframes)
+        return;
+
+    uint64_t needed = nframes - captured;
+    uint32_t buffered = null_frames_buffered (sc);
+    uint64_t played = needed < buffered ? needed : buffered;
+
+    null_capture_put (sc, false, sc->read_pos, played);
+    sc->read_pos += played;
+    null_capture_put (sc, true, 0, needed - played);
+}
+
+static uint32_t
+null_period_frames (const SinusContext *sc)
+{
+    uint32_t period = sc->settings.hint_min_write_frames;
+
+    if (period == 0 || period > sc->settings.buffer_frames)
+        period = sc->settings.buffer_frames;
+
+    return period;
+}
+
+/* Set timer_fd to expire once the clock has made a period of room: right
+ * away when it's already there, never while stopped. Called with sc->lock
+ * held. */
+static void
+null_poll_arm (SinusContext *sc)
+{
+    struct itimerspec its = { 0 };
+
+    if (sc->running)
+    {
+        uint32_t free_frames = null_frames_free (sc);
+        uint32_t period = null_period_frames (sc);
+
+        /* An all-zero it_value would disarm. Free-running always has room,
+         * the next write makes it. */
+        uint64_t wait = sc->freerun || free_frames >= period
+                            ? 1
+                            : frames_to_ns (sc, period - free_frames);
+        its.it_value.tv_sec = (time_t)(wait / NS_PER_SEC);
+        its.it_value.tv_nsec = (long)(wait % NS_PER_SEC);
+    }
+
+    timerfd_settime (sc->timer_fd, 0, &its, NULL);
+}
+
+/* Feed a write to the SINUS_FLAG_ADAPTIVE controller, queued being what the
+ * write found. Called with sc->lock held. */
+static void
+null_adapt (SinusContext *sc, uint32_t queued)
+{
+    if (!sc->adaptive || !sc->running)
+        return;
+
+    uint64_t underruns = __atomic_load_n (&sc->stats.underruns,
+                                          __ATOMIC_RELAXED);
+    if (sinus_latency_update (&sc->latency, underruns, queued, now_ns ())
+        && sc->polling)
+        null_poll_arm (sc);
+}
+
+/* Called without sc->lock held, takes it to sample the fill level */
+static void
+null_stats_write (SinusContext *sc, uint32_t requested, sinus_ssize_t written,
+                  uint64_t start_ns)
+{
+    uint64_t elapsed = now_ns () - start_ns;
+
+    pthread_mutex_lock (&sc->lock);
+    uint32_t buffered = null_frames_buffered (sc);
+    if (written > 0)
+        null_adapt (sc, buffered > (uint32_t)written
+                            ? buffered - (uint32_t)written
+                            : 0);
+    pthread_mutex_unlock (&sc->lock);
+
+    sinus_stats_write (&sc->stats, requested, written, elapsed, buffered);
+}
+
+/* Contiguous writable region at write_pos, at most nframes long. */
+static uint8_t *
+null_ring_region (SinusContext *sc, uint32_t *nframes)
+{
+    uint32_t offset = (uint32_t)(sc->write_pos % sc->settings.buffer_frames);
+    uint32_t contiguous = sc->settings.buffer_frames - offset;
+
+    if (*nframes > contiguous)
+        *nframes = contiguous;
+
+    return sc->buffer + (size_t)offset * sc->frame_bytes;
+}
+
+/* Copy as much as fits into the ring. Called with sc->lock held. */
+static uint32_t
+null_ring_write (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    null_clock_make_room (sc, nframes);
+    uint32_t free_frames = null_frames_free (sc);
+
+    uint32_t to_write = nframes < free_frames ? nframes : free_frames;
+    uint32_t left = to_write;
+    const uint8_t *src = frames;
+
+    while (left > 0)
+    {
+        uint32_t n = left;
+        uint8_t *dst = null_ring_region (sc, &n);
+        size_t bytes = (size_t)n * sc->frame_bytes;
+
+        memcpy (dst, src, bytes);
+        src += bytes;
+        sc->write_pos += n;
+        left -= n;
+    }
+
+    if (sc->polling)
+        null_poll_arm (sc);
+
+    return to_write;
+}
+
+/* null_ring_write for planar input, starting offset frames into each
+ * channel. Called with sc->lock held. */
+static uint32_t
+null_ring_write_planar (SinusContext *sc, const void *const *channels,
+                        uint32_t offset, uint32_t nframes)
+{
+    null_clock_make_room (sc, nframes);
+    uint32_t free_frames = null_frames_free (sc);
+
+    uint32_t nchannels = sc->settings.channels;
+    size_t sample_bytes = (size_t)sinus_format_to_size (sc->settings.fmt);
+    const void **chunk = alloca (sizeof (void *) * nchannels);
+
+    uint32_t to_write = nframes < free_frames ? nframes : free_frames;
+    uint32_t done = 0;
+
+    while (done < to_write)
+    {
+        uint32_t n = to_write - done;
+        uint8_t *dst = null_ring_region (sc, &n);
+
+        for (uint32_t c = 0; c < nchannels; ++c)
+            chunk[c] = (const uint8_t *)channels[c]
+                       + (size_t)(offset + done) * sample_bytes;
+
+        sinus_interleave (dst, chunk, sc->settings.fmt, nchannels, n);
+        sc->write_pos += n;
+        done += n;
+    }
+
+    if (sc->polling)
+        null_poll_arm (sc);
+
+    return to_write;
+}
+
+/* Queue up to a buffer of silence, as much as fits. Called with sc->lock
+ * held. */
+static uint32_t
+null_ring_silence (SinusContext *sc, uint64_t nframes)
+{
+    uint32_t want = nframes < sc->settings.buffer_frames
+                        ? (uint32_t)nframes
+                        : sc->settings.buffer_frames;
+
+    null_clock_make_room (sc, want);
+    uint32_t free_frames = null_frames_free (sc);
+
+    uint32_t to_write = want < free_frames ? want : free_frames;
+    uint32_t left = to_write;
+
+    while (left > 0)
+    {
+        uint32_t n = left;
+        uint8_t *dst = null_ring_region (sc, &n);
+
+        sinus_silence (dst, sc->settings.fmt,
+                       (size_t)n * sc->settings.channels);
+        sc->write_pos += n;
+        left -= n;
+    }
+
+    if (sc->polling)
+        null_poll_arm (sc);
+
+    return to_write;
+}
+
+/* With interleaved = false the caller's buffer is one block of nframes
+ * samples per channel */
+static void
+null_channel_blocks (const SinusContext *sc, const void *frames,
+                     uint32_t nframes, const void **channels)
+{
+    size_t block_bytes
+        = (size_t)nframes * (size_t)sinus_format_to_size (sc->settings.fmt);
+
+    for (uint32_t c = 0; c < sc->settings.channels; ++c)
+        channels[c] = (const uint8_t *)frames + block_bytes * c;
+}
+
+static void *
+null_fill_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = null_period_frames (sc);
+
+    pthread_mutex_lock (&sc->lock);
+    while (sc->fill_thread_running)
+    {
+        null_clock_advance (sc);
+
+        null_clock_make_room (sc, period);
+        uint32_t avail = null_frames_free (sc);
+
+        if (!sc->running || avail < period)
+        {
+            /* Sleep until one period of space opens up. */
+            uint32_t missing = sc->running ? period - avail : period;
+            uint64_t wait = frames_to_ns (sc, missing);
+            pthread_mutex_unlock (&sc->lock);
+            sleep_ns (wait);
+            pthread_mutex_lock (&sc->lock);
+            continue;
+        }
+
+        uint32_t n = avail;
+        void *dst = null_ring_region (sc, &n);
+        SinusFillCallback cb = sc->fill_cb;
+
+        /* Only this thread writes the ring, so the region stays ours. */
+        pthread_mutex_unlock (&sc->lock);
+        sinus_ssize_t got = cb (dst, n);
+        pthread_mutex_lock (&sc->lock);
+
+        if (got < 0)
+            break;
+        if (got == 0)
+        {
+            /* Producer has nothing yet, don't spin on it */
+            pthread_mutex_unlock (&sc->lock);
+            sleep_ns (frames_to_ns (sc, period));
+            pthread_mutex_lock (&sc->lock);
+            continue;
+        }
+        if ((uint32_t)got > n)
+            got = n;
+        null_adapt (sc, null_frames_buffered (sc));
+        sc->write_pos += (uint64_t)got;
+
+        /* Writing is just the pointer bump above, there's no time to record */
+        sinus_stats_write (&sc->stats, n, got, 0, null_frames_buffered (sc));
+    }
+    sc->fill_thread_running = false;
+    pthread_mutex_unlock (&sc->lock);
+
+    return NULL;
+}
+
+/* Submission queue: the head buffer is copied into the device buffer as the
+ * clock makes room for it, like the fill thread does with its callback. */
+static void *
+null_submit_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = null_period_frames (sc);
+
+    for (;;)
+    {
+        pthread_mutex_lock (&sc->lock);
+        bool go = sc->submit_thread_running;
+        pthread_mutex_unlock (&sc->lock);
+
+        if (!go)
+            break;
+
+        const void *frames;
+        uint32_t nframes;
+
+        /* Timeout only so submit_thread_running gets noticed */
+        if (!sinus_submit_peek (sc->submit, sc->frame_bytes, &frames,
+                                &nframes, frames_to_ns (sc, period)))
+            continue;
+
+        if (nframes == 0)
+        {
+            sinus_submit_advance (sc->submit, 0);
+            continue;
+        }
+
+        uint64_t start = now_ns ();
+        uint32_t want = nframes < period ? nframes : period;
+        uint32_t written = 0;
+        uint32_t missing = want;
+
+        pthread_mutex_lock (&sc->lock);
+        if (sc->running)
+        {
+            null_clock_advance (sc);
+            null_clock_make_room (sc, want);
+            written = null_ring_write (sc, frames, nframes);
+
+            uint32_t avail = null_frames_free (sc);
+            missing = avail < want ? want - avail : 0;
+        }
+        pthread_mutex_unlock (&sc->lock);
+
+        if (written > 0)
+        {
+            null_stats_write (sc, nframes, written, start);
+            sinus_submit_advance (sc->submit, written);
+        }
+
+        /* Sleep until the rest, or a period of it, fits */
+        if (written < nframes && missing > 0)
+            sleep_ns (frames_to_ns (sc, missing));
+    }
+
+    return NULL;
+}
+
+static int
+null_submit_thread_start (SinusContext *sc)
+{
+    sc->submit_thread_running = true;
+    if (pthread_create (&sc->submit_thread, NULL, null_submit_thread, sc)
+        != 0)
+    {
+        sc->submit_thread_running = false;
+        return -1;
+    }
+    sc->submit_thread_started = true;
+
+    return 0;
+}
+
+static void
+null_submit_thread_stop (SinusContext *sc)
+{
+    if (!sc->submit_thread_started)
+        return;
+
+    pthread_mutex_lock (&sc->lock);
+    sc->submit_thread_running = false;
+    pthread_mutex_unlock (&sc->lock);
+
+    pthread_join (sc->submit_thread, NULL);
+    sc->submit_thread_started = false;
+}
+
+int
+sinus_context_init (SinusContext **_sc, const SinusSettings *ss_nullable,
+                    void *user_data)
+{
+    runtime_assert (_sc != NULL);
+
+    SinusSettings *_ss = (SinusSettings *)ss_nullable;
+    if (!_ss)
+    {
+        _ss = alloca (sizeof (SinusSettings));
+        sinus_settings_default (_ss);
+    }
+
+    uint32_t frame_bytes
+        = (uint32_t)sinus_format_to_size (_ss->fmt) * _ss->channels;
+    if (frame_bytes == 0 || _ss->sample_rate == 0 || _ss->buffer_frames == 0)
+    {
+        fprintf (stderr, "Null backend: invalid settings\n");
+        return -1;
+    }
+
+    struct SinusContext *sc = calloc (1, sizeof (struct SinusContext));
+    runtime_assert (sc != NULL);
+
+    sc->buffer = malloc ((size_t)_ss->buffer_frames * frame_bytes);
+    runtime_assert (sc->buffer != NULL);
+
+    sc->timer_fd = timerfd_create (CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (sc->timer_fd < 0)
+    {
+        free (sc->buffer);
+        free (sc);
+        return -1;
+    }
+
+    if (user_data)
+    {
+        sc->freerun = *(bool *)user_data;
+    }
+    else
+    {
+        const char *clock = getenv ("SINUS_NULL_CLOCK");
+        sc->freerun = clock && strcmp (clock, "freerun") == 0;
+    }
+
+    pthread_mutex_init (&sc->lock, NULL);
+
+    sc->frame_bytes = frame_bytes;
+    sc->running = false;
+    sc->settings = *_ss;
+
+    sc->playback = !(_ss->flags & SINUS_FLAG_CAPTURE)
+                   || (_ss->flags & SINUS_FLAG_DUPLEX);
+    if (_ss->flags & (SINUS_FLAG_CAPTURE | SINUS_FLAG_DUPLEX))
+    {
+        sc->capture = malloc ((size_t)_ss->buffer_frames * frame_bytes);
+        runtime_assert (sc->capture != NULL);
+    }
+
+    sc->adaptive = (sc->settings.flags & SINUS_FLAG_ADAPTIVE) != 0;
+    if (sc->adaptive)
+        sinus_latency_init (&sc->latency, sc->settings.min_buffer_frames,
+                            sc->settings.buffer_frames,
+                            null_period_frames (sc), now_ns ());
+
+    *_sc = sc;
+    return 0;
+}
+
+void
+sinus_context_deinit (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    sinus_mixer_destroy (sc->mixer);
+    sinus_frames_fill_callback_set (sc, NULL);
+    if (sc->capture)
+        sinus_frames_capture_callback_set (sc, NULL);
+    null_submit_thread_stop (sc);
+    if (sc->submit)
+    {
+        sinus_submit_deinit (sc->submit);
+        free (sc->submit);
+    }
+    sc->running = false;
+
+    pthread_mutex_destroy (&sc->lock);
+    close (sc->timer_fd);
+    free (sc->capture);
+    free (sc->buffer);
+    free (sc);
+}
+
+int
+sinus_context_reconfigure (SinusContext *sc, const SinusSettings *ss)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (ss != NULL);
+
+    uint32_t frame_bytes
+        = (uint32_t)sinus_format_to_size (ss->fmt) * ss->channels;
+    if (frame_bytes == 0 || ss->sample_rate == 0 || ss->buffer_frames == 0
+        || sc->capture || !sinus_mixer_idle (sc->mixer))
+        return -1;
+
+    sinus_mixer_destroy (sc->mixer);
+    sc->mixer = NULL;
+
+    /* Restarted below, on the new buffer */
+    SinusFillCallback cb = sc->fill_cb;
+    sinus_frames_fill_callback_set (sc, NULL);
+    null_submit_thread_stop (sc);
+
+    pthread_mutex_lock (&sc->lock);
+
+    /* The queue survives when it still means the same thing to the clock.
+     * Otherwise it plays out first, like a real device changing hw params,
+     * unless nothing is playing it. */
+    if (frame_bytes != sc->frame_bytes
+        || ss->buffer_frames != sc->settings.buffer_frames
+        || ss->sample_rate != sc->settings.sample_rate)
+    {
+        if (sc->freerun || !sc->running)
+            sc->read_pos = sc->write_pos;
+
+        for (;;)
+        {
+            null_clock_advance (sc);
+            uint32_t buffered = null_frames_buffered (sc);
+            if (buffered == 0)
+                break;
+
+            pthread_mutex_unlock (&sc->lock);
+            sleep_ns (frames_to_ns (sc, buffered));
+            pthread_mutex_lock (&sc->lock);
+        }
+
+        uint8_t *buffer
+            = realloc (sc->buffer, (size_t)ss->buffer_frames * frame_bytes);
+        runtime_assert (buffer != NULL);
+        sc->buffer = buffer;
+    }
+
+    null_clock_advance (sc);
+    sc->frame_bytes = frame_bytes;
+    sc->settings = *ss;
+    null_clock_reset (sc);
+
+    sc->adaptive = (sc->settings.flags & SINUS_FLAG_ADAPTIVE) != 0;
+    if (sc->adaptive)
+        sinus_latency_init (&sc->latency, sc->settings.min_buffer_frames,
+                            sc->settings.buffer_frames,
+                            null_period_frames (sc), now_ns ());
+
+    null_poll_arm (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    if (sc->submit && null_submit_thread_start (sc) < 0)
+        return -1;
+
+    return (int)sinus_frames_fill_callback_set (sc, cb);
+}
+
+/* Start processing frames */
+int
+sinus_control_start (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    pthread_mutex_lock (&sc->lock);
+    if (!sc->running)
+    {
+        null_clock_reset (sc);
+        sc->running = true;
+        null_poll_arm (sc);
+    }
+    pthread_mutex_unlock (&sc->lock);
+
+    return 0;
+}
+
+/* Stop processing frames */
+int
+sinus_control_pause (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    sc->running = false;
+    null_poll_arm (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    return 0;
+}
+
+/* Stop processing frames & Reset internal state */
+int
+sinus_control_stop (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    /* Neither thread mid-write into the reset buffer, restarted below */
+    bool submitting = sc->submit_thread_started;
+    SinusFillCallback cb = sc->fill_cb;
+    sinus_frames_fill_callback_set (sc, NULL);
+    null_submit_thread_stop (sc);
+
+    pthread_mutex_lock (&sc->lock);
+    sc->running = false;
+    sc->write_pos = 0;
+    sc->read_pos = 0;
+    sc->capture_write_pos = 0;
+    sc->capture_read_pos = 0;
+    null_poll_arm (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    if (sc->submit)
+        sinus_submit_flush (sc->submit);
+    if (submitting && null_submit_thread_start (sc) < 0)
+        return -1;
+
+    return (int)sinus_frames_fill_callback_set (sc, cb);
+}
+
+/* Process all queued frames and pause */
+int
+sinus_control_drain (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    /* Let the thread hand every submitted buffer over first */
+    while (sc->submit && sc->running && sc->submit_thread_started
+           && sinus_submit_pending (sc->submit) > 0)
+        sleep_ns (frames_to_ns (sc, null_period_frames (sc)));
+
+    /* A callback would keep the buffer topped up, it's restarted below and
+     * waits there for the next start */
+    SinusFillCallback cb = sc->fill_cb;
+    sinus_frames_fill_callback_set (sc, NULL);
+
+    pthread_mutex_lock (&sc->lock);
+
+    if (!sc->running)
+    {
+        pthread_mutex_unlock (&sc->lock);
+        sinus_frames_fill_callback_set (sc, cb);
+        return -1;
+    }
+
+    if (sc->freerun)
+    {
+        null_capture_put (sc, false, sc->read_pos,
+                          sc->write_pos - sc->read_pos);
+        sc->read_pos = sc->write_pos;
+    }
+
+    for (;;)
+    {
+        null_clock_advance (sc);
+        uint32_t buffered = null_frames_buffered (sc);
+        if (buffered == 0)
+            break;
+
+        pthread_mutex_unlock (&sc->lock);
+        sleep_ns (frames_to_ns (sc, buffered));
+        pthread_mutex_lock (&sc->lock);
+    }
+
+    sc->running = false;
+    null_poll_arm (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    return (int)sinus_frames_fill_callback_set (sc, cb);
+}
+
+static sinus_ssize_t
+null_write_planar (SinusContext *sc, const void *const *channels,
+                   uint32_t nframes)
+{
+    runtime_assert (channels != NULL);
+
+    if (!sc->running || nframes == 0)
+        return 0;
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    uint32_t written = null_ring_write_planar (sc, channels, 0, nframes);
+    pthread_mutex_unlock (&sc->lock);
+
+    return written;
+}
+
+static sinus_ssize_t
+null_write (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    if (!sc->running || nframes == 0 || !frames)
+        return 0;
+
+    if (!sc->settings.interleaved)
+    {
+        const void **channels
+            = alloca (sizeof (void *) * sc->settings.channels);
+        null_channel_blocks (sc, frames, nframes, channels);
+        return null_write_planar (sc, channels, nframes);
+    }
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    uint32_t written = null_ring_write (sc, frames, nframes);
+    pthread_mutex_unlock (&sc->lock);
+
+    return written;
+}
+
+/* One lock for the whole chain, so a gather is a single queue update */
+static sinus_ssize_t
+null_writev (SinusContext *sc, const SinusIovec *iov, int iovcnt)
+{
+    sinus_ssize_t total = 0;
+
+    if (!sc->running)
+        return 0;
+
+    if (!sc->settings.interleaved)
+    {
+        for (int i = 0; i < iovcnt; ++i)
+        {
+            sinus_ssize_t n = null_write (sc, iov[i].frames, iov[i].nframes);
+            total += n;
+            if (n < (sinus_ssize_t)iov[i].nframes)
+                break;
+        }
+        return total;
+    }
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    for (int i = 0; i < iovcnt; ++i)
+    {
+        if (!iov[i].frames)
+            break;
+
+        uint32_t n = null_ring_write (sc, iov[i].frames, iov[i].nframes);
+        total += n;
+        if (n < iov[i].nframes)
+            break;
+    }
+    pthread_mutex_unlock (&sc->lock);
+
+    return total;
+}
+
+static sinus_ssize_t
+null_write_timed (SinusContext *sc, const void *frames, uint32_t nframes,
+                  uint32_t timeout_us)
+{
+    if (nframes == 0 || !frames || !sc->running)
+        return 0;
+
+    uint64_t deadline = now_ns () + (uint64_t)timeout_us * 1000ULL;
+    const uint8_t *ptr = frames;
+    uint32_t frames_left = nframes;
+
+    const void **channels = NULL;
+    if (!sc->settings.interleaved)
+    {
+        channels = alloca (sizeof (void *) * sc->settings.channels);
+        null_channel_blocks (sc, frames, nframes, channels);
+    }
+
+    pthread_mutex_lock (&sc->lock);
+    while (frames_left > 0 && sc->running)
+    {
+        null_clock_advance (sc);
+
+        uint32_t wr
+            = channels ? null_ring_write_planar (sc, channels,
+                                                 nframes - frames_left,
+                                                 frames_left)
+                       : null_ring_write (sc, ptr, frames_left);
+        ptr += (size_t)wr * sc->frame_bytes;
+        frames_left -= wr;
+
+        if (frames_left == 0)
+            break;
+
+        uint64_t now = now_ns ();
+        if (now >= deadline)
+            break; /* timeout expired */
+
+        /* Wait until a useful amount of space has been played out. */
+        uint32_t want = sc->settings.hint_min_write_frames;
+        if (want == 0 || want > frames_left)
+            want = frames_left;
+        if (want > sc->settings.buffer_frames)
+            want = sc->settings.buffer_frames;
+
+        uint64_t wait = frames_to_ns (sc, want);
+        if (wait > deadline - now)
+            wait = deadline - now;
+
+        pthread_mutex_unlock (&sc->lock);
+        sleep_ns (wait);
+        pthread_mutex_lock (&sc->lock);
+    }
+    pthread_mutex_unlock (&sc->lock);
+
+    return nframes - frames_left;
+}
+
+static sinus_ssize_t
+null_write_at (SinusContext *sc, const void *frames, uint32_t nframes,
+               uint64_t presentation_ns, int64_t *error_ns)
+{
+    if (error_ns)
+        *error_ns = 0;
+    if (!sc->running || nframes == 0 || !frames)
+        return 0;
+
+    const void **channels = NULL;
+    if (!sc->settings.interleaved)
+    {
+        channels = alloca (sizeof (void *) * sc->settings.channels);
+        null_channel_blocks (sc, frames, nframes, channels);
+    }
+
+    int64_t rate = (int64_t)sc->settings.sample_rate;
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+
+    /* The frame after the last one written plays when the clock reaches
+     * it. Free-running has no such moment, take it as playing from now. */
+    uint64_t start_ns
+        = sc->freerun
+              ? now_ns () + frames_to_ns (sc, null_frames_buffered (sc))
+              : sc->clock_ns
+                    + frames_to_ns (sc, sc->write_pos - sc->clock_frames);
+
+    int64_t offset = (int64_t)(presentation_ns - start_ns);
+    uint64_t pad = 0;
+    uint32_t skip = 0;
+
+    /* To the nearest frame, which is as close as it gets */
+    if (offset > 0)
+        pad = ((uint64_t)offset * (uint64_t)rate + NS_PER_SEC / 2) / NS_PER_SEC;
+    else
+    {
+        uint64_t late = ((uint64_t)-offset * (uint64_t)rate + NS_PER_SEC / 2)
+                        / NS_PER_SEC;
+        skip = late < nframes ? (uint32_t)late : nframes;
+    }
+
+    uint64_t padded = 0;
+    while (padded < pad)
+    {
+        uint32_t n = null_ring_silence (sc, pad - padded);
+        if (n == 0)
+            break;
+        padded += n;
+    }
+
+    if (error_ns)
+        *error_ns = (int64_t)(start_ns - presentation_ns)
+                    + ((int64_t)padded - (int64_t)skip) * (int64_t)NS_PER_SEC
+                          / rate;
+
+    /* The rest of the silence goes first, next time */
+    uint32_t written = 0;
+    if (padded == pad)
+        written = channels
+                      ? null_ring_write_planar (sc, channels, skip,
+                                                nframes - skip)
+                      : null_ring_write (sc,
+                                         (const uint8_t *)frames
+                                             + (size_t)skip * sc->frame_bytes,
+                                         nframes - skip);
+    pthread_mutex_unlock (&sc->lock);
+
+    if (padded < pad)
+        return 0;
+    return (sinus_ssize_t)skip + written;
+}
+
+sinus_ssize_t
+sinus_frames_write (SinusContext *sc, const void *frames, uint32_t nframes)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    uint64_t start = now_ns ();
+    sinus_ssize_t ret = null_write (sc, frames, nframes);
+
+    null_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_writev (SinusContext *sc, const SinusIovec *iov, int iovcnt)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    if (iovcnt < 0 || (iovcnt > 0 && !iov))
+        return -1;
+
+    uint64_t start = now_ns ();
+    uint64_t total = 0;
+
+    for (int i = 0; i < iovcnt; ++i)
+        total += iov[i].nframes;
+
+    sinus_ssize_t ret = null_writev (sc, iov, iovcnt);
+
+    null_stats_write (sc, total > UINT32_MAX ? UINT32_MAX : (uint32_t)total,
+                      ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_write_planar (SinusContext *sc, const void *const *channels,
+                           uint32_t nframes)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    uint64_t start = now_ns ();
+    sinus_ssize_t ret = null_write_planar (sc, channels, nframes);
+
+    null_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_write_timed (SinusContext *sc, const void *frames,
+                          uint32_t nframes, uint32_t timeout_us)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    uint64_t start = now_ns ();
+    sinus_ssize_t ret = null_write_timed (sc, frames, nframes, timeout_us);
+
+    null_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_write_at (SinusContext *sc, const void *frames, uint32_t nframes,
+                       uint64_t presentation_ns, int64_t *error_ns)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    uint64_t start = now_ns ();
+    sinus_ssize_t ret
+        = null_write_at (sc, frames, nframes, presentation_ns, error_ns);
+
+    null_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+/* Up to nframes from the capture buffer, waiting at most timeout_ns for
+ * them. A stopped context is started, as reading starts ALSA capture. */
+static sinus_ssize_t
+null_read (SinusContext *sc, void *frames, uint32_t nframes,
+           uint64_t timeout_ns)
+{
+    uint64_t deadline
+        = timeout_ns == UINT64_MAX ? UINT64_MAX : now_ns () + timeout_ns;
+    uint32_t size = sc->settings.buffer_frames;
+    uint8_t *dst = frames;
+    uint32_t done = 0;
+
+    pthread_mutex_lock (&sc->lock);
+
+    if (!sc->running)
+    {
+        null_clock_reset (sc);
+        sc->running = true;
+        null_poll_arm (sc);
+    }
+
+    while (done < nframes && sc->running)
+    {
+        null_clock_advance (sc);
+        null_clock_make_frames (sc, nframes - done);
+
+        uint64_t captured = sc->capture_write_pos - sc->capture_read_pos;
+        if (captured == 0)
+        {
+            uint64_t now = now_ns ();
+            if (now >= deadline)
+                break;
+
+            /* Until the rest should be there */
+            uint64_t wait = frames_to_ns (sc, nframes - done) + 1;
+            if (wait > deadline - now)
+                wait = deadline - now;
+
+            pthread_mutex_unlock (&sc->lock);
+            sleep_ns (wait);
+            pthread_mutex_lock (&sc->lock);
+            continue;
+        }
+
+        uint32_t offset = (uint32_t)(sc->capture_read_pos % size);
+        uint32_t n = nframes - done;
+        if (n > captured)
+            n = (uint32_t)captured;
+        if (n > size - offset)
+            n = size - offset;
+
+        memcpy (dst + (size_t)done * sc->frame_bytes,
+                sc->capture + (size_t)offset * sc->frame_bytes,
+                (size_t)n * sc->frame_bytes);
+        sc->capture_read_pos += n;
+        done += n;
+    }
+
+    pthread_mutex_unlock (&sc->lock);
+
+    sinus_stats_add (&sc->stats.frames_read, done);
+    return done;
+}
+
+sinus_ssize_t
+sinus_frames_read (SinusContext *sc, void *frames, uint32_t nframes)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->capture)
+        return -1;
+
+    return null_read (sc, frames, nframes, UINT64_MAX);
+}
+
+sinus_ssize_t
+sinus_frames_read_timed (SinusContext *sc, void *frames, uint32_t nframes,
+                         uint32_t timeout_us)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->capture)
+        return -1;
+
+    return null_read (sc, frames, nframes, (uint64_t)timeout_us * 1000ULL);
+}
+
+sinus_ssize_t
+sinus_frames_get_n_frames_available (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->capture)
+        return -1;
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    uint64_t captured = sc->capture_write_pos - sc->capture_read_pos;
+    pthread_mutex_unlock (&sc->lock);
+
+    return (sinus_ssize_t)captured;
+}
+
+int
+sinus_frames_begin_write (SinusContext *sc, void **frames, uint32_t *nframes)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (frames != NULL && nframes != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    if (!sc->running)
+    {
+        *nframes = 0;
+        return 0;
+    }
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+
+    null_clock_make_room (sc, *nframes);
+    uint32_t free_frames = null_frames_free (sc);
+
+    if (*nframes > free_frames)
+        *nframes = free_frames;
+
+    /* Free space is never touched by the clock, so it stays ours */
+    *frames = null_ring_region (sc, nframes);
+    pthread_mutex_unlock (&sc->lock);
+
+    return 0;
+}
+
+static sinus_ssize_t
+null_commit (SinusContext *sc, uint32_t nframes)
+{
+    if (!sc->running)
+        return 0;
+
+    pthread_mutex_lock (&sc->lock);
+    sc->write_pos += nframes;
+    if (sc->polling)
+        null_poll_arm (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    return nframes;
+}
+
+sinus_ssize_t
+sinus_frames_commit (SinusContext *sc, uint32_t nframes)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    uint64_t start = now_ns ();
+    sinus_ssize_t ret = null_commit (sc, nframes);
+
+    null_stats_write (sc, nframes, ret, start);
+    return ret;
+}
+
+sinus_ssize_t
+sinus_frames_get_n_frames_buffered (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    uint32_t buffered = null_frames_buffered (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    return buffered;
+}
+
+sinus_ssize_t
+sinus_frames_get_n_frames_free (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    uint32_t free_frames = null_frames_free (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    return free_frames;
+}
+
+int
+sinus_poll_fds_count (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    return 1;
+}
+
+int
+sinus_poll_fds_get (SinusContext *sc, struct pollfd *fds, uint32_t nfds)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (fds != NULL || nfds == 0);
+
+    if (!sc->playback)
+        return -1;
+
+    if (nfds < 1)
+        return 0;
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    null_poll_arm (sc);
+    sc->polling = true;
+    pthread_mutex_unlock (&sc->lock);
+
+    fds[0] = (struct pollfd){ .fd = sc->timer_fd, .events = POLLIN };
+    return 1;
+}
+
+int
+sinus_poll_revents (SinusContext *sc, struct pollfd *fds, uint32_t nfds,
+                    unsigned short *revents)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (revents != NULL);
+
+    if (!sc->playback)
+        return -1;
+
+    *revents = 0;
+    if (nfds < 1 || !(fds[0].revents & POLLIN))
+        return 0;
+
+    uint64_t expirations;
+    if (read (sc->timer_fd, &expirations, sizeof (expirations)) < 0)
+        expirations = 0; // already consumed, EAGAIN
+
+    pthread_mutex_lock (&sc->lock);
+    null_clock_advance (sc);
+    if (sc->running
+        && (sc->freerun || null_frames_free (sc) >= null_period_frames (sc)))
+        *revents = POLLOUT;
+    null_poll_arm (sc);
+    pthread_mutex_unlock (&sc->lock);
+
+    return 0;
+}
+
+uint32_t
+sinus_info_get_sample_rate (SinusContext *sc)
+{
+    return sc->settings.sample_rate;
+}
+
+uint32_t
+sinus_info_get_channels (SinusContext *sc)
+{
+    return sc->settings.channels;
+}
+
+SinusFormat
+sinus_info_get_format (SinusContext *sc)
+{
+    return sc->settings.fmt;
+}
+
+uint32_t
+sinus_info_get_buffer_target (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    return null_frames_target (sc);
+}
+
+sinus_ssize_t
+sinus_frames_fill_callback_set (SinusContext *sc, SinusFillCallback cb)
+{
+    runtime_assert (sc != NULL);
+
+    if (cb && (sc->submit || !sc->playback))
+        return -1;
+
+    if (sc->fill_thread_started)
+    {
+        pthread_mutex_lock (&sc->lock);
+        sc->fill_thread_running = false;
+        pthread_mutex_unlock (&sc->lock);
+
+        pthread_join (sc->fill_thread, NULL);
+        sc->fill_thread_started = false;
+    }
+
+    sc->fill_cb = cb;
+    if (cb == NULL)
+        return 0;
+
+    sc->fill_thread_running = true;
+    if (pthread_create (&sc->fill_thread, NULL, null_fill_thread, sc) != 0)
+    {
+        sc->fill_thread_running = false;
+        sc->fill_cb = NULL;
+        return -1;
+    }
+    sc->fill_thread_started = true;
+
+    return 0;
+}
+
+/* The queue and its thread, on first use */
+static int
+null_submit_setup (SinusContext *sc)
+{
+    if (sc->submit)
+        return 0;
+    if (sc->fill_cb || !sc->playback)
+        return -1;
+
+    SinusSubmitQueue *q = malloc (sizeof (SinusSubmitQueue));
+    if (!q)
+        return -1;
+    if (sinus_submit_init (q) < 0)
+    {
+        free (q);
+        return -1;
+    }
+
+    sc->submit = q;
+    if (null_submit_thread_start (sc) < 0)
+    {
+        sc->submit = NULL;
+        sinus_submit_deinit (q);
+        free (q);
+        return -1;
+    }
+
+    return 0;
+}
+
+int
+sinus_submit (SinusContext *sc, const void *frames, uint32_t nframes,
+              void *cookie)
+{
+    runtime_assert (sc != NULL);
+
+    if ((!frames && nframes > 0) || null_submit_setup (sc) < 0)
+        return -1;
+
+    return sinus_submit_push (sc->submit, frames, nframes, cookie);
+}
+
+int
+sinus_reap (SinusContext *sc, SinusCompletion *completions, uint32_t max)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->submit)
+        return 0;
+    if (!completions && max > 0)
+        return -1;
+
+    return sinus_submit_reap (sc->submit, completions, max);
+}
+
+int
+sinus_submit_fd (SinusContext *sc)
+{
+    runtime_assert (sc != NULL);
+
+    if (null_submit_setup (sc) < 0)
+        return -1;
+
+    return sc->submit->event;
+}
+
+/* Capture callback: a period at a time while the context runs */
+static void *
+null_capture_thread (void *arg)
+{
+    SinusContext *sc = arg;
+    uint32_t period = null_period_frames (sc);
+    void *frames = malloc ((size_t)period * sc->frame_bytes);
+
+    if (!frames)
+        return NULL;
+
+    for (;;)
+    {
+        pthread_mutex_lock (&sc->lock);
+        bool go = sc->capture_thread_running;
+        bool running = sc->running;
+        pthread_mutex_unlock (&sc->lock);
+
+        if (!go)
+            break;
+
+        if (!running)
+        {
+            sleep_ns (frames_to_ns (sc, period));
+            continue;
+        }
+
+        /* Timeout only so capture_thread_running gets noticed */
+        sinus_ssize_t got
+            = null_read (sc, frames, period, frames_to_ns (sc, period));
+        if (got > 0 && sc->capture_cb (frames, (uint32_t)got) < 0)
+            break;
+    }
+
+    free (frames);
+    return NULL;
+}
+
+sinus_ssize_t
+sinus_frames_capture_callback_set (SinusContext *sc, SinusCaptureCallback cb)
+{
+    runtime_assert (sc != NULL);
+
+    if (!sc->capture)
+        return -1;
+
+    if (sc->capture_thread_started)
+    {
+        pthread_mutex_lock (&sc->lock);
+        sc->capture_thread_running = false;
+        pthread_mutex_unlock (&sc->lock);
+
+        pthread_join (sc->capture_thread, NULL);
+        sc->capture_thread_started = false;
+    }
+
+    sc->capture_cb = cb;
+    if (cb == NULL)
+        return 0;
+
+    sc->capture_thread_running = true;
+    if (pthread_create (&sc->capture_thread, NULL, null_capture_thread, sc)
+        != 0)
+    {
+        sc->capture_thread_running = false;
+        sc->capture_cb = NULL;
+        return -1;
+    }
+    sc->capture_thread_started = true;
+
+    return 0;
+}
+
+SinusMixer **
+sinus_context_mixer (SinusContext *sc)
+{
+    return &sc->mixer;
+}
+
+void
+sinus_stats_get (SinusContext *sc, SinusStats *stats)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (stats != NULL);
+
+    sinus_stats_copy (stats, &sc->stats);
+}
+
+/* Nothing to look for, the clock is the device */
+void
+sinus_probe_stats (SinusContext *sc, SinusProbeStats *stats)
+{
+    runtime_assert (sc != NULL);
+    runtime_assert (stats != NULL);
+
+    *stats = (SinusProbeStats){ .count = 1 };
+    stats->candidates[0].device = "null";
+}
@@ -29,6 +29,8 @@ typedef enum sinus_format_e
     SINUS_FORMAT_U24_P3,
     SINUS_FORMAT_FLOAT,   // in range -1.0 - 1.0, 32 bit
     SINUS_FORMAT_FLOAT64, // in range -1.0 - 1.0, 64 bit
+    SINUS_FORMAT_S32,
+    SINUS_FORMAT_U10_P5, // 4 unsigned 10 bit samples in 5 bytes, see below
 } SinusFormat;
 
 static const sinus_ssize_t sinus_format_sizes_bytes[] = {
@@ -37,11 +39,53 @@ static const sinus_ssize_t sinus_format_sizes_bytes[] = {
     [SINUS_FORMAT_U16] = 2,     [SINUS_FORMAT_S24_U4] = 4,
     [SINUS_FORMAT_U24_U4] = 4,  [SINUS_FORMAT_S24_P3] = 3,
     [SINUS_FORMAT_U24_P3] = 3,  [SINUS_FORMAT_FLOAT] = 4,
-    [SINUS_FORMAT_FLOAT64] = 8,
+    [SINUS_FORMAT_FLOAT64] = 8, [SINUS_FORMAT_S32] = 4,
+    [SINUS_FORMAT_U10_P5] = 0,
 };
 
 #define sinus_format_to_size(fmt) sinus_format_sizes_bytes[fmt]
 
+/* U10_P5 is the MCP4911 backend's device format and has no whole byte
+ * size. A group of 4 samples is 5 bytes: bytes 0 - 3 hold the upper 8 bits
+ * of samples 0 - 3, byte 4 the low 2 bits of sample k at bit 2 * k.
+ * sinus_format_bytes counts it in whole groups. */
+#define sinus_format_bytes(fmt, nsamples)                                      \
+    ((fmt) == SINUS_FORMAT_U10_P5                                              \
+         ? ((nsamples) + 3) / 4 * 5                                            \
+         : (nsamples) * sinus_format_to_size (fmt))
+
+/* Writers copy into an internal lock-free ring drained by a backend thread,
+ * so sinus_frames_write* never makes a syscall */
+#define SINUS_FLAG_RING (1U << 0)
+/* Don't resample when the device refuses sample_rate, switch to the device
+ * rate instead (sample_rate is updated) */
+#define SINUS_FLAG_NO_RESAMPLE (1U << 1)
+/* Treat buffer_frames as an upper bound and keep only as much queued as the
+ * producer needs: the fill target grows on underruns and near misses and
+ * shrinks back while things are calm, never below min_buffer_frames.
+ * Underruns count on every write path, the ring, the callbacks and direct
+ * sinus_frames_write* alike, since those recover (and restart) the stream.
+ * sinus_frames_get_n_frames_free and the poll descriptors follow it. */
+#define SINUS_FLAG_ADAPTIVE (1U << 2)
+/* When no cached device works, try every candidate device at once instead
+ * of one after the other; the first one in the usual order still wins */
+#define SINUS_FLAG_PARALLEL_PROBE (1U << 3)
+/* Record instead of play: frames come from sinus_frames_read* or the
+ * capture callback, nothing can be written (the playback calls, the
+ * submission queue and the poll functions return -1) */
+#define SINUS_FLAG_CAPTURE (1U << 4)
+/* Play and record with the same format, rate and channels. The two streams
+ * are linked where the device allows it, so they start and stop together
+ * and run period for period on one clock. */
+#define SINUS_FLAG_DUPLEX (1U << 5)
+
+typedef enum sinus_resample_quality_e
+{
+    SINUS_RESAMPLE_FAST,   //  8 taps
+    SINUS_RESAMPLE_MEDIUM, // 32 taps
+    SINUS_RESAMPLE_BEST,   // 64 taps
+} SinusResampleQuality;
+
 typedef struct sinus_settings_s
 {
     SinusFormat fmt;        // sample format
@@ -52,6 +96,11 @@ typedef struct sinus_settings_s
 
     uint32_t hint_update_us;        // how often to write data to the backend
     uint32_t hint_min_write_frames; // minimum efficient write size
+
+    uint32_t flags;             // SINUS_FLAG_*
+    uint32_t resample_quality;  // SinusResampleQuality
+    uint32_t min_buffer_frames; // SINUS_FLAG_ADAPTIVE: lowest fill target,
+                                // 0 for two periods
 } SinusSettings;
 
 SINUSDEF void sinus_settings_default (SinusSettings *ss);
@@ -59,6 +108,18 @@ SINUSDEF void sinus_settings_default (SinusSettings *ss);
 SINUSDEF int sinus_context_init (SinusContext **sc, const SinusSettings *ss,
                                  void *user_data);
 SINUSDEF void sinus_context_deinit (SinusContext *sc);
+/* Switch to new settings on the open device. Frames already queued play
+ * out in the old settings first, and only when the device itself has to
+ * change (layout, or a format or rate it takes natively); otherwise the
+ * switch is seamless and the next write is simply in the new settings.
+ * Paused or stopped streams lose what they had queued. Statistics, the
+ * fill callback and the ring stay; SINUS_FLAG_RING can't be toggled and
+ * streams from sinus_stream_open have to be closed first. Playback only,
+ * not concurrently with writes. A running stream keeps running. Returns
+ * < 0 and keeps the old settings on failure, unless the device is gone
+ * altogether: then every call fails and only deinit is left. */
+SINUSDEF int sinus_context_reconfigure (SinusContext *sc,
+                                        const SinusSettings *ss);
 
 /* Start processing frames */
 SINUSDEF int sinus_control_start (SinusContext *sc);
@@ -69,18 +130,167 @@ SINUSDEF int sinus_control_stop (SinusContext *sc);
 /* Process all queued frames and pause */
 SINUSDEF int sinus_control_drain (SinusContext *sc);
 
+/* frames follow settings.interleaved: frame after frame, or one block of
+ * nframes samples per channel */
 SINUSDEF sinus_ssize_t sinus_frames_write (SinusContext *sc, const void *frames,
                                            uint32_t nframes);
+/* One pointer per channel, nframes samples each. Goes to the device as is
+ * when it takes planar data, interleaved otherwise. */
+SINUSDEF sinus_ssize_t sinus_frames_write_planar (SinusContext *sc,
+                                                  const void *const *channels,
+                                                  uint32_t nframes);
 SINUSDEF sinus_ssize_t sinus_frames_write_timed (SinusContext *sc,
                                                  const void *frames,
                                                  uint32_t nframes,
                                                  uint32_t timeout_us);
+/* One buffer of a sinus_frames_writev chain, laid out like the frames of
+ * sinus_frames_write */
+typedef struct sinus_iovec_s
+{
+    const void *frames;
+    uint32_t nframes;
+} SinusIovec;
+
+/* sinus_frames_write on the buffers of iov back to back, with the per-call
+ * work paid once: interleaved chains are gathered straight into device
+ * space (the mmap area when there is one), converting on the way, in as
+ * few device calls as the free space allows. Returns frames taken in
+ * total; a short count means the chain was cut there. */
+SINUSDEF sinus_ssize_t sinus_frames_writev (SinusContext *sc,
+                                            const SinusIovec *iov, int iovcnt);
+/* Like sinus_frames_write, but the first frame should play at presentation_ns
+ * on CLOCK_MONOTONIC. Silence is queued in front of the frames when they're
+ * early, leading frames are dropped when they're late. Returns frames taken,
+ * dropped ones included; when only part of the silence fits nothing is
+ * taken and the call can be repeated. error_ns, if not NULL, receives when
+ * the first frame taken will actually play minus when it should. */
+SINUSDEF sinus_ssize_t sinus_frames_write_at (SinusContext *sc,
+                                              const void *frames,
+                                              uint32_t nframes,
+                                              uint64_t presentation_ns,
+                                              int64_t *error_ns);
+/* Zero-copy writes: *frames receives space for up to *nframes frames (updated
+ * to what is actually available), render into it, then commit how many frames
+ * were written. On ALSA this is the mmap area when the device allows it.
+ * Always interleaved. */
+SINUSDEF int sinus_frames_begin_write (SinusContext *sc, void **frames,
+                                       uint32_t *nframes);
+SINUSDEF sinus_ssize_t sinus_frames_commit (SinusContext *sc,
+                                            uint32_t nframes);
 SINUSDEF sinus_ssize_t sinus_frames_get_n_frames_buffered (SinusContext *sc);
 SINUSDEF sinus_ssize_t sinus_frames_get_n_frames_free (SinusContext *sc);
 
+/* Submission queue: buffers are handed over instead of copied and a backend
+ * thread feeds them to the device back to back, in submission order. A
+ * buffer belongs to the library from sinus_submit until its completion is
+ * reaped, which happens once the device has taken all of it (it may still
+ * be queued for playback, but the memory is free again). Stopping the
+ * context completes the pending buffers with what was taken of them.
+ * Playback only, MUTUALLY EXCLUSIVE WITH sinus_frames_write* FUNCTIONS, the
+ * fill callback and SINUS_FLAG_RING. */
+#define SINUS_SUBMIT_MAX 64 // buffers submitted and not yet reaped
+
+typedef struct sinus_completion_s
+{
+    void *cookie;     // as given to sinus_submit
+    uint32_t nframes; // frames the device took, all of them unless stopped
+} SinusCompletion;
+
+/* frames are laid out as for sinus_frames_write. Returns < 0 when
+ * SINUS_SUBMIT_MAX buffers are still out, reap some first. */
+SINUSDEF int sinus_submit (SinusContext *sc, const void *frames,
+                           uint32_t nframes, void *cookie);
+/* Up to max completions, oldest first, without blocking. Returns how many. */
+SINUSDEF int sinus_reap (SinusContext *sc, SinusCompletion *completions,
+                         uint32_t max);
+/* eventfd that is readable while completions wait to be reaped; poll it,
+ * sinus_reap clears it */
+SINUSDEF int sinus_submit_fd (SinusContext *sc);
+
+/* Capture (SINUS_FLAG_CAPTURE, SINUS_FLAG_DUPLEX), always interleaved.
+ * Reading from a stopped context starts it, duplex playback included. For
+ * a fixed round trip, start, queue that much playback, then read and write
+ * a period at a time. Blocks until all nframes are there; returns frames
+ * read. */
+SINUSDEF sinus_ssize_t sinus_frames_read (SinusContext *sc, void *frames,
+                                          uint32_t nframes);
+/* Same, but gives up after timeout_us and returns what it got by then */
+SINUSDEF sinus_ssize_t sinus_frames_read_timed (SinusContext *sc, void *frames,
+                                                uint32_t nframes,
+                                                uint32_t timeout_us);
+/* Frames that can be read without blocking. An overrun is recovered (and
+ * counted) like a read would, < 0 when that fails. */
+SINUSDEF sinus_ssize_t sinus_frames_get_n_frames_available (SinusContext *sc);
+
+/* Histogram buckets: 0 counts zeros, bucket i > 0 counts values in
+ * [2^(i-1), 2^i), the last one everything above */
+#define SINUS_STATS_BUCKETS 32
+
+typedef struct sinus_stats_s
+{
+    uint64_t underruns;      // -EPIPE seen
+    uint64_t suspends;       // -ESTRPIPE seen
+    uint64_t recoveries;     // times the stream was brought back after either
+                             // (or any other error)
+    uint64_t frames_written; // accepted by sinus_frames_write* and friends
+    uint64_t short_writes;   // calls that took some but not all frames
+    uint64_t zero_writes;    // calls that took nothing
+    uint64_t overruns;       // capture: times frames were lost to a full
+                             // buffer
+    uint64_t frames_read;    // handed out by sinus_frames_read* and the
+                             // capture callback
+
+    uint64_t write_ns[SINUS_STATS_BUCKETS];   // time spent per write call
+    uint64_t fill_frames[SINUS_STATS_BUCKETS]; // frames buffered after it
+} SinusStats;
+
+/* Snapshot of the counters since sinus_context_init. Cheap and safe from any
+ * thread, the audio path only does relaxed atomic adds. */
+SINUSDEF void sinus_stats_get (SinusContext *sc, SinusStats *stats);
+
+#define SINUS_PROBE_MAX 16
+
+typedef struct sinus_probe_candidate_s
+{
+    const char *device; // the backend's name for it, static
+    int32_t result;     // 0 if it opened and took the settings, < 0 if not
+    uint64_t ns;        // time spent on it
+} SinusProbeCandidate;
+
+typedef struct sinus_probe_stats_s
+{
+    uint32_t count;    // candidates tried, in the order they were started
+    uint32_t chosen;   // index of the one in use
+    uint32_t cached;   // true: it came from the probe cache
+    uint32_t parallel; // true: the candidates were tried in parallel
+    uint64_t total_ns; // all of device probing in sinus_context_init
+    SinusProbeCandidate candidates[SINUS_PROBE_MAX];
+} SinusProbeStats;
+
+/* How sinus_context_init found its device. The device that worked is kept in
+ * $SINUS_PROBE_CACHE (default $XDG_CACHE_HOME/sinus/probe, "off" disables
+ * it) and tried first next time. */
+SINUSDEF void sinus_probe_stats (SinusContext *sc, SinusProbeStats *stats);
+
+struct pollfd;
+
+/* Event loop integration. The descriptors become ready when at least
+ * hint_min_write_frames can be written; poll them, then pass the returned
+ * revents through sinus_poll_revents, which sets POLLOUT in *revents when
+ * that much space is actually free. Not meant for pull mode. */
+SINUSDEF int sinus_poll_fds_count (SinusContext *sc);
+/* Fills up to nfds descriptors, returns how many or < 0 on error */
+SINUSDEF int sinus_poll_fds_get (SinusContext *sc, struct pollfd *fds,
+                                 uint32_t nfds);
+SINUSDEF int sinus_poll_revents (SinusContext *sc, struct pollfd *fds,
+                                 uint32_t nfds, unsigned short *revents);
+
 SINUSDEF uint32_t sinus_info_get_sample_rate (SinusContext *sc);
 SINUSDEF uint32_t sinus_info_get_channels (SinusContext *sc);
 SINUSDEF SinusFormat sinus_info_get_format (SinusContext *sc);
+/* Frames the backend currently aims to keep queued: buffer_frames, or the
+ * fill target with SINUS_FLAG_ADAPTIVE */
+SINUSDEF uint32_t sinus_info_get_buffer_target (SinusContext *sc);
 
 /* MUTUALLY EXCLUSIVE WITH sinus_frames_write* FUNCTIONS !!!*/
 typedef sinus_ssize_t (*SinusFillCallback) (void *frames,
@@ -88,4 +298,12 @@ typedef sinus_ssize_t (*SinusFillCallback) (void *frames,
 SINUSDEF sinus_ssize_t sinus_frames_fill_callback_set (SinusContext *sc,
                                                        SinusFillCallback cb);
 
+/* MUTUALLY EXCLUSIVE WITH sinus_frames_read* FUNCTIONS !!! Called from a
+ * backend thread with every period captured while the context runs; a
+ * return < 0 stops it. */
+typedef sinus_ssize_t (*SinusCaptureCallback) (const void *frames,
+                                               uint32_t nframes);
+SINUSDEF sinus_ssize_t sinus_frames_capture_callback_set (
+    SinusContext *sc, SinusCaptureCallback cb);
+
 #endif
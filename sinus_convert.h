@@ -0,0 +1,45 @@
+#ifndef _SINUS_CONVERT_H
+#define _SINUS_CONVERT_H
+
+/*
+ * Sample format conversion between any two SinusFormats.
+ *
+ * Integer <-> float scaling uses 2^(bits-1) in both directions, so integer
+ * samples survive a round trip through float unchanged. Float -> integer
+ * clamps to the integer range. The fastest kernels the CPU supports (AVX2,
+ * SSSE3, SSE2 or plain C) are picked on first use.
+ *
+ * U10_P5 takes sinus_format_bytes of space, whole groups of 4 samples; FLOAT
+ * and S16 pack into it directly, S16 rounding the same as through float.
+ */
+
+#include <sinus.h>
+
+#include <stddef.h>
+
+/* Convert nsamples samples (frames * channels). dst and src must not
+ * overlap unless the formats are equal. */
+SINUSDEF void sinus_convert (void *dst, SinusFormat dst_fmt, const void *src,
+                             SinusFormat src_fmt, size_t nsamples);
+
+SINUSDEF void sinus_convert_to_float (float *dst, const void *src,
+                                      SinusFormat src_fmt, size_t nsamples);
+SINUSDEF void sinus_convert_from_float (void *dst, SinusFormat dst_fmt,
+                                        const float *src, size_t nsamples);
+
+/* Planar <-> interleaved, one pointer per channel, nframes samples each.
+ * 16 and 32 bit samples have SIMD kernels for 2, 4, 6 and 8 channels. */
+SINUSDEF void sinus_interleave (void *dst, const void *const *src,
+                                SinusFormat fmt, uint32_t channels,
+                                uint32_t nframes);
+SINUSDEF void sinus_deinterleave (void *const *dst, const void *src,
+                                  SinusFormat fmt, uint32_t channels,
+                                  uint32_t nframes);
+
+/* nsamples samples of silence: zero, or midscale for the unsigned formats */
+SINUSDEF void sinus_silence (void *dst, SinusFormat fmt, size_t nsamples);
+
+/* Name of the instruction set the kernels were picked for */
+SINUSDEF const char *sinus_convert_isa (void);
+
+#endif
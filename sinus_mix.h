@@ -0,0 +1,48 @@
+#ifndef _SINUS_MIX_H
+#define _SINUS_MIX_H
+
+/*
+ * Software mixer: any number of independent sources on one SinusContext.
+ *
+ * Every stream has its own format, gain and ring buffer. A mixer thread,
+ * started with the first stream, sums whatever the streams have queued in
+ * float and converts the result into the context's format. Stream writers
+ * never block and never take a lock, a stream that falls behind just
+ * contributes silence.
+ *
+ * Streams run at the context's sample rate. While any are open the mixer
+ * owns the context's write side, don't call sinus_frames_write* or set a
+ * fill callback. The context still has to be started by the caller, and
+ * sinus_context_deinit closes streams that are left open.
+ */
+
+#include <sinus.h>
+
+#define SINUS_MIX_MAX_STREAMS 32
+
+typedef struct SinusStream SinusStream;
+
+typedef struct sinus_stream_settings_s
+{
+    SinusFormat fmt;        // sample format
+    uint32_t channels;      // the context's channel count, or 1 (copied to
+                            // every channel)
+    uint32_t buffer_frames; // ring buffer size (in frames)
+    float gain;             // linear, 1.0 is unity
+} SinusStreamSettings;
+
+SINUSDEF void sinus_stream_settings_default (SinusStreamSettings *ss);
+
+SINUSDEF int sinus_stream_open (SinusContext *sc, SinusStream **st,
+                                const SinusStreamSettings *ss);
+/* Frames still queued are dropped */
+SINUSDEF void sinus_stream_close (SinusStream *st);
+
+/* Queue interleaved frames, returns how many fit (never blocks) */
+SINUSDEF sinus_ssize_t sinus_stream_write (SinusStream *st, const void *frames,
+                                           uint32_t nframes);
+SINUSDEF sinus_ssize_t sinus_stream_get_n_frames_free (SinusStream *st);
+/* Takes effect from the next mix */
+SINUSDEF void sinus_stream_set_gain (SinusStream *st, float gain);
+
+#endif
@@ -0,0 +1,49 @@
+#ifndef _SINUS_OSC_H
+#define _SINUS_OSC_H
+
+/*
+ * Band-limited oscillators for tones and test signals.
+ *
+ * Every shape is a set of mipmapped wavetables, one per octave, each holding
+ * only the harmonics that stay below Nyquist for the pitches it plays. The
+ * tables are built once, on the first sinus_osc_init, and shared by all
+ * voices; a voice is just a phase accumulator, so dozens of them are cheap
+ * enough for a fill callback. Tables are read with linear interpolation,
+ * eight samples at a time on AVX2.
+ */
+
+#include <sinus.h>
+
+typedef enum sinus_osc_shape_e
+{
+    SINUS_OSC_SINE,
+    SINUS_OSC_SQUARE,
+    SINUS_OSC_SAW, // rising
+    SINUS_OSC_TRIANGLE,
+} SinusOscShape;
+
+typedef struct SinusOsc SinusOsc;
+
+SINUSDEF int sinus_osc_init (SinusOsc **osc, SinusOscShape shape,
+                             uint32_t sample_rate);
+SINUSDEF void sinus_osc_deinit (SinusOsc *osc);
+
+/* Anything from 0 up to Nyquist, higher is clamped. Picks the table, so
+ * glides should step it every block rather than every frame. */
+SINUSDEF void sinus_osc_set_frequency (SinusOsc *osc, float hz);
+/* Linear, 1.0 (the default) is full scale */
+SINUSDEF void sinus_osc_set_amplitude (SinusOsc *osc, float amplitude);
+/* In cycles, 0.0 - 1.0 */
+SINUSDEF void sinus_osc_set_phase (SinusOsc *osc, float phase);
+
+/* nframes mono float frames, overwriting dst */
+SINUSDEF void sinus_osc_render_float (SinusOsc *osc, float *dst,
+                                      uint32_t nframes);
+/* Same, added to what's in dst, for summing voices */
+SINUSDEF void sinus_osc_mix_float (SinusOsc *osc, float *dst,
+                                   uint32_t nframes);
+/* nframes interleaved frames of fmt, the same sample in every channel */
+SINUSDEF void sinus_osc_render (SinusOsc *osc, void *dst, SinusFormat fmt,
+                                uint32_t channels, uint32_t nframes);
+
+#endif
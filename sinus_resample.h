@@ -0,0 +1,32 @@
+#ifndef _SINUS_RESAMPLE_H
+#define _SINUS_RESAMPLE_H
+
+/*
+ * Streaming sample rate converter: polyphase windowed-sinc filter, one
+ * phase per output position of the reduced in/out rate ratio (quantized to
+ * 2048 phases for awkward ratios). Works on interleaved float frames.
+ */
+
+#include <sinus.h>
+
+typedef struct SinusResampler SinusResampler;
+
+SINUSDEF int sinus_resampler_init (SinusResampler **r, uint32_t channels,
+                                   uint32_t in_rate, uint32_t out_rate,
+                                   SinusResampleQuality quality);
+SINUSDEF void sinus_resampler_deinit (SinusResampler *r);
+
+/* Forget all history, as if freshly initialized */
+SINUSDEF void sinus_resampler_reset (SinusResampler *r);
+
+/* Consume up to *in_frames and produce up to *out_frames frames. Both are
+ * updated to the amounts actually consumed/produced. Input that doesn't
+ * produce output yet is kept inside, so nothing is lost between calls. */
+SINUSDEF void sinus_resampler_process (SinusResampler *r, const float *in,
+                                       uint32_t *in_frames, float *out,
+                                       uint32_t *out_frames);
+
+/* Filter delay in input frames */
+SINUSDEF uint32_t sinus_resampler_latency (const SinusResampler *r);
+
+#endif
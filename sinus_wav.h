@@ -0,0 +1,52 @@
+#ifndef _SINUS_WAV_H
+#define _SINUS_WAV_H
+
+/*
+ * Streaming WAV source. The file is mmap'd and read front to back, so
+ * frames in the file's own format are handed out without a copy. Reads
+ * RIFF/WAVE, RF64/BW64 (64 bit sizes in a ds64 chunk) and Sony Wave64.
+ *
+ * Integer PCM of 8, 16, 24 and 32 bits and float of 32 and 64 bits, plain
+ * or WAVE_FORMAT_EXTENSIBLE.
+ */
+
+#include <sinus.h>
+
+typedef struct SinusSourceWav SinusSourceWav;
+
+SINUSDEF int sinus_source_wav_open (SinusSourceWav **wav, const char *path);
+SINUSDEF void sinus_source_wav_close (SinusSourceWav *wav);
+
+SINUSDEF SinusFormat sinus_source_wav_get_format (SinusSourceWav *wav);
+SINUSDEF uint32_t sinus_source_wav_get_channels (SinusSourceWav *wav);
+SINUSDEF uint32_t sinus_source_wav_get_sample_rate (SinusSourceWav *wav);
+SINUSDEF uint64_t sinus_source_wav_get_n_frames (SinusSourceWav *wav);
+/* Frames between the read position and the end */
+SINUSDEF uint64_t sinus_source_wav_get_n_frames_left (SinusSourceWav *wav);
+
+SINUSDEF int sinus_source_wav_seek (SinusSourceWav *wav, uint64_t frame);
+
+/* Zero-copy: *frames points at up to nframes frames at the read position,
+ * in the file's format, valid until close. Returns how many and moves the
+ * read position past them, 0 at the end. */
+SINUSDEF uint32_t sinus_source_wav_frames (SinusSourceWav *wav,
+                                           const void **frames,
+                                           uint32_t nframes);
+
+/* Copy up to nframes frames into dst as interleaved fmt with channels
+ * channels. Missing channels repeat the file's last one, extra ones are
+ * dropped. Returns frames read, 0 at the end. Suits a fill callback. */
+SINUSDEF sinus_ssize_t sinus_source_wav_read (SinusSourceWav *wav, void *dst,
+                                              SinusFormat fmt,
+                                              uint32_t channels,
+                                              uint32_t nframes);
+
+/* Write as much as sc takes right now, without blocking. When the context
+ * runs in the file's format and channel count the frames go straight from
+ * the mapping to sinus_frames_write, otherwise they're converted into
+ * sinus_frames_begin_write's buffer. Expects an interleaved context.
+ * Returns frames written, < 0 on error. */
+SINUSDEF sinus_ssize_t sinus_source_wav_write (SinusSourceWav *wav,
+                                               SinusContext *sc);
+
+#endif
@@ -1,28 +1,58 @@
 #include "sinus.h"
-
-#include "square.h"
+#include "sinus_osc.h"
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <limits.h>
 
+#define TONE_HZ 440.0f
+#define TONE_SECONDS 2
+#define CHUNK_FRAMES 1024
+
 int
 main (void)
 {
     SinusContext *sc;
-    sinus_context_init (&sc, NULL, NULL);
+    if (sinus_context_init (&sc, NULL, NULL) != 0)
+        return 1;
+
+    uint32_t rate = sinus_info_get_sample_rate (sc);
+    uint32_t channels = sinus_info_get_channels (sc);
+    SinusFormat fmt = sinus_info_get_format (sc);
+
+    SinusOsc *osc;
+    if (sinus_osc_init (&osc, SINUS_OSC_SQUARE, rate) != 0)
+    {
+        sinus_context_deinit (sc);
+        return 1;
+    }
+    sinus_osc_set_frequency (osc, TONE_HZ);
+    sinus_osc_set_amplitude (osc, 0.5f);
+
+    size_t frame_bytes = (size_t)sinus_format_to_size (fmt) * channels;
+    uint8_t *chunk = malloc (frame_bytes * CHUNK_FRAMES);
+    if (!chunk)
+    {
+        sinus_osc_deinit (osc);
+        sinus_context_deinit (sc);
+        return 1;
+    }
 
     sinus_control_start (sc);
 
-    for (uint32_t i = 0; i < 5; ++i)
+    for (uint32_t played = 0; played < rate * TONE_SECONDS;
+         played += CHUNK_FRAMES)
     {
+        sinus_osc_render (osc, chunk, fmt, channels, CHUNK_FRAMES);
+
         uint32_t w = 0;
 
-        while (w < SQUARE_SAMPLE_COUNT)
+        while (w < CHUNK_FRAMES)
         {
-            sinus_ssize_t n = sinus_frames_write (sc, square_sample_table,
-                                                  SQUARE_SAMPLE_COUNT);
+            sinus_ssize_t n = sinus_frames_write (sc, chunk + w * frame_bytes,
+                                                  CHUNK_FRAMES - w);
             if (n < 0)
             {
                 break;
@@ -48,5 +78,7 @@ main (void)
     getchar ();
 
     sinus_context_deinit (sc);
+    sinus_osc_deinit (osc);
+    free (chunk);
     return 0;
 }
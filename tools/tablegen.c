@@ -0,0 +1,405 @@
+/*
+ * Table generator: one cycle of a waveform, or a gain curve, as a C header
+ * in any SinusFormat, ready for the loop that plays it.
+ *
+ *   tablegen --shape square --format u8 --length 1024 --name square > t.h
+ *
+ * Shapes:
+ *   sine, square, saw, triangle   - naive, with every discontinuity
+ *   bl-square, bl-saw, bl-triangle - band-limited (additive, --harmonics)
+ *   gain-db    - fader taper, --min-db at index 1 up to 0 dB, index 0 mutes
+ *   gain-power - equal-power fade in, sin (x * pi / 2)
+ *
+ * Samples are computed in double, scaled by --amplitude and go through
+ * sinus_convert_from_float, so they come out exactly as the runtime would
+ * convert them. --progmem puts the table in AVR flash (read it with
+ * pgm_read_*, on other targets PROGMEM is empty), --align N aligns it for
+ * SIMD loads on hosts.
+ */
+
+#define _GNU_SOURCE
+
+#include <sinus.h>
+#include <sinus_convert.h>
+
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_WIDTH 80
+
+static const struct
+{
+    const char *name;
+    SinusFormat fmt;
+    const char *type; // C element type, P3 formats are bytes
+    uint32_t bits;
+} formats[] = {
+    { "s8", SINUS_FORMAT_S8, "int8_t", 8 },
+    { "u8", SINUS_FORMAT_U8, "uint8_t", 8 },
+    { "s16", SINUS_FORMAT_S16, "int16_t", 16 },
+    { "u16", SINUS_FORMAT_U16, "uint16_t", 16 },
+    { "s24_u4", SINUS_FORMAT_S24_U4, "int32_t", 24 },
+    { "u24_u4", SINUS_FORMAT_U24_U4, "uint32_t", 24 },
+    { "s24_p3", SINUS_FORMAT_S24_P3, "uint8_t", 24 },
+    { "u24_p3", SINUS_FORMAT_U24_P3, "uint8_t", 24 },
+    { "float", SINUS_FORMAT_FLOAT, "float", 32 },
+    { "float64", SINUS_FORMAT_FLOAT64, "double", 64 },
+    { "s32", SINUS_FORMAT_S32, "int32_t", 32 },
+};
+
+typedef struct
+{
+    const char *shape;
+    uint32_t format; // index into formats
+    uint32_t length;
+    double amplitude;
+    double phase;       // cycles
+    uint32_t harmonics; // bl-*, 0 for everything below Nyquist
+    double min_db;      // gain-db
+    const char *name;
+    bool progmem;
+    uint32_t align;
+} Options;
+
+static void
+usage (const char *argv0)
+{
+    fprintf (stderr,
+             "usage: %s --shape SHAPE [--format FMT] [--length N]\n"
+             "       [--amplitude A] [--phase CYCLES] [--harmonics N]\n"
+             "       [--min-db DB] [--name NAME] [--progmem | --align N]\n"
+             "shapes: sine square saw triangle bl-square bl-saw "
+             "bl-triangle\n"
+             "        gain-db gain-power\n"
+             "formats:",
+             argv0);
+    for (size_t i = 0; i < sizeof (formats) / sizeof (formats[0]); ++i)
+        fprintf (stderr, " %s", formats[i].name);
+    fprintf (stderr, "\n");
+}
+
+/* Harmonic h of the band-limited shapes, before normalizing */
+static double
+harmonic (const char *shape, uint32_t h)
+{
+    if (strcmp (shape, "bl-square") == 0)
+        return h % 2 ? 1.0 / h : 0.0;
+    if (strcmp (shape, "bl-saw") == 0)
+        return (h % 2 ? 1.0 : -1.0) / h;
+    if (strcmp (shape, "bl-triangle") == 0)
+        return h % 2 ? (h % 4 == 1 ? 1.0 : -1.0) / ((double)h * h) : 0.0;
+    return 0.0;
+}
+
+/* One period of shape at x in [0, 1) */
+static double
+naive (const char *shape, double x)
+{
+    if (strcmp (shape, "sine") == 0)
+        return sin (2.0 * M_PI * x);
+    if (strcmp (shape, "square") == 0)
+        return x < 0.5 ? 1.0 : -1.0;
+    if (strcmp (shape, "saw") == 0)
+        return x < 0.5 ? 2.0 * x : 2.0 * x - 2.0;
+    if (strcmp (shape, "triangle") == 0)
+        return x < 0.25 ? 4.0 * x : x < 0.75 ? 2.0 - 4.0 * x : 4.0 * x - 4.0;
+    return NAN;
+}
+
+/* Fills out with o->length samples in -1.0 - 1.0, false on a bad shape */
+static bool
+generate (const Options *o, double *out)
+{
+    uint32_t n = o->length;
+
+    if (strcmp (o->shape, "gain-db") == 0)
+    {
+        out[0] = 0.0;
+        for (uint32_t i = 1; i < n; ++i)
+        {
+            double db = n > 2 ? o->min_db * (n - 1 - i) / (n - 2) : 0.0;
+            out[i] = pow (10.0, db / 20.0);
+        }
+        return true;
+    }
+
+    if (strcmp (o->shape, "gain-power") == 0)
+    {
+        for (uint32_t i = 0; i < n; ++i)
+            out[i] = sin (M_PI / 2.0 * (n > 1 ? (double)i / (n - 1) : 1.0));
+        return true;
+    }
+
+    if (strncmp (o->shape, "bl-", 3) == 0)
+    {
+        uint32_t top = n / 2 > 0 ? n / 2 - (n % 2 == 0) : 0; // below Nyquist
+        if (o->harmonics > 0 && o->harmonics < top)
+            top = o->harmonics;
+        if (top == 0 || harmonic (o->shape, 1) == 0.0)
+            return false;
+
+        double peak = 0.0;
+        for (uint32_t i = 0; i < n; ++i)
+        {
+            double x = 2.0 * M_PI * ((double)i / n + o->phase);
+            double sum = 0.0;
+            for (uint32_t h = 1; h <= top; ++h)
+                sum += harmonic (o->shape, h) * sin (h * x);
+            out[i] = sum;
+            if (fabs (sum) > peak)
+                peak = fabs (sum);
+        }
+
+        for (uint32_t i = 0; i < n; ++i)
+            out[i] /= peak;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < n; ++i)
+    {
+        double x = (double)i / n + o->phase;
+        out[i] = naive (o->shape, x - floor (x));
+        if (isnan (out[i]))
+            return false;
+    }
+    return true;
+}
+
+/* %g, but always a floating literal: "1" would be an int, "1f" invalid */
+static int
+format_real (char *buf, size_t size, double v, int digits, const char *suffix)
+{
+    int len = snprintf (buf, size, "%.*g", digits, v);
+    bool integral = strpbrk (buf, ".e") == NULL;
+
+    return snprintf (buf + len, size - (size_t)len, "%s%s",
+                     integral ? ".0" : "", suffix)
+           + len;
+}
+
+/* One element of the converted table as C source */
+static int
+format_element (char *buf, size_t size, SinusFormat fmt, const void *data,
+                size_t i)
+{
+    switch (fmt)
+    {
+    case SINUS_FORMAT_S8:
+        return snprintf (buf, size, "%d", ((const int8_t *)data)[i]);
+    case SINUS_FORMAT_S16:
+        return snprintf (buf, size, "%d", ((const int16_t *)data)[i]);
+    case SINUS_FORMAT_U16:
+        return snprintf (buf, size, "%u", ((const uint16_t *)data)[i]);
+    case SINUS_FORMAT_S24_U4:
+    case SINUS_FORMAT_S32:
+    {
+        int32_t v = ((const int32_t *)data)[i];
+        /* INT32_MIN has no literal of its own */
+        if (v == INT32_MIN)
+            return snprintf (buf, size, "INT32_MIN");
+        return snprintf (buf, size, "%ld", (long)v);
+    }
+    case SINUS_FORMAT_U24_U4:
+        return snprintf (buf, size, "%luU",
+                         (unsigned long)((const uint32_t *)data)[i]);
+    case SINUS_FORMAT_FLOAT:
+        return format_real (buf, size, ((const float *)data)[i], 9, "f");
+    case SINUS_FORMAT_FLOAT64:
+        return format_real (buf, size, ((const double *)data)[i], 17, "");
+    default: // bytes: U8 and the P3 formats
+        return snprintf (buf, size, "%u", ((const uint8_t *)data)[i]);
+    }
+}
+
+static void
+to_upper (char *dst, size_t size, const char *src)
+{
+    size_t k = 0;
+    for (; src[k] && k < size - 1; ++k)
+        dst[k] = (char)toupper ((unsigned char)src[k]);
+    dst[k] = '\0';
+}
+
+static void
+emit (const Options *o, const void *data, int argc, char **argv)
+{
+    SinusFormat fmt = formats[o->format].fmt;
+    size_t bytes = (size_t)sinus_format_to_size (fmt);
+    bool p3 = fmt == SINUS_FORMAT_S24_P3 || fmt == SINUS_FORMAT_U24_P3;
+    size_t elements = p3 ? (size_t)o->length * 3 : o->length;
+
+    char upper[128];
+    char fmt_upper[16];
+    to_upper (upper, sizeof (upper), o->name);
+    to_upper (fmt_upper, sizeof (fmt_upper), formats[o->format].name);
+
+    printf ("/*\n * Generated by tools/tablegen, do not edit:\n *  ");
+    for (int i = 0; i < argc; ++i)
+        printf (" %s", i == 0 ? "tablegen" : argv[i]);
+    printf ("\n */\n\n");
+
+    printf ("#ifndef _%s_H\n#define _%s_H\n\n", upper, upper);
+    printf ("#include <stdint.h>\n");
+    /* Off the AVR the table is plain const data, so hosts can include it */
+    if (o->progmem)
+        printf ("#ifdef __AVR__\n#include <avr/pgmspace.h>\n"
+                "#elif !defined(PROGMEM)\n#define PROGMEM\n#endif\n");
+    printf ("\n");
+
+    printf ("#define %s_SAMPLE_COUNT %u\n", upper, o->length);
+    printf ("#define %s_SAMPLE_WIDTH %u\n", upper, formats[o->format].bits);
+    printf ("#define %s_SAMPLE_BYTES %zu\n", upper, bytes);
+    printf ("#define %s_SAMPLE_FORMAT SINUS_FORMAT_%s\n\n", upper,
+            fmt_upper);
+
+    printf ("static const %s %s_sample_table[%zu]", formats[o->format].type,
+            o->name, elements);
+    if (o->progmem)
+        printf (" PROGMEM");
+    else if (o->align > 1)
+        printf ("\n    __attribute__ ((aligned (%u)))", o->align);
+    printf (" = {\n");
+
+    size_t col = 0;
+    for (size_t i = 0; i < elements; ++i)
+    {
+        char item[48];
+        int len = format_element (item, sizeof (item), fmt, data, i);
+
+        if (col > 0 && col + 1 + (size_t)len + 1 > LINE_WIDTH)
+        {
+            printf (",\n");
+            col = 0;
+        }
+        else if (col > 0)
+        {
+            printf (", ");
+            col += 1;
+        }
+
+        if (col == 0)
+        {
+            printf ("    ");
+            col = 4;
+        }
+
+        printf ("%s", item);
+        col += (size_t)len + 1;
+    }
+    printf ("\n};\n\n#endif // _%s_H\n", upper);
+}
+
+int
+main (int argc, char **argv)
+{
+    Options o = {
+        .shape = NULL,
+        .format = 1, // u8
+        .length = 1024,
+        .amplitude = 1.0,
+        .phase = 0.0,
+        .harmonics = 0,
+        .min_db = -60.0,
+        .name = "table",
+        .progmem = false,
+        .align = 0,
+    };
+
+    for (int i = 1; i < argc; ++i)
+    {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        bool takes_value = true;
+
+        if (strcmp (arg, "--progmem") == 0)
+        {
+            o.progmem = true;
+            takes_value = false;
+        }
+        else if (!val)
+        {
+            usage (argv[0]);
+            return 1;
+        }
+        else if (strcmp (arg, "--shape") == 0)
+            o.shape = val;
+        else if (strcmp (arg, "--format") == 0)
+        {
+            size_t f = 0;
+            size_t count = sizeof (formats) / sizeof (formats[0]);
+            while (f < count && strcmp (formats[f].name, val) != 0)
+                ++f;
+            if (f == count)
+            {
+                usage (argv[0]);
+                return 1;
+            }
+            o.format = (uint32_t)f;
+        }
+        else if (strcmp (arg, "--length") == 0)
+            o.length = (uint32_t)strtoul (val, NULL, 0);
+        else if (strcmp (arg, "--amplitude") == 0)
+            o.amplitude = strtod (val, NULL);
+        else if (strcmp (arg, "--phase") == 0)
+            o.phase = strtod (val, NULL);
+        else if (strcmp (arg, "--harmonics") == 0)
+            o.harmonics = (uint32_t)strtoul (val, NULL, 0);
+        else if (strcmp (arg, "--min-db") == 0)
+            o.min_db = strtod (val, NULL);
+        else if (strcmp (arg, "--name") == 0)
+            o.name = val;
+        else if (strcmp (arg, "--align") == 0)
+            o.align = (uint32_t)strtoul (val, NULL, 0);
+        else
+        {
+            usage (argv[0]);
+            return 1;
+        }
+
+        if (takes_value)
+            ++i;
+    }
+
+    if (!o.shape || o.length == 0 || (o.align & (o.align - 1)) != 0
+        || (o.progmem && o.align > 1))
+    {
+        usage (argv[0]);
+        return 1;
+    }
+
+    double *samples = malloc (o.length * sizeof (double));
+    float *scaled = malloc (o.length * sizeof (float));
+    void *data = malloc (o.length * 8);
+    if (!samples || !scaled || !data)
+        return 1;
+
+    if (!generate (&o, samples))
+    {
+        fprintf (stderr, "%s: can't make '%s' at length %u\n", argv[0],
+                 o.shape, o.length);
+        return 1;
+    }
+
+    /* float64 would only lose bits going through float */
+    if (formats[o.format].fmt == SINUS_FORMAT_FLOAT64)
+        for (uint32_t i = 0; i < o.length; ++i)
+            ((double *)data)[i] = samples[i] * o.amplitude;
+    else
+    {
+        for (uint32_t i = 0; i < o.length; ++i)
+            scaled[i] = (float)(samples[i] * o.amplitude);
+        sinus_convert_from_float (data, formats[o.format].fmt, scaled,
+                                  o.length);
+    }
+    emit (&o, data, argc, argv);
+
+    free (data);
+    free (scaled);
+    free (samples);
+    return 0;
+}